@@ -0,0 +1,422 @@
+#include "bcache.h"
+#include "writeback.h"
+#include <stddef.h>
+#include <string.h>
+
+// Fixed cache memory: BCACHE_BLOCKS * BLOCK_SIZE bytes
+static uint8_t cache_data[BCACHE_BLOCKS][BLOCK_SIZE];
+static struct buffer_head buffers[BCACHE_BLOCKS];
+static struct buffer_head *hash_table[BCACHE_HASH_SIZE];
+static uint32_t clock_hand = 0;
+static int bcache_ready = 0;
+static struct bcache_stats stats;
+static struct writeback *wb_sets[WB_MAX_MOUNTS]; // Dirty-block sets of the mounted filesystems
+
+static inline uint32_t bcache_hash(uint32_t block) {
+    return (block * 2654435761u) % BCACHE_HASH_SIZE;
+}
+
+// Dirty-block set whose range holds block, or NULL
+static struct writeback *wb_of(uint32_t block) {
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        struct writeback *wb = wb_sets[i];
+        if (wb != NULL && block - wb->first < wb->nblocks) {
+            return wb;
+        }
+    }
+    return NULL;
+}
+
+static inline void wb_clear(uint32_t block) {
+    struct writeback *wb = wb_of(block);
+    if (wb != NULL) {
+        writeback_clear(wb, block);
+    }
+}
+
+static void bcache_init(void) {
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        buffers[i].block = 0;
+        buffers[i].flags = 0;
+        buffers[i].count = 0;
+        buffers[i].hash_next = NULL;
+        buffers[i].data = cache_data[i];
+    }
+    bcache_ready = 1;
+}
+
+static struct buffer_head *bcache_lookup(uint32_t block) {
+    struct buffer_head *bh = hash_table[bcache_hash(block)];
+    while (bh != NULL && bh->block != block) {
+        bh = bh->hash_next;
+    }
+    return bh;
+}
+
+static void bcache_hash_insert(struct buffer_head *bh) {
+    uint32_t slot = bcache_hash(bh->block);
+    bh->hash_next = hash_table[slot];
+    hash_table[slot] = bh;
+    bh->flags |= BH_HASHED;
+}
+
+static void bcache_unhash(struct buffer_head *bh) {
+    struct buffer_head **link = &hash_table[bcache_hash(bh->block)];
+    while (*link != NULL) {
+        if (*link == bh) {
+            *link = bh->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    bh->hash_next = NULL;
+    bh->flags &= ~BH_HASHED;
+}
+
+static int bcache_writeback(struct buffer_head *bh) {
+    if (write_block(bh->block, bh->data) != 0) {
+        return -1;
+    }
+    bh->flags &= ~BH_DIRTY;
+    wb_clear(bh->block);
+    stats.writebacks++;
+    return 0;
+}
+
+// CLOCK eviction: skip pinned buffers, give referenced ones a second chance
+static struct buffer_head *bcache_evict(void) {
+    for (int scanned = 0; scanned < 2 * BCACHE_BLOCKS; scanned++) {
+        struct buffer_head *bh = &buffers[clock_hand];
+        clock_hand = (clock_hand + 1) % BCACHE_BLOCKS;
+
+        if (bh->count != 0) {
+            continue;
+        }
+        if (bh->flags & BH_REFERENCED) {
+            bh->flags &= ~BH_REFERENCED;
+            continue;
+        }
+        if ((bh->flags & BH_DIRTY) && bcache_writeback(bh) != 0) {
+            continue;
+        }
+        // A dropped buffer is still hashed without being valid
+        if (bh->flags & BH_HASHED) {
+            bcache_unhash(bh);
+        }
+        if (bh->flags & BH_VALID) {
+            stats.evictions++;
+        }
+        if (bh->flags & BH_READAHEAD) {
+            stats.ra_wasted++;
+        }
+        bh->flags = 0;
+        return bh;
+    }
+    return NULL; // Every buffer is pinned or failed to write back
+}
+
+// Find or allocate the buffer for a block, pinned, without reading it
+static struct buffer_head *bcache_get(uint32_t block) {
+    if (!bcache_ready) {
+        bcache_init();
+    }
+
+    struct buffer_head *bh = bcache_lookup(block);
+    if (bh != NULL) {
+        stats.hits++;
+        if (bh->flags & BH_READAHEAD) {
+            stats.ra_hits++;
+        }
+        bh->count++;
+        bh->flags = (bh->flags & ~BH_READAHEAD) | BH_REFERENCED;
+        return bh;
+    }
+
+    stats.misses++;
+    bh = bcache_evict();
+    if (bh == NULL) {
+        return NULL;
+    }
+
+    bh->block = block;
+    bh->count = 1;
+    bh->flags = BH_REFERENCED;
+    bcache_hash_insert(bh);
+    return bh;
+}
+
+static void bcache_discard(struct buffer_head *bh) {
+    if (bh->flags & BH_READAHEAD) {
+        stats.ra_wasted++;
+    }
+    bcache_unhash(bh);
+    bh->flags = 0;
+    bh->count = 0;
+}
+
+struct buffer_head *bread(uint32_t block) {
+    struct buffer_head *bh = bcache_get(block);
+    if (bh == NULL || (bh->flags & BH_VALID)) {
+        return bh;
+    }
+
+    if (read_block(block, bh->data) != 0) {
+        bcache_discard(bh);
+        return NULL;
+    }
+    bh->flags |= BH_VALID;
+    return bh;
+}
+
+struct buffer_head *bgetblk(uint32_t block) {
+    struct buffer_head *bh = bcache_get(block);
+    if (bh != NULL && !(bh->flags & BH_VALID)) {
+        // Caller overwrites the block, so skip the device read
+        memset(bh->data, 0, BLOCK_SIZE);
+        bh->flags |= BH_VALID;
+    }
+    return bh;
+}
+
+uint32_t bcache_prefetch(uint32_t start, uint32_t count) {
+    struct buffer_head *run[BCACHE_BLOCKS];
+    struct block_iovec iov[BCACHE_BLOCKS];
+    uint32_t issued = 0;
+
+    if (!bcache_ready) {
+        bcache_init();
+    }
+    if (start >= block_count()) {
+        return 0;
+    }
+    if (count > block_count() - start) {
+        count = block_count() - start;
+    }
+
+    // Gather runs of uncached blocks and read each with one request
+    uint32_t block = start;
+    int exhausted = 0;
+    while (block < start + count && !exhausted) {
+        if (bcache_lookup(block) != NULL) {
+            block++;
+            continue;
+        }
+
+        uint32_t first = block;
+        int n = 0;
+        while (block < start + count && n < BCACHE_BLOCKS / 2 && bcache_lookup(block) == NULL) {
+            // Pinned while the read is in flight so the run cannot recycle itself
+            struct buffer_head *bh = bcache_evict();
+            if (bh == NULL) {
+                exhausted = 1;
+                break;
+            }
+            bh->count = 1;
+            run[n] = bh;
+            iov[n].base = bh->data;
+            iov[n].len = BLOCK_SIZE;
+            n++;
+            block++;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        int ok = read_blocks(first, n, iov, n) == 0;
+        for (int i = 0; i < n; i++) {
+            run[i]->count = 0;
+            if (ok) {
+                // One CLOCK pass of grace so the window survives until it is read
+                run[i]->block = first + i;
+                run[i]->flags = BH_VALID | BH_READAHEAD | BH_REFERENCED;
+                bcache_hash_insert(run[i]);
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        issued += n;
+    }
+    return issued;
+}
+
+void bcache_forget(uint32_t start, uint32_t count) {
+    if (!bcache_ready) {
+        return;
+    }
+    for (uint32_t block = start; block < start + count; block++) {
+        struct buffer_head *bh = bcache_lookup(block);
+        if (bh != NULL && bh->count == 0 && !(bh->flags & BH_DIRTY)) {
+            bcache_discard(bh);
+        }
+    }
+}
+
+void bcache_drop(uint32_t start, uint32_t count) {
+    if (!bcache_ready) {
+        return;
+    }
+    for (uint32_t block = start; block < start + count; block++) {
+        struct buffer_head *bh = bcache_lookup(block);
+        if (bh == NULL) {
+            continue;
+        }
+        if (bh->flags & BH_DIRTY) {
+            wb_clear(block);
+        }
+        if (bh->count == 0) {
+            bcache_discard(bh);
+        } else {
+            // Still pinned: never write it back, and make the next user re-read
+            bh->flags &= ~(BH_DIRTY | BH_VALID);
+        }
+    }
+}
+
+void bwrite(struct buffer_head *bh) {
+    struct writeback *wb = wb_of(bh->block);
+    if (wb == NULL) {
+        bh->flags |= BH_DIRTY | BH_VALID;
+        return;
+    }
+    if (!(bh->flags & BH_DIRTY)) {
+        writeback_mark(wb, bh->block);
+    }
+    bh->flags |= BH_DIRTY | BH_VALID;
+
+    // Throttle the writer once too much of the cache is dirty
+    writeback_balance(wb, BCACHE_BLOCKS);
+}
+
+int bcache_attach_writeback(struct writeback *wb) {
+    if (!bcache_ready) {
+        bcache_init();
+    }
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        if (wb_sets[i] == NULL) {
+            wb_sets[i] = wb;
+            // Pick up what its range already has dirty
+            for (int b = 0; b < BCACHE_BLOCKS; b++) {
+                if (buffers[b].flags & BH_DIRTY) {
+                    writeback_mark(wb, buffers[b].block);
+                }
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void bcache_detach_writeback(struct writeback *wb) {
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        if (wb_sets[i] == wb) {
+            wb_sets[i] = NULL;
+        }
+    }
+}
+
+void brelse(struct buffer_head *bh) {
+    if (bh != NULL && bh->count > 0) {
+        bh->count--;
+    }
+}
+
+// Collect the dirty buffers sorted by block number. For one dirty-block
+// set only its dirty blocks are visited, already in order; otherwise the
+// whole cache is scanned and sorted.
+static int bcache_collect_dirty(struct writeback *wb, struct buffer_head **dirty) {
+    int ndirty = 0;
+
+    if (wb != NULL) {
+        uint32_t block = writeback_next(wb, 0);
+        while (block != UINT32_MAX && ndirty < BCACHE_BLOCKS) {
+            struct buffer_head *bh = bcache_lookup(block);
+            if (bh != NULL && (bh->flags & BH_DIRTY)) {
+                dirty[ndirty++] = bh;
+            } else {
+                writeback_clear(wb, block); // Dropped or written around the cache
+            }
+            block = writeback_next(wb, block + 1);
+        }
+        return ndirty;
+    }
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        if (buffers[i].flags & BH_DIRTY) {
+            // Insertion sort by block number keeps adjacent blocks together
+            int j = ndirty++;
+            while (j > 0 && dirty[j - 1]->block > buffers[i].block) {
+                dirty[j] = dirty[j - 1];
+                j--;
+            }
+            dirty[j] = &buffers[i];
+        }
+    }
+    return ndirty;
+}
+
+// Write back dirty buffers in block order, one vectored write per run
+static int bcache_flush(struct writeback *wb) {
+    struct buffer_head *dirty[BCACHE_BLOCKS];
+    struct block_iovec iov[BCACHE_BLOCKS];
+    int status = 0;
+
+    if (!bcache_ready) {
+        return 0;
+    }
+
+    int ndirty = bcache_collect_dirty(wb, dirty);
+    for (int first = 0; first < ndirty;) {
+        int run = 0;
+        while (first + run < ndirty && dirty[first + run]->block == dirty[first]->block + run) {
+            iov[run].base = dirty[first + run]->data;
+            iov[run].len = BLOCK_SIZE;
+            run++;
+        }
+
+        if (write_blocks(dirty[first]->block, run, iov, run) == 0) {
+            for (int i = first; i < first + run; i++) {
+                dirty[i]->flags &= ~BH_DIRTY;
+                wb_clear(dirty[i]->block);
+            }
+            stats.writebacks += run;
+        } else {
+            status = -1;
+        }
+        first += run;
+    }
+
+    // Make the written blocks durable on persistent backends
+    if (block_sync() != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+int bflush(void) {
+    return bcache_flush(NULL);
+}
+
+int bflush_writeback(struct writeback *wb) {
+    return bcache_flush(wb);
+}
+
+int binvalidate(void) {
+    int status = bflush();
+    if (!bcache_ready) {
+        return status;
+    }
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        if (buffers[i].count != 0) {
+            status = -1; // Still in use, cannot be dropped
+        } else if ((buffers[i].flags & (BH_HASHED | BH_DIRTY)) == BH_HASHED) {
+            bcache_discard(&buffers[i]);
+        }
+    }
+    return status;
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    *out = stats;
+}
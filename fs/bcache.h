@@ -0,0 +1,80 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+// Buffer cache budget (in blocks) and lookup hash size
+#define BCACHE_BLOCKS 256
+#define BCACHE_HASH_SIZE 512
+
+// Buffer state flags
+#define BH_VALID      0x01  // Data matches (or supersedes) the disk contents
+#define BH_DIRTY      0x02  // Data must be written back before eviction
+#define BH_REFERENCED 0x04  // CLOCK reference bit
+#define BH_READAHEAD  0x08  // Prefetched and not yet used
+#define BH_HASHED     0x10  // Linked in the lookup hash under block
+
+// Cached block
+struct buffer_head {
+    uint32_t block;                 // Block number on the device
+    uint16_t flags;                 // BH_* flags
+    uint16_t count;                 // Number of active users (pinned while > 0)
+    struct buffer_head *hash_next;  // Next buffer in the same hash bucket
+    uint8_t *data;                  // BLOCK_SIZE bytes of block data
+};
+
+// Counters used to size the cache
+struct bcache_stats {
+    uint64_t hits;        // Lookups served from the cache
+    uint64_t misses;      // Lookups that had to read the device
+    uint64_t evictions;   // Buffers recycled for another block
+    uint64_t writebacks;  // Dirty buffers written to the device
+    uint64_t ra_hits;     // Prefetched buffers that were used
+    uint64_t ra_wasted;   // Prefetched buffers dropped before use
+};
+
+// Get a pinned buffer holding the contents of a block (NULL on error)
+struct buffer_head *bread(uint32_t block);
+
+// Get a pinned buffer for a block that the caller will overwrite entirely
+struct buffer_head *bgetblk(uint32_t block);
+
+// Read the uncached blocks of [start, start + count) into the cache without
+// pinning them; returns the number of blocks read from the device
+uint32_t bcache_prefetch(uint32_t start, uint32_t count);
+
+// Mark a buffer dirty; it is written back on eviction or bflush()
+void bwrite(struct buffer_head *bh);
+
+// Track the dirty buffers of a filesystem's block range in its dirty-block
+// set: bflush_writeback() then walks only that filesystem's dirty blocks,
+// and bwrite() flushes them early once the set exceeds its dirty ratio of
+// the cache. Up to WB_MAX_MOUNTS sets, with disjoint ranges.
+struct writeback;
+int bcache_attach_writeback(struct writeback *wb);
+void bcache_detach_writeback(struct writeback *wb);
+
+// Release a buffer obtained from bread()/bgetblk()
+void brelse(struct buffer_head *bh);
+
+// Write back every dirty buffer and sync the backend
+int bflush(void);
+
+// Write back the dirty buffers of one dirty-block set and sync the backend
+int bflush_writeback(struct writeback *wb);
+
+// Flush and drop every cached block (e.g. before switching block backends)
+int binvalidate(void);
+
+// Drop clean cached copies of blocks that were written around the cache
+void bcache_forget(uint32_t start, uint32_t count);
+
+// Drop cached copies of freed blocks, dirty ones included, so a stale
+// buffer is never written over the block's next owner
+void bcache_drop(uint32_t start, uint32_t count);
+
+// Read the cache counters
+void bcache_get_stats(struct bcache_stats *stats);
+
+#endif // BCACHE_H
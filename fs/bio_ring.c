@@ -0,0 +1,200 @@
+#include "bio_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+int bio_ring_init(struct bio_ring *ring, uint32_t entries, bio_complete_fn complete, void *arg) {
+    memset(ring, 0, sizeof(*ring));
+    if (entries == 0 || entries > (1u << 16)) {
+        return -1;
+    }
+
+    uint32_t size = 1;
+    while (size < entries) {
+        size <<= 1;
+    }
+    ring->entries = size;
+    ring->mask = size - 1;
+    ring->complete = complete;
+    ring->complete_arg = arg;
+
+    ring->sq = calloc(size, sizeof(*ring->sq));
+    ring->cq = calloc(size, sizeof(*ring->cq));
+    ring->order = calloc(size, sizeof(*ring->order));
+    ring->iov = calloc(size, sizeof(*ring->iov));
+    if (ring->sq == NULL || ring->cq == NULL || ring->order == NULL || ring->iov == NULL) {
+        bio_ring_destroy(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void bio_ring_destroy(struct bio_ring *ring) {
+    free(ring->sq);
+    free(ring->cq);
+    free(ring->order);
+    free(ring->iov);
+    ring->sq = NULL;
+    ring->cq = NULL;
+    ring->order = NULL;
+    ring->iov = NULL;
+}
+
+struct bio_sqe *bio_ring_get_sqe(struct bio_ring *ring) {
+    if (ring->sq_tail - ring->sq_head == ring->entries) {
+        return NULL;
+    }
+    struct bio_sqe *sqe = &ring->sq[ring->sq_tail++ & ring->mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void bio_post(struct bio_ring *ring, const struct bio_sqe *sqe, int result) {
+    struct bio_cqe cqe = { sqe->user_data, result };
+    ring->stats.completed++;
+    if (ring->complete != NULL) {
+        ring->complete(&cqe, ring->complete_arg);
+    } else {
+        ring->cq[ring->cq_tail++ & ring->mask] = cqe;
+    }
+}
+
+static inline struct bio_sqe *bio_at(struct bio_ring *ring, uint32_t slot) {
+    return &ring->sq[slot & ring->mask];
+}
+
+// Order the segment [first, first + n) by block. Insertion sort is stable,
+// so writes to the same start block keep their submission order; a write
+// segment with partial overlaps is issued exactly as submitted.
+static void bio_sort(struct bio_ring *ring, uint32_t first, uint32_t n, int op) {
+    uint32_t *order = ring->order;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t slot = first + i;
+        uint32_t j = i;
+        while (j > 0 && bio_at(ring, order[j - 1])->block > bio_at(ring, slot)->block) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = slot;
+    }
+
+    if (op != BIO_OP_WRITE) {
+        return;
+    }
+    for (uint32_t i = 1; i < n; i++) {
+        const struct bio_sqe *prev = bio_at(ring, order[i - 1]);
+        if (bio_at(ring, order[i])->block < prev->block + prev->count) {
+            for (uint32_t k = 0; k < n; k++) {
+                order[k] = first + k;
+            }
+            return;
+        }
+    }
+}
+
+// Issue a sorted segment, merging requests that continue each other
+static void bio_dispatch(struct bio_ring *ring, uint32_t n, int op) {
+    uint32_t i = 0;
+    while (i < n) {
+        struct bio_sqe *first = bio_at(ring, ring->order[i]);
+        if (first->count == 0 || first->buffer == NULL) {
+            bio_post(ring, first, -1);
+            i++;
+            continue;
+        }
+
+        uint32_t run = 0;
+        uint32_t count = 0;
+        while (i + run < n) {
+            struct bio_sqe *sqe = bio_at(ring, ring->order[i + run]);
+            if (sqe->count == 0 || sqe->buffer == NULL || sqe->block != first->block + count) {
+                break;
+            }
+            ring->iov[run].base = sqe->buffer;
+            ring->iov[run].len = (size_t)sqe->count * BLOCK_SIZE;
+            count += sqe->count;
+            run++;
+        }
+
+        int result = op == BIO_OP_READ
+            ? read_blocks(first->block, count, ring->iov, (int)run)
+            : write_blocks(first->block, count, ring->iov, (int)run);
+        ring->stats.dispatched++;
+        for (uint32_t k = 0; k < run; k++) {
+            bio_post(ring, bio_at(ring, ring->order[i + k]), result);
+        }
+        i += run;
+    }
+}
+
+int bio_ring_submit(struct bio_ring *ring) {
+    uint32_t n = ring->sq_tail - ring->sq_head;
+    if (ring->complete == NULL) {
+        // Never produce more completions than the queue can hold
+        uint32_t room = ring->entries - (ring->cq_tail - ring->cq_head);
+        if (n > room) {
+            n = room;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    uint32_t head = ring->sq_head;
+    uint32_t end = head + n;
+    while (head != end) {
+        struct bio_sqe *sqe = bio_at(ring, head);
+        if (sqe->op == BIO_OP_SYNC) {
+            bio_post(ring, sqe, block_sync());
+            ring->stats.dispatched++;
+            head++;
+            continue;
+        }
+        if (sqe->op != BIO_OP_READ && sqe->op != BIO_OP_WRITE) {
+            bio_post(ring, sqe, -1);
+            head++;
+            continue;
+        }
+
+        // Longest segment of the same direction: it may be reordered freely
+        int op = sqe->op;
+        uint32_t len = 0;
+        while (head + len != end && bio_at(ring, head + len)->op == op) {
+            len++;
+        }
+        bio_sort(ring, head, len, op);
+        bio_dispatch(ring, len, op);
+        head += len;
+    }
+
+    ring->sq_head = end;
+    ring->stats.submitted += n;
+    ring->stats.batches++;
+    return (int)n;
+}
+
+int bio_ring_peek_cqe(struct bio_ring *ring, struct bio_cqe **cqe) {
+    if (ring->cq_head == ring->cq_tail) {
+        return -1;
+    }
+    *cqe = &ring->cq[ring->cq_head & ring->mask];
+    return 0;
+}
+
+void bio_ring_cqe_seen(struct bio_ring *ring) {
+    if (ring->cq_head != ring->cq_tail) {
+        ring->cq_head++;
+    }
+}
+
+int bio_ring_wait_cqe(struct bio_ring *ring, struct bio_cqe **cqe) {
+    if (bio_ring_peek_cqe(ring, cqe) == 0) {
+        return 0;
+    }
+    // Backends complete requests during dispatch, so one submit is enough
+    bio_ring_submit(ring);
+    return bio_ring_peek_cqe(ring, cqe);
+}
+
+void bio_ring_get_stats(const struct bio_ring *ring, struct bio_ring_stats *out) {
+    *out = ring->stats;
+}
@@ -0,0 +1,80 @@
+#ifndef BIO_RING_H
+#define BIO_RING_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+// Request opcodes
+#define BIO_OP_READ  1
+#define BIO_OP_WRITE 2
+#define BIO_OP_SYNC  3   // Barrier: completes after everything queued before it
+
+// Submission queue entry
+struct bio_sqe {
+    uint8_t op;           // BIO_OP_*
+    uint32_t block;       // First block
+    uint32_t count;       // Blocks to transfer
+    void *buffer;         // count * BLOCK_SIZE bytes
+    uint64_t user_data;   // Tag copied to the completion
+};
+
+// Completion queue entry
+struct bio_cqe {
+    uint64_t user_data;
+    int32_t result;       // 0 on success, -1 on error
+};
+
+typedef void (*bio_complete_fn)(const struct bio_cqe *cqe, void *arg);
+
+struct bio_ring_stats {
+    uint64_t submitted;   // Requests taken from the submission queue
+    uint64_t completed;   // Completions posted
+    uint64_t batches;     // bio_ring_submit() calls that did work
+    uint64_t dispatched;  // Backend calls issued after merging
+};
+
+// Submission/completion ring pair. Requests are queued with
+// bio_ring_get_sqe() and handed to the block layer in batches by
+// bio_ring_submit(); adjacent requests of a batch are merged into single
+// vectored calls. Completions are either queued for bio_ring_peek_cqe() or,
+// when a callback is set, delivered to it directly.
+struct bio_ring {
+    uint32_t entries;     // Ring size (power of two)
+    uint32_t mask;
+    struct bio_sqe *sq;
+    uint32_t sq_head;     // Next entry to dispatch
+    uint32_t sq_tail;     // Next free entry
+    struct bio_cqe *cq;
+    uint32_t cq_head;     // Next completion to reap
+    uint32_t cq_tail;
+    bio_complete_fn complete;
+    void *complete_arg;
+
+    // Dispatch scratch space, one slot per ring entry
+    uint32_t *order;
+    struct block_iovec *iov;
+
+    struct bio_ring_stats stats;
+};
+
+// entries is rounded up to a power of two; complete may be NULL (polling)
+int bio_ring_init(struct bio_ring *ring, uint32_t entries, bio_complete_fn complete, void *arg);
+void bio_ring_destroy(struct bio_ring *ring);
+
+// Reserve the next submission entry (NULL when the queue is full)
+struct bio_sqe *bio_ring_get_sqe(struct bio_ring *ring);
+
+// Dispatch every queued request; returns the number dispatched. Requests
+// stay queued while the completion queue has no room for their results.
+int bio_ring_submit(struct bio_ring *ring);
+
+// Look at the oldest completion (0 if there is one), then mark it consumed
+int bio_ring_peek_cqe(struct bio_ring *ring, struct bio_cqe **cqe);
+void bio_ring_cqe_seen(struct bio_ring *ring);
+
+// Submit, then wait until a completion is available
+int bio_ring_wait_cqe(struct bio_ring *ring, struct bio_cqe **cqe);
+
+void bio_ring_get_stats(const struct bio_ring *ring, struct bio_ring_stats *stats);
+
+#endif // BIO_RING_H
@@ -0,0 +1,375 @@
+#include "bitmap.h"
+#include "block_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define WORD_BITS 64
+#define FULL_WORD (~0ULL)
+
+// Return the first index in [from, n) whose word is not all ones, or n
+typedef uint32_t (*find_not_full_fn)(const uint64_t *v, uint32_t from, uint32_t n);
+
+static uint32_t find_not_full_scalar(const uint64_t *v, uint32_t from, uint32_t n) {
+    while (from < n && v[from] == FULL_WORD) {
+        from++;
+    }
+    return from;
+}
+
+#if defined(__SSE2__)
+static uint32_t find_not_full_sse2(const uint64_t *v, uint32_t from, uint32_t n) {
+    const __m128i ones = _mm_set1_epi32(-1);
+    while (from + 2 <= n) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + from));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(x, ones)) != 0xFFFF) {
+            break;
+        }
+        from += 2;
+    }
+    return find_not_full_scalar(v, from, n);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static uint32_t find_not_full_avx2(const uint64_t *v, uint32_t from, uint32_t n) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    while (from + 4 <= n) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(v + from));
+        if (!_mm256_testc_si256(x, ones)) {
+            break;
+        }
+        from += 4;
+    }
+    return find_not_full_scalar(v, from, n);
+}
+#endif
+
+static find_not_full_fn find_not_full = NULL;
+static const char *find_not_full_name = "scalar";
+
+static void bitmap_select_scan(void) {
+    find_not_full = find_not_full_scalar;
+#if defined(__SSE2__)
+    find_not_full = find_not_full_sse2;
+    find_not_full_name = "sse2";
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_not_full = find_not_full_avx2;
+        find_not_full_name = "avx2";
+    }
+#endif
+}
+
+uint32_t bitmap_blocks(uint32_t nbits) {
+    return (uint32_t)(((uint64_t)nbits + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8));
+}
+
+#define WORDS_PER_BLOCK (BLOCK_SIZE / 8)
+
+static inline void bitmap_touch(struct ion_bitmap *bm, uint32_t word) {
+    uint32_t block = word / WORDS_PER_BLOCK;
+    if (!bm->dirty[block]) {
+        bm->dirty[block] = 1;
+        bm->ndirty++;
+    }
+}
+
+static void bitmap_mark_all(struct ion_bitmap *bm, uint8_t dirty) {
+    memset(bm->dirty, dirty, bitmap_blocks(bm->nbits));
+    bm->ndirty = dirty ? bitmap_blocks(bm->nbits) : 0;
+}
+
+static inline void summary_update(struct ion_bitmap *bm, uint32_t word) {
+    uint64_t bit = 1ULL << (word % WORD_BITS);
+    if (bm->words[word] == FULL_WORD) {
+        bm->summary[word / WORD_BITS] |= bit;
+    } else {
+        bm->summary[word / WORD_BITS] &= ~bit;
+    }
+}
+
+// Mark bits past nbits as used so they are never handed out
+static void bitmap_pad(struct ion_bitmap *bm) {
+    uint32_t total_words = bitmap_blocks(bm->nbits) * (BLOCK_SIZE / 8);
+    if (bm->nbits % WORD_BITS) {
+        bm->words[bm->nwords - 1] |= FULL_WORD << (bm->nbits % WORD_BITS);
+    }
+    for (uint32_t w = bm->nwords; w < total_words; w++) {
+        bm->words[w] = FULL_WORD;
+    }
+}
+
+// Rebuild the summary level from the words
+static void bitmap_rebuild(struct ion_bitmap *bm) {
+    memset(bm->summary, 0, bm->nsummary * sizeof(uint64_t));
+    for (uint32_t w = 0; w < bm->nwords; w++) {
+        summary_update(bm, w);
+    }
+    // Summary bits past the last word read as full
+    if (bm->nwords % WORD_BITS) {
+        bm->summary[bm->nsummary - 1] |= FULL_WORD << (bm->nwords % WORD_BITS);
+    }
+}
+
+uint32_t bitmap_count_free(const struct ion_bitmap *bm) {
+    uint64_t used = 0;
+    for (uint32_t w = 0; w < bm->nwords; w++) {
+        used += __builtin_popcountll(bm->words[w]);
+    }
+    // Padding bits were counted as used
+    used -= (uint64_t)bm->nwords * WORD_BITS - bm->nbits;
+    return bm->nbits - (uint32_t)used;
+}
+
+int bitmap_init(struct ion_bitmap *bm, uint32_t nbits) {
+    if (nbits == 0) {
+        return -1;
+    }
+    if (find_not_full == NULL) {
+        bitmap_select_scan();
+    }
+
+    bm->nbits = nbits;
+    bm->nwords = (nbits + WORD_BITS - 1) / WORD_BITS;
+    bm->nsummary = (bm->nwords + WORD_BITS - 1) / WORD_BITS;
+    bm->words = calloc(bitmap_blocks(nbits), BLOCK_SIZE);
+    bm->summary = calloc(bm->nsummary, sizeof(uint64_t));
+    bm->dirty = calloc(bitmap_blocks(nbits), 1);
+    if (bm->words == NULL || bm->summary == NULL || bm->dirty == NULL) {
+        bitmap_destroy(bm);
+        return -1;
+    }
+
+    bm->hint = 0;
+    bitmap_mark_all(bm, 1);
+    bitmap_pad(bm);
+    bitmap_rebuild(bm);
+    return 0;
+}
+
+void bitmap_destroy(struct ion_bitmap *bm) {
+    free(bm->words);
+    free(bm->summary);
+    free(bm->dirty);
+    bm->words = NULL;
+    bm->summary = NULL;
+    bm->dirty = NULL;
+}
+
+// First word in [from, to) that has a clear bit, found through the summary
+static int64_t summary_next_free(const struct ion_bitmap *bm, uint32_t from, uint32_t to) {
+    if (from >= to) {
+        return -1;
+    }
+
+    uint32_t s = from / WORD_BITS;
+    uint32_t end = (to + WORD_BITS - 1) / WORD_BITS;
+    if (from % WORD_BITS) {
+        uint64_t open = ~bm->summary[s] & (FULL_WORD << (from % WORD_BITS));
+        if (open) {
+            uint32_t w = s * WORD_BITS + __builtin_ctzll(open);
+            return w < to ? (int64_t)w : -1;
+        }
+        s++;
+    }
+
+    s = find_not_full(bm->summary, s, end);
+    if (s >= end) {
+        return -1;
+    }
+    uint32_t w = s * WORD_BITS + __builtin_ctzll(~bm->summary[s]);
+    return w < to ? (int64_t)w : -1;
+}
+
+// Word with a clear bit, preferring the hint and wrapping around once
+static int64_t bitmap_find(const struct ion_bitmap *bm) {
+    uint32_t start = bm->hint < bm->nwords ? bm->hint : 0;
+    if (bm->words[start] != FULL_WORD) {
+        return start;
+    }
+
+    int64_t w = summary_next_free(bm, start + 1, bm->nwords);
+    if (w < 0) {
+        w = summary_next_free(bm, 0, start);
+    }
+    return w;
+}
+
+int bitmap_alloc(struct ion_bitmap *bm, uint32_t *bit) {
+    int64_t w = bitmap_find(bm);
+    if (w < 0) {
+        return -1;
+    }
+
+    uint32_t off = __builtin_ctzll(~bm->words[w]);
+    bm->words[w] |= 1ULL << off;
+    bm->hint = (uint32_t)w;
+    summary_update(bm, (uint32_t)w);
+    bitmap_touch(bm, (uint32_t)w);
+    *bit = (uint32_t)w * WORD_BITS + off;
+    return 0;
+}
+
+uint32_t bitmap_alloc_run(struct ion_bitmap *bm, uint32_t want, uint32_t *start) {
+    int64_t first = bitmap_find(bm);
+    if (first < 0 || want == 0) {
+        return 0;
+    }
+
+    uint32_t pos = (uint32_t)first * WORD_BITS + __builtin_ctzll(~bm->words[first]);
+    uint32_t got = 0;
+    *start = pos;
+
+    // Claim the clear bits following pos, a word at a time
+    while (got < want && pos < bm->nbits) {
+        uint32_t w = pos / WORD_BITS;
+        uint32_t off = pos % WORD_BITS;
+        uint64_t rest = bm->words[w] >> off;
+        uint32_t span = rest ? (uint32_t)__builtin_ctzll(rest) : WORD_BITS - off;
+        if (span == 0) {
+            break;
+        }
+        if (span > want - got) {
+            span = want - got;
+        }
+
+        uint64_t mask = span == WORD_BITS ? FULL_WORD : ((1ULL << span) - 1) << off;
+        bm->words[w] |= mask;
+        summary_update(bm, w);
+        bitmap_touch(bm, w);
+        got += span;
+        pos += span;
+        if (off + span < WORD_BITS) {
+            break; // Hit a used bit inside this word
+        }
+    }
+
+    bm->hint = (pos - 1) / WORD_BITS;
+    return got;
+}
+
+void bitmap_set(struct ion_bitmap *bm, uint32_t bit) {
+    uint32_t w = bit / WORD_BITS;
+    uint64_t mask = 1ULL << (bit % WORD_BITS);
+    if (bit >= bm->nbits || (bm->words[w] & mask)) {
+        return;
+    }
+    bm->words[w] |= mask;
+    summary_update(bm, w);
+    bitmap_touch(bm, w);
+}
+
+void bitmap_clear(struct ion_bitmap *bm, uint32_t bit) {
+    uint32_t w = bit / WORD_BITS;
+    uint64_t mask = 1ULL << (bit % WORD_BITS);
+    if (bit >= bm->nbits || !(bm->words[w] & mask)) {
+        return;
+    }
+    bm->words[w] &= ~mask;
+    summary_update(bm, w);
+    bitmap_touch(bm, w);
+}
+
+int bitmap_test(const struct ion_bitmap *bm, uint32_t bit) {
+    if (bit >= bm->nbits) {
+        return 1;
+    }
+    return (bm->words[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+int bitmap_load(struct ion_bitmap *bm, uint32_t first_block) {
+    uint32_t nblocks = bitmap_blocks(bm->nbits);
+    struct block_iovec iov = { bm->words, (size_t)nblocks * BLOCK_SIZE };
+    if (read_blocks(first_block, nblocks, &iov, 1) != 0) {
+        return -1;
+    }
+
+    bitmap_pad(bm);
+    bitmap_rebuild(bm);
+    bm->hint = 0;
+    bitmap_mark_all(bm, 0);
+    return 0;
+}
+
+int bitmap_store(struct ion_bitmap *bm, uint32_t first_block) {
+    uint32_t nblocks = bitmap_blocks(bm->nbits);
+    uint32_t i = 0;
+
+    // One vectored write per run of modified blocks
+    while (bm->ndirty > 0 && i < nblocks) {
+        if (!bm->dirty[i]) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < nblocks && bm->dirty[i + run]) {
+            run++;
+        }
+        struct block_iovec iov = { bm->words + (size_t)i * WORDS_PER_BLOCK, (size_t)run * BLOCK_SIZE };
+        if (write_blocks(first_block + i, run, &iov, 1) != 0) {
+            return -1;
+        }
+        memset(bm->dirty + i, 0, run);
+        bm->ndirty -= run;
+        i += run;
+    }
+    return 0;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Fill a 1M-bit map in 10% steps. At each level, free random bits and
+// reallocate them so the search has to find holes anywhere in the map.
+int bitmap_bench(void) {
+    const uint32_t nbits = 1u << 20;
+    const uint32_t rounds = 20000;
+    struct ion_bitmap bm;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uint32_t used = 0;
+
+    if (bitmap_init(&bm, nbits) != 0) {
+        return -1;
+    }
+
+    printf("Bitmap allocator benchmark (%u bits, %s scan):\n", nbits, find_not_full_name);
+    for (int level = 10; level <= 100; level += 10) {
+        uint32_t target = (uint32_t)((uint64_t)nbits * level / 100);
+        uint32_t bit;
+        while (used < target && bitmap_alloc(&bm, &bit) == 0) {
+            used++;
+        }
+
+        uint64_t elapsed = 0;
+        for (uint32_t i = 0; i < rounds; i++) {
+            // xorshift64 picks a used bit to release
+            do {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                bit = (uint32_t)(seed % nbits);
+            } while (!bitmap_test(&bm, bit));
+            bitmap_clear(&bm, bit);
+
+            uint64_t t0 = bench_now_ns();
+            bitmap_alloc(&bm, &bit);
+            elapsed += bench_now_ns() - t0;
+        }
+        printf("  fill %3d%%: %6.1f ns/alloc\n", level, (double)elapsed / rounds);
+    }
+
+    bitmap_destroy(&bm);
+    return 0;
+}
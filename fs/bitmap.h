@@ -0,0 +1,53 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdint.h>
+
+// Free-space bitmap (1 = in use) with a summary level: one summary bit per
+// 64-bit word, set while that word is completely used. Searches start at a
+// next-fit hint and skip full words through the summary, so an allocation
+// never walks the whole map. The map keeps no free count; the filesystem
+// tracks it in per-CPU counters seeded by bitmap_count_free() at load.
+struct ion_bitmap {
+    uint64_t *words;      // Bitmap, padded to whole blocks
+    uint64_t *summary;    // One bit per word, 1 = word full
+    uint32_t nbits;       // Number of tracked objects
+    uint32_t nwords;      // Words covering nbits
+    uint32_t nsummary;    // Summary words
+    uint32_t hint;        // Word where the next search starts
+    uint8_t *dirty;       // One flag per disk block modified since the last store
+    uint32_t ndirty;      // Blocks flagged in dirty
+};
+
+int bitmap_init(struct ion_bitmap *bm, uint32_t nbits);
+void bitmap_destroy(struct ion_bitmap *bm);
+
+// Find and set a clear bit; returns -1 when the map is full
+int bitmap_alloc(struct ion_bitmap *bm, uint32_t *bit);
+
+// Allocate up to want contiguous bits; returns the count (0 when full)
+uint32_t bitmap_alloc_run(struct ion_bitmap *bm, uint32_t want, uint32_t *start);
+
+// Number of clear bits, counted over the whole map
+uint32_t bitmap_count_free(const struct ion_bitmap *bm);
+
+void bitmap_set(struct ion_bitmap *bm, uint32_t bit);
+void bitmap_clear(struct ion_bitmap *bm, uint32_t bit);
+int bitmap_test(const struct ion_bitmap *bm, uint32_t bit);
+
+// Number of blocks needed to store nbits on disk
+uint32_t bitmap_blocks(uint32_t nbits);
+
+// Load the map from (or store modified blocks to) consecutive disk blocks
+int bitmap_load(struct ion_bitmap *bm, uint32_t first_block);
+int bitmap_store(struct ion_bitmap *bm, uint32_t first_block);
+
+// Number of disk blocks the next bitmap_store() writes
+static inline uint32_t bitmap_dirty_blocks(const struct ion_bitmap *bm) {
+    return bm->ndirty;
+}
+
+// Allocation latency benchmark across fill levels
+int bitmap_bench(void);
+
+#endif // BITMAP_H
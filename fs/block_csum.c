@@ -0,0 +1,236 @@
+#include "block_csum.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct block_csum {
+    struct block_backend backend;   // Installed as the active backend
+    struct block_backend *lower;
+    uint32_t start;                 // Checksum table on the device
+    uint32_t nblocks;
+    uint32_t logged;                // Blocks below are journaled with the table
+    uint32_t *table;                // One entry per device block, 0 = none
+    uint64_t *cleared;              // Entry known to be 0 on disk, one bit per block
+    uint8_t *dirty;                 // One flag per table block
+    uint32_t ndirty;                // Table blocks flagged in dirty
+    struct block_csum_stats stats;
+};
+
+// 0 is reserved for "no checksum recorded"
+static inline uint32_t csum_block(const void *data) {
+    uint32_t crc = crc32c(0, data, BLOCK_SIZE);
+    return crc != 0 ? crc : 1;
+}
+
+static inline int csum_covered(const struct block_csum *cs, uint32_t block) {
+    return block < cs->nblocks * CSUM_PER_BLOCK && (block < cs->start || block >= cs->start + cs->nblocks);
+}
+
+#define CLEARED_WORDS (CSUM_PER_BLOCK / 64)   // cleared words per table block
+
+static inline int cleared_test(const struct block_csum *cs, uint32_t block) {
+    return (cs->cleared[block / 64] >> (block % 64)) & 1;
+}
+
+int block_csum_format(uint32_t start, uint32_t nblocks) {
+    uint8_t zero[BLOCK_SIZE];
+    memset(zero, 0, sizeof(zero));
+    for (uint32_t i = 0; i < nblocks; i++) {
+        if (write_block(start + i, zero) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int csum_read(struct block_backend *be, uint32_t start, uint32_t count, void *buffer) {
+    struct block_csum *cs = be->priv;
+    const uint8_t *data = buffer;
+    int status = 0;
+
+    if (block_backend_io(cs->lower, start, count, buffer, 0) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = start + i;
+        if (!csum_covered(cs, block) || cs->table[block] == 0) {
+            continue;
+        }
+        cs->stats.verified++;
+        if (csum_block(data + (size_t)i * BLOCK_SIZE) != cs->table[block]) {
+            cs->stats.mismatches++;
+            printf("Checksum mismatch on block %u\n", block);
+            status = -1;
+        }
+    }
+    return status;
+}
+
+static inline void csum_mark_dirty(struct block_csum *cs, uint32_t tb) {
+    if (!cs->dirty[tb]) {
+        cs->dirty[tb] = 1;
+        cs->ndirty++;
+    }
+}
+
+// A block written in place must never sit on disk next to the checksum of
+// its old contents: clear the recorded entries and commit the cleared table
+// blocks before the data moves. The image written keeps the journaled
+// entries at 0 as well, since their blocks may not be committed yet.
+static int csum_clear(struct block_csum *cs, uint32_t start, uint32_t count) {
+    uint32_t image[CSUM_PER_BLOCK];
+    uint32_t end = start + count;
+
+    for (uint32_t tb = start / CSUM_PER_BLOCK; tb < cs->nblocks && tb * CSUM_PER_BLOCK < end; tb++) {
+        uint32_t base = tb * CSUM_PER_BLOCK;
+        uint32_t from = start > base ? start : base;
+        uint32_t to = end < base + CSUM_PER_BLOCK ? end : base + CSUM_PER_BLOCK;
+        int changed = 0;
+
+        for (uint32_t b = from; b < to; b++) {
+            if (b < cs->logged || !csum_covered(cs, b) || cs->table[b] == 0 || cleared_test(cs, b)) {
+                continue;
+            }
+            cs->table[b] = 0;
+            cs->cleared[b / 64] |= 1ULL << (b % 64);
+            changed = 1;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        csum_mark_dirty(cs, tb);
+        for (uint32_t k = 0; k < CSUM_PER_BLOCK; k++) {
+            uint32_t b = base + k;
+            image[k] = b < cs->logged || cleared_test(cs, b) ? 0 : cs->table[b];
+        }
+        if (block_backend_write_now(cs->lower, cs->start + tb, 1, image) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int csum_write(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    struct block_csum *cs = be->priv;
+    const uint8_t *data = buffer;
+
+    if (start + count > cs->logged && csum_clear(cs, start, count) != 0) {
+        return -1;
+    }
+    if (block_backend_io(cs->lower, start, count, (void *)buffer, 1) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = start + i;
+        if (csum_covered(cs, block)) {
+            cs->table[block] = csum_block(data + (size_t)i * BLOCK_SIZE);
+            csum_mark_dirty(cs, block / CSUM_PER_BLOCK);
+            cs->stats.computed++;
+        }
+    }
+    return 0;
+}
+
+// Write back the dirty table blocks, one request per run
+static int csum_store(struct block_csum *cs) {
+    uint32_t i = 0;
+    while (i < cs->nblocks) {
+        if (!cs->dirty[i]) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < cs->nblocks && cs->dirty[i + run]) {
+            run++;
+        }
+        if (block_backend_io(cs->lower, cs->start + i, run, cs->table + (size_t)i * CSUM_PER_BLOCK, 1) != 0) {
+            return -1;
+        }
+        // The stored entries may be committed from here on
+        memset(cs->cleared + (size_t)i * CLEARED_WORDS, 0, (size_t)run * CLEARED_WORDS * sizeof(uint64_t));
+        memset(cs->dirty + i, 0, run);
+        cs->ndirty -= run;
+        i += run;
+    }
+    return 0;
+}
+
+static int csum_sync(struct block_backend *be) {
+    struct block_csum *cs = be->priv;
+    if (csum_store(cs) != 0) {
+        return -1;
+    }
+    return cs->lower->sync != NULL ? cs->lower->sync(cs->lower) : 0;
+}
+
+struct block_csum *block_csum_open(uint32_t start, uint32_t nblocks, uint32_t logged) {
+    struct block_backend *lower = block_get_backend();
+    struct block_csum *cs = calloc(1, sizeof(*cs));
+    if (cs == NULL) {
+        return NULL;
+    }
+    cs->table = malloc((size_t)nblocks * BLOCK_SIZE);
+    cs->dirty = calloc(nblocks, 1);
+    cs->cleared = calloc((size_t)nblocks * CLEARED_WORDS, sizeof(uint64_t));
+    if (cs->table == NULL || cs->dirty == NULL || cs->cleared == NULL ||
+        block_backend_io(lower, start, nblocks, cs->table, 0) != 0) {
+        free(cs->table);
+        free(cs->dirty);
+        free(cs->cleared);
+        free(cs);
+        return NULL;
+    }
+
+    cs->lower = lower;
+    cs->start = start;
+    cs->nblocks = nblocks;
+    cs->logged = logged;
+    cs->backend.name = "csum";
+    cs->backend.nblocks = lower->nblocks;
+    cs->backend.base = NULL;
+    cs->backend.read = csum_read;
+    cs->backend.write = csum_write;
+    cs->backend.sync = csum_sync;
+    cs->backend.priv = cs;
+
+    if (block_set_backend(&cs->backend) != 0) {
+        free(cs->table);
+        free(cs->dirty);
+        free(cs->cleared);
+        free(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+int block_csum_close(struct block_csum *cs) {
+    int status = csum_store(cs);
+    if (block_set_backend(cs->lower) != 0) {
+        return -1;
+    }
+    free(cs->table);
+    free(cs->dirty);
+    free(cs->cleared);
+    free(cs);
+    return status;
+}
+
+int block_csum_reload(struct block_csum *cs) {
+    if (block_backend_io(cs->lower, cs->start, cs->nblocks, cs->table, 0) != 0) {
+        return -1;
+    }
+    memset(cs->cleared, 0, (size_t)cs->nblocks * CLEARED_WORDS * sizeof(uint64_t));
+    memset(cs->dirty, 0, cs->nblocks);
+    cs->ndirty = 0;
+    return 0;
+}
+
+uint32_t block_csum_dirty_blocks(const struct block_csum *cs) {
+    return cs->ndirty;
+}
+
+void block_csum_get_stats(const struct block_csum *cs, struct block_csum_stats *out) {
+    *out = cs->stats;
+}
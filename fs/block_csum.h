@@ -0,0 +1,48 @@
+#ifndef BLOCK_CSUM_H
+#define BLOCK_CSUM_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+// CRC-32C values per checksum table block
+#define CSUM_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+
+struct block_csum_stats {
+    uint64_t computed;     // Checksums computed for written blocks
+    uint64_t verified;     // Blocks whose checksum was checked on read
+    uint64_t mismatches;   // Reads that failed verification
+};
+
+// Checksumming backend stacked on top of the current one. Every block
+// written gets a CRC-32C in a table of nblocks blocks at start, which is
+// verified when the block is read back; a mismatch fails the read. Blocks
+// never written since the table was created have no checksum and are not
+// verified.
+//
+// The table reaches the disk on sync. Blocks below logged go through a
+// journal underneath, which commits them together with the table. The
+// others are written in place, so before one that has a checksum on disk
+// is overwritten, its entry is cleared there first (write_now); after a
+// crash such a block reads back unverified rather than failing on a
+// stale checksum.
+struct block_csum;
+
+// Prepare an empty table in [start, start + nblocks) of the current backend
+int block_csum_format(uint32_t start, uint32_t nblocks);
+
+// Load the table and make the checksumming backend the active one
+struct block_csum *block_csum_open(uint32_t start, uint32_t nblocks, uint32_t logged);
+
+// Write the table back and restore the underlying backend
+int block_csum_close(struct block_csum *cs);
+
+// Read the table back from the device underneath, dropping every entry
+// not written back yet (e.g. after a journal transaction was aborted)
+int block_csum_reload(struct block_csum *cs);
+
+// Table blocks the next sync writes
+uint32_t block_csum_dirty_blocks(const struct block_csum *cs);
+
+void block_csum_get_stats(const struct block_csum *cs, struct block_csum_stats *stats);
+
+#endif // BLOCK_CSUM_H
@@ -0,0 +1,293 @@
+#include "block_dedup.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEDUP_NONE UINT32_MAX
+
+struct dedup_fp {
+    uint64_t lo, hi;
+};
+
+// Fingerprint index entry (open addressing, linear probing)
+struct dedup_slot {
+    struct dedup_fp fp;
+    uint32_t physical;      // DEDUP_NONE when empty
+};
+
+struct dedup_disk {
+    struct block_backend backend;
+    struct block_backend *lower;
+    uint32_t *map;              // Logical -> physical, DEDUP_NONE if unwritten
+    uint32_t *refs;             // Per physical block
+    struct dedup_fp *fps;       // Fingerprint of each physical block
+    uint32_t *free_stack;       // Unused physical blocks
+    uint32_t free_count;
+    struct dedup_slot *index;
+    uint32_t index_mask;
+    struct dedup_stats stats;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3 x64 128-bit over one block
+static struct dedup_fp dedup_fingerprint(const uint8_t *data) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0;
+
+    for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i, 8);
+        memcpy(&k2, data + i + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    h1 ^= BLOCK_SIZE;
+    h2 ^= BLOCK_SIZE;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return (struct dedup_fp){ h1, h2 };
+}
+
+static inline int fp_equal(const struct dedup_fp *a, const struct dedup_fp *b) {
+    return a->lo == b->lo && a->hi == b->hi;
+}
+
+static uint32_t index_find(struct dedup_disk *dd, const struct dedup_fp *fp) {
+    for (uint32_t i = (uint32_t)fp->lo & dd->index_mask;; i = (i + 1) & dd->index_mask) {
+        struct dedup_slot *slot = &dd->index[i];
+        if (slot->physical == DEDUP_NONE) {
+            return DEDUP_NONE;
+        }
+        if (fp_equal(&slot->fp, fp)) {
+            return slot->physical;
+        }
+    }
+}
+
+static void index_insert(struct dedup_disk *dd, const struct dedup_fp *fp, uint32_t physical) {
+    uint32_t i = (uint32_t)fp->lo & dd->index_mask;
+    while (dd->index[i].physical != DEDUP_NONE) {
+        i = (i + 1) & dd->index_mask;
+    }
+    dd->index[i].fp = *fp;
+    dd->index[i].physical = physical;
+}
+
+// Remove the entry for physical and close the gap (backward shift)
+static void index_remove(struct dedup_disk *dd, const struct dedup_fp *fp, uint32_t physical) {
+    uint32_t i = (uint32_t)fp->lo & dd->index_mask;
+    while (dd->index[i].physical != physical) {
+        if (dd->index[i].physical == DEDUP_NONE) {
+            return; // Not indexed (lost a fingerprint collision)
+        }
+        i = (i + 1) & dd->index_mask;
+    }
+
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1) & dd->index_mask; dd->index[j].physical != DEDUP_NONE; j = (j + 1) & dd->index_mask) {
+        uint32_t home = (uint32_t)dd->index[j].fp.lo & dd->index_mask;
+        // Move j into the hole unless its home lies cyclically in (hole, j]
+        if (((j - home) & dd->index_mask) >= ((j - hole) & dd->index_mask)) {
+            dd->index[hole] = dd->index[j];
+            hole = j;
+        }
+    }
+    dd->index[hole].physical = DEDUP_NONE;
+}
+
+static void physical_put(struct dedup_disk *dd, uint32_t physical) {
+    if (physical == DEDUP_NONE || --dd->refs[physical] > 0) {
+        return;
+    }
+    index_remove(dd, &dd->fps[physical], physical);
+    dd->free_stack[dd->free_count++] = physical;
+    dd->stats.physical--;
+}
+
+// Compare a stored block with new contents (fingerprints can collide)
+static int physical_matches(struct dedup_disk *dd, uint32_t physical, const uint8_t *data) {
+    uint8_t block[BLOCK_SIZE];
+    if (dd->lower->base != NULL) {
+        return memcmp(dd->lower->base + (size_t)physical * BLOCK_SIZE, data, BLOCK_SIZE) == 0;
+    }
+    return block_backend_io(dd->lower, physical, 1, block, 0) == 0 && memcmp(block, data, BLOCK_SIZE) == 0;
+}
+
+static int dedup_write_one(struct dedup_disk *dd, uint32_t logical, const uint8_t *data) {
+    struct dedup_fp fp = dedup_fingerprint(data);
+    uint32_t old = dd->map[logical];
+    uint32_t match = index_find(dd, &fp);
+
+    if (match != DEDUP_NONE) {
+        if (physical_matches(dd, match, data)) {
+            dd->stats.dup_writes++;
+            if (match == old) {
+                return 0;
+            }
+            dd->refs[match]++;
+            if (old == DEDUP_NONE) {
+                dd->stats.logical++;
+            }
+            physical_put(dd, old);
+            dd->map[logical] = match;
+            return 0;
+        }
+        dd->stats.collisions++;
+    }
+
+    uint32_t physical;
+    if (old != DEDUP_NONE && dd->refs[old] == 1) {
+        // Sole owner: rewrite in place under the new fingerprint
+        index_remove(dd, &dd->fps[old], old);
+        physical = old;
+    } else {
+        if (dd->free_count == 0) {
+            return -1; // Lower device full
+        }
+        physical = dd->free_stack[--dd->free_count];
+        dd->refs[physical] = 1;
+        dd->stats.physical++;
+        if (old == DEDUP_NONE) {
+            dd->stats.logical++;
+        }
+        physical_put(dd, old);
+        dd->map[logical] = physical;
+    }
+
+    if (block_backend_io(dd->lower, physical, 1, (void *)data, 1) != 0) {
+        return -1;
+    }
+    dd->fps[physical] = fp;
+    if (match == DEDUP_NONE) {
+        index_insert(dd, &fp, physical);
+    }
+    return 0;
+}
+
+static int dedup_read(struct block_backend *be, uint32_t start, uint32_t count, void *buffer) {
+    struct dedup_disk *dd = be->priv;
+    uint8_t *out = buffer;
+
+    for (uint32_t i = 0; i < count; i++, out += BLOCK_SIZE) {
+        uint32_t physical = dd->map[start + i];
+        if (physical == DEDUP_NONE) {
+            memset(out, 0, BLOCK_SIZE);
+        } else if (block_backend_io(dd->lower, physical, 1, out, 0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int dedup_write(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    struct dedup_disk *dd = be->priv;
+    const uint8_t *in = buffer;
+
+    for (uint32_t i = 0; i < count; i++, in += BLOCK_SIZE) {
+        if (dedup_write_one(dd, start + i, in) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int dedup_sync(struct block_backend *be) {
+    struct dedup_disk *dd = be->priv;
+    return dd->lower->sync != NULL ? dd->lower->sync(dd->lower) : 0;
+}
+
+static void dedup_free(struct dedup_disk *dd) {
+    free(dd->map);
+    free(dd->refs);
+    free(dd->fps);
+    free(dd->free_stack);
+    free(dd->index);
+    free(dd);
+}
+
+struct block_backend *block_dedup_open(struct block_backend *lower, uint32_t nblocks) {
+    if (lower == NULL || nblocks == 0 || lower->nblocks == 0) {
+        return NULL;
+    }
+
+    uint32_t nphys = lower->nblocks;
+    uint32_t index_size = 1;
+    while (index_size < 2 * nphys) {
+        index_size <<= 1; // At most half full
+    }
+
+    struct dedup_disk *dd = calloc(1, sizeof(*dd));
+    if (dd == NULL) {
+        return NULL;
+    }
+    dd->map = malloc((size_t)nblocks * sizeof(*dd->map));
+    dd->refs = calloc(nphys, sizeof(*dd->refs));
+    dd->fps = calloc(nphys, sizeof(*dd->fps));
+    dd->free_stack = malloc((size_t)nphys * sizeof(*dd->free_stack));
+    dd->index = malloc((size_t)index_size * sizeof(*dd->index));
+    if (dd->map == NULL || dd->refs == NULL || dd->fps == NULL || dd->free_stack == NULL || dd->index == NULL) {
+        dedup_free(dd);
+        return NULL;
+    }
+
+    memset(dd->map, 0xFF, (size_t)nblocks * sizeof(*dd->map));
+    for (uint32_t i = 0; i < index_size; i++) {
+        dd->index[i].physical = DEDUP_NONE;
+    }
+    // Hand out low physical blocks first
+    for (uint32_t i = 0; i < nphys; i++) {
+        dd->free_stack[i] = nphys - 1 - i;
+    }
+    dd->free_count = nphys;
+    dd->index_mask = index_size - 1;
+    dd->lower = lower;
+    dd->stats.index_bytes = (size_t)nblocks * sizeof(*dd->map) +
+        (size_t)nphys * (sizeof(*dd->refs) + sizeof(*dd->fps) + sizeof(*dd->free_stack)) +
+        (size_t)index_size * sizeof(*dd->index);
+
+    dd->backend.name = "dedup";
+    dd->backend.nblocks = nblocks;
+    dd->backend.base = NULL;
+    dd->backend.read = dedup_read;
+    dd->backend.write = dedup_write;
+    dd->backend.sync = dedup_sync;
+    dd->backend.priv = dd;
+    return &dd->backend;
+}
+
+void block_dedup_close(struct block_backend *be) {
+    dedup_free(be->priv);
+}
+
+void block_dedup_get_stats(struct block_backend *be, struct dedup_stats *out) {
+    struct dedup_disk *dd = be->priv;
+    *out = dd->stats;
+}
+
+double block_dedup_ratio(struct block_backend *be) {
+    struct dedup_disk *dd = be->priv;
+    if (dd->stats.physical == 0) {
+        return 1.0;
+    }
+    return (double)dd->stats.logical / (double)dd->stats.physical;
+}
@@ -0,0 +1,28 @@
+#ifndef BLOCK_DEDUP_H
+#define BLOCK_DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "block_io.h"
+
+struct dedup_stats {
+    uint64_t logical;       // Logical blocks holding data
+    uint64_t physical;      // Physical blocks in use
+    uint64_t dup_writes;    // Writes satisfied by an existing block
+    uint64_t collisions;    // Fingerprint matches whose contents differed
+    size_t index_bytes;     // Memory used by the map and the fingerprint index
+};
+
+// Deduplicating backend of nblocks logical blocks stored on lower. Each
+// written block is fingerprinted (128-bit); blocks with identical contents
+// share one refcounted physical block, so writing duplicate data only
+// updates the mapping. The mapping is kept in memory only.
+struct block_backend *block_dedup_open(struct block_backend *lower, uint32_t nblocks);
+void block_dedup_close(struct block_backend *be);
+
+void block_dedup_get_stats(struct block_backend *be, struct dedup_stats *stats);
+
+// Logical blocks per physical block in use
+double block_dedup_ratio(struct block_backend *be);
+
+#endif // BLOCK_DEDUP_H
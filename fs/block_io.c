@@ -1,24 +1,422 @@
 #include "block_io.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define DISK_SIZE 1024
-#define BLOCK_SIZE 4096
-
+// Default backend: a RAM disk linked into .bss
 static uint8_t disk[DISK_SIZE][BLOCK_SIZE];
 
-int read_block(uint32_t block, void *buffer) {
-    if (block >= DISK_SIZE) {
+static struct block_backend ram_backend = {
+    .name = "ram",
+    .nblocks = DISK_SIZE,
+    .base = (uint8_t *)disk,
+};
+
+static struct block_backend *backend = &ram_backend;
+
+// Copy of a borrowed block's data kept for its readers
+struct block_copy {
+    struct block_copy *next;    // Next retired copy
+    uint16_t refs;              // Readers pinned on this copy
+    uint8_t data[BLOCK_SIZE];
+};
+
+// Pin bookkeeping for one borrowed block. Data a reader was given never
+// changes: writes to a version that has readers go to a new pending copy,
+// which replaces the live data once the live readers have returned it.
+struct block_pin {
+    uint32_t block;
+    uint16_t refs;                  // Readers pinned on the live data
+    uint8_t in_use;
+    uint8_t writer;                 // A mutable borrow is outstanding
+    uint8_t *draft;                 // The writer's private copy
+    struct block_copy *pending;     // Newest data, waiting for live readers
+    struct block_copy *retired;     // Superseded copies still pinned by readers
+    uint8_t *bounce;                // Live data for backends without a mapping
+};
+
+static struct block_pin pins[BLOCK_PIN_SLOTS];
+static int pins_used = 0;
+
+// Move whole blocks between a backend and memory
+int block_backend_io(struct block_backend *be, uint32_t start, uint32_t count, void *buffer, int to_disk) {
+    if (be->base != NULL) {
+        uint8_t *dev = be->base + (size_t)start * BLOCK_SIZE;
+        if (to_disk) {
+            memcpy(dev, buffer, (size_t)count * BLOCK_SIZE);
+        } else {
+            memcpy(buffer, dev, (size_t)count * BLOCK_SIZE);
+        }
+        return 0;
+    }
+    if (to_disk) {
+        return be->write(be, start, count, buffer);
+    }
+    return be->read(be, start, count, buffer);
+}
+
+int block_backend_write_now(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    if (be->write_now != NULL) {
+        return be->write_now(be, start, count, buffer);
+    }
+    if (block_backend_io(be, start, count, (void *)buffer, 1) != 0) {
         return -1;
     }
-    memcpy(buffer, disk[block], BLOCK_SIZE);
+    return be->sync != NULL ? be->sync(be) : 0;
+}
+
+static inline int backend_io(uint32_t start, uint32_t count, uint8_t *mem, int to_disk) {
+    return block_backend_io(backend, start, count, mem, to_disk);
+}
+
+static struct block_pin *pin_find(uint32_t block) {
+    if (pins_used == 0) {
+        return NULL;
+    }
+    for (int i = 0; i < BLOCK_PIN_SLOTS; i++) {
+        if (pins[i].in_use && pins[i].block == block) {
+            return &pins[i];
+        }
+    }
+    return NULL;
+}
+
+static struct block_pin *pin_get(uint32_t block) {
+    struct block_pin *pin = pin_find(block);
+    if (pin != NULL) {
+        return pin;
+    }
+    for (int i = 0; i < BLOCK_PIN_SLOTS; i++) {
+        if (!pins[i].in_use) {
+            memset(&pins[i], 0, sizeof(pins[i]));
+            pins[i].block = block;
+            pins[i].in_use = 1;
+            pins_used++;
+            return &pins[i];
+        }
+    }
+    return NULL; // Too many blocks borrowed at once
+}
+
+static void pin_put(struct block_pin *pin) {
+    if (pin->refs == 0 && !pin->writer && pin->pending == NULL && pin->retired == NULL) {
+        free(pin->bounce);
+        pin->bounce = NULL;
+        pin->in_use = 0;
+        pins_used--;
+    }
+}
+
+// Pointer to the live data of a pinned block
+static uint8_t *pin_live(struct block_pin *pin) {
+    if (backend->base != NULL) {
+        return backend->base + (size_t)pin->block * BLOCK_SIZE;
+    }
+    if (pin->bounce == NULL) {
+        uint8_t *bounce = malloc(BLOCK_SIZE);
+        if (bounce == NULL || backend_io(pin->block, 1, bounce, 0) != 0) {
+            free(bounce);
+            return NULL;
+        }
+        pin->bounce = bounce;
+    }
+    return pin->bounce;
+}
+
+// Whether a borrowed pointer refers to the live data of a pinned block
+static int pin_is_live(struct block_pin *pin, const void *data) {
+    if (backend->base != NULL) {
+        return data == backend->base + (size_t)pin->block * BLOCK_SIZE;
+    }
+    return pin->bounce != NULL && data == pin->bounce;
+}
+
+// Keep a superseded copy for its readers, or free it if it has none
+static void pin_retire(struct block_pin *pin, struct block_copy *copy) {
+    if (copy->refs == 0) {
+        free(copy);
+        return;
+    }
+    copy->next = pin->retired;
+    pin->retired = copy;
+}
+
+// Copy the pending data over the live block once no reader sees the old data
+static int pin_publish(struct block_pin *pin) {
+    struct block_copy *copy = pin->pending;
+    uint8_t *live = pin_live(pin);
+    int status = -1;
+
+    if (live != NULL) {
+        memcpy(live, copy->data, BLOCK_SIZE);
+        status = pin->bounce != NULL ? backend_io(pin->block, 1, pin->bounce, 1) : 0;
+    }
+    pin->pending = NULL;
+    pin_retire(pin, copy);
+    return status;
+}
+
+// Write len bytes at in_block into the newest version of a pinned block.
+// A version with readers is left alone and a new pending copy is made.
+static int pin_write(struct block_pin *pin, size_t in_block, const uint8_t *mem, size_t len) {
+    uint8_t *target;
+    uint16_t readers;
+    if (pin->pending != NULL) {
+        target = pin->pending->data;
+        readers = pin->pending->refs;
+    } else {
+        target = pin_live(pin);
+        readers = pin->refs;
+        if (target == NULL) {
+            return -1;
+        }
+    }
+
+    if (readers == 0) {
+        memcpy(target + in_block, mem, len);
+        if (pin->pending == NULL && pin->bounce != NULL) {
+            return backend_io(pin->block, 1, pin->bounce, 1);
+        }
+        return 0;
+    }
+
+    struct block_copy *copy = malloc(sizeof(*copy));
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy->data, target, BLOCK_SIZE);
+    memcpy(copy->data + in_block, mem, len);
+    copy->refs = 0;
+    copy->next = NULL;
+    if (pin->pending != NULL) {
+        pin_retire(pin, pin->pending);
+    }
+    pin->pending = copy;
+    return 0;
+}
+
+// Copy a byte range of the device, honoring the pending copies of pinned blocks
+static int device_copy(size_t offset, uint8_t *mem, size_t len, int to_disk) {
+    while (len > 0) {
+        uint32_t block = offset / BLOCK_SIZE;
+        size_t in_block = offset % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - in_block < len ? BLOCK_SIZE - in_block : len;
+        struct block_pin *pin = pin_find(block);
+
+        if (pin != NULL && to_disk) {
+            // Readers of a borrowed block keep seeing the data they were given
+            if (pin_write(pin, in_block, mem, chunk) != 0) {
+                return -1;
+            }
+        } else if (pin != NULL && pin->pending != NULL) {
+            memcpy(mem, pin->pending->data + in_block, chunk); // Newest version
+        } else if (in_block == 0 && len >= BLOCK_SIZE) {
+            // Whole blocks go to the backend in one call, up to the next pinned block
+            uint32_t count = 1;
+            while ((size_t)(count + 1) * BLOCK_SIZE <= len &&
+                   (pins_used == 0 || pin_find(block + count) == NULL)) {
+                count++;
+            }
+            chunk = (size_t)count * BLOCK_SIZE;
+            if (backend_io(block, count, mem, to_disk) != 0) {
+                return -1;
+            }
+        } else if (backend->base != NULL) {
+            uint8_t *dev = backend->base + offset;
+            if (to_disk) {
+                memcpy(dev, mem, chunk);
+            } else {
+                memcpy(mem, dev, chunk);
+            }
+        } else {
+            // Partial block on an unmapped backend: read-modify-write
+            uint8_t bounce[BLOCK_SIZE];
+            if (backend_io(block, 1, bounce, 0) != 0) {
+                return -1;
+            }
+            if (to_disk) {
+                memcpy(bounce + in_block, mem, chunk);
+                if (backend_io(block, 1, bounce, 1) != 0) {
+                    return -1;
+                }
+            } else {
+                memcpy(mem, bounce + in_block, chunk);
+            }
+        }
+
+        offset += chunk;
+        mem += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int block_set_backend(struct block_backend *be) {
+    if (pins_used != 0) {
+        return -1; // Borrowed pointers would dangle
+    }
+    backend = be != NULL ? be : &ram_backend;
     return 0;
 }
 
+struct block_backend *block_get_backend(void) {
+    return backend;
+}
+
+uint32_t block_count(void) {
+    return backend->nblocks;
+}
+
+int block_sync(void) {
+    if (backend->sync == NULL) {
+        return 0;
+    }
+    return backend->sync(backend);
+}
+
+int read_block(uint32_t block, void *buffer) {
+    if (block >= backend->nblocks) {
+        return -1;
+    }
+    return device_copy((size_t)block * BLOCK_SIZE, buffer, BLOCK_SIZE, 0);
+}
+
 int write_block(uint32_t block, const void *buffer) {
-    if (block >= DISK_SIZE) {
+    if (block >= backend->nblocks) {
+        return -1;
+    }
+    return device_copy((size_t)block * BLOCK_SIZE, (uint8_t *)buffer, BLOCK_SIZE, 1);
+}
+
+// Validate a vectored request: one bounds check for the whole range
+static int blocks_check(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt) {
+    if (start >= backend->nblocks || count > backend->nblocks - start || iovcnt < 0) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    return total == (size_t)count * BLOCK_SIZE ? 0 : -1;
+}
+
+// Length of the run of segments starting at iov[i] that are contiguous in memory
+static size_t iov_merge(const struct block_iovec *iov, int iovcnt, int *i) {
+    size_t len = iov[*i].len;
+    while (*i + 1 < iovcnt && (uint8_t *)iov[*i].base + iov[*i].len == iov[*i + 1].base) {
+        (*i)++;
+        len += iov[*i].len;
+    }
+    return len;
+}
+
+static int blocks_io(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt, int to_disk) {
+    if (blocks_check(start, count, iov, iovcnt) != 0) {
         return -1;
     }
-    memcpy(disk[block], buffer, BLOCK_SIZE);
+    size_t offset = (size_t)start * BLOCK_SIZE;
+    for (int i = 0; i < iovcnt; i++) {
+        uint8_t *base = iov[i].base;
+        size_t len = iov_merge(iov, iovcnt, &i);
+        if (device_copy(offset, base, len, to_disk) != 0) {
+            return -1;
+        }
+        offset += len;
+    }
     return 0;
 }
+
+int read_blocks(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt) {
+    return blocks_io(start, count, iov, iovcnt, 0);
+}
+
+int write_blocks(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt) {
+    return blocks_io(start, count, iov, iovcnt, 1);
+}
+
+const void *block_borrow(uint32_t block) {
+    if (block >= backend->nblocks) {
+        return NULL;
+    }
+    struct block_pin *pin = pin_get(block);
+    if (pin == NULL) {
+        return NULL;
+    }
+
+    // A writer's draft is private, so readers always get committed data
+    if (pin->pending != NULL) {
+        pin->pending->refs++;
+        return pin->pending->data;
+    }
+    uint8_t *live = pin_live(pin);
+    if (live == NULL) {
+        pin_put(pin);
+        return NULL;
+    }
+    pin->refs++;
+    return live;
+}
+
+void block_return(uint32_t block, const void *data) {
+    struct block_pin *pin = pin_find(block);
+    if (pin == NULL) {
+        return;
+    }
+
+    if (pin_is_live(pin, data) && pin->refs > 0) {
+        pin->refs--;
+        if (pin->refs == 0 && pin->pending != NULL) {
+            pin_publish(pin);
+        }
+    } else if (pin->pending != NULL && data == pin->pending->data && pin->pending->refs > 0) {
+        pin->pending->refs--;
+    } else {
+        for (struct block_copy **link = &pin->retired; *link != NULL; link = &(*link)->next) {
+            struct block_copy *copy = *link;
+            if (data == copy->data && copy->refs > 0) {
+                if (--copy->refs == 0) {
+                    *link = copy->next;
+                    free(copy);
+                }
+                break;
+            }
+        }
+    }
+    pin_put(pin);
+}
+
+void *block_borrow_mut(uint32_t block) {
+    if (block >= backend->nblocks) {
+        return NULL;
+    }
+    struct block_pin *pin = pin_get(block);
+    if (pin == NULL) {
+        return NULL;
+    }
+
+    // One writer at a time, working on a private copy of the newest data
+    const uint8_t *newest = pin->pending != NULL ? pin->pending->data : pin_live(pin);
+    uint8_t *draft = pin->writer || newest == NULL ? NULL : malloc(BLOCK_SIZE);
+    if (draft == NULL) {
+        pin_put(pin);
+        return NULL;
+    }
+    memcpy(draft, newest, BLOCK_SIZE);
+    pin->draft = draft;
+    pin->writer = 1;
+    return draft;
+}
+
+int block_commit(uint32_t block, void *data) {
+    struct block_pin *pin = pin_find(block);
+    if (pin == NULL || !pin->writer || data != pin->draft) {
+        return -1;
+    }
+
+    int status = pin_write(pin, 0, pin->draft, BLOCK_SIZE);
+    free(pin->draft);
+    pin->draft = NULL;
+    pin->writer = 0;
+    pin_put(pin);
+    return status;
+}
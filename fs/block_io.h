@@ -2,8 +2,68 @@
 #define BLOCK_IO_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#define DISK_SIZE 1024     // Capacity of the built-in RAM backend (in blocks)
+#define BLOCK_SIZE 4096
+
+// Maximum number of distinct blocks that can be borrowed at the same time
+#define BLOCK_PIN_SLOTS 32
+
+// Scatter/gather segment for vectored block I/O
+struct block_iovec {
+    void *base;   // Start of the memory segment
+    size_t len;   // Segment length in bytes
+};
+
+// Storage behind read_block()/write_block(). Backends that live in memory
+// set base to a linear mapping of the whole device; the others implement
+// read/write, which always move whole blocks.
+struct block_backend {
+    const char *name;
+    uint32_t nblocks;   // Capacity in blocks
+    uint8_t *base;      // Linear mapping of the device, or NULL
+    int (*read)(struct block_backend *be, uint32_t start, uint32_t count, void *buffer);
+    int (*write)(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer);
+    int (*sync)(struct block_backend *be);  // Persist written blocks (optional)
+    // Write and persist blocks at once, ahead of anything the backend is
+    // still holding back (optional; write + sync otherwise)
+    int (*write_now)(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer);
+    void *priv;         // Backend private data
+};
+
+// Switch to another backend (NULL restores the RAM disk). Fails while blocks
+// are borrowed; the caller drops cached buffers first (binvalidate()).
+int block_set_backend(struct block_backend *be);
+struct block_backend *block_get_backend(void);
+uint32_t block_count(void);
+int block_sync(void);
+
+// Move whole blocks to or from a specific backend, bypassing block_io state
+// (for backends stacked on top of another one)
+int block_backend_io(struct block_backend *be, uint32_t start, uint32_t count, void *buffer, int to_disk);
+int block_backend_write_now(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer);
 
 int read_block(uint32_t block, void *buffer);
 int write_block(uint32_t block, const void *buffer);
 
+// Vectored I/O on count blocks starting at start. The segments are filled
+// (or drained) in order and must add up to exactly count * BLOCK_SIZE bytes.
+int read_blocks(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt);
+int write_blocks(uint32_t start, uint32_t count, const struct block_iovec *iov, int iovcnt);
+
+// Zero-copy access to the backing store.
+// block_borrow() returns a pinned read-only pointer straight into the block;
+// it stays valid and unchanged until block_return(). Writes to a block that
+// has readers, through write_block(), write_blocks() or block_commit(), go
+// to a private copy that replaces the live data once the last reader of the
+// old contents has returned it; later borrowers see the newest data.
+// block_borrow_mut() returns a private copy of the block for one writer at a
+// time, and block_commit() publishes it. Blocks cached by bcache should not
+// also be borrowed, since dirty cached data is not visible here.
+const void *block_borrow(uint32_t block);
+void block_return(uint32_t block, const void *data);
+void *block_borrow_mut(uint32_t block);
+int block_commit(uint32_t block, void *data);
+
 #endif // BLOCK_IO_H
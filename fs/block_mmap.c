@@ -0,0 +1,96 @@
+// Hosted build only: disk images are regular files mapped with mmap()
+
+#include "block_mmap.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mmap_disk {
+    struct block_backend backend;
+    int fd;
+    size_t length;   // Mapped bytes (nblocks * BLOCK_SIZE)
+};
+
+static int mmap_sync(struct block_backend *be) {
+    struct mmap_disk *md = be->priv;
+    // The kernel only writes back pages that were actually dirtied
+    return msync(be->base, md->length, MS_SYNC) == 0 ? 0 : -1;
+}
+
+struct block_backend *block_mmap_open(const char *path, uint32_t nblocks) {
+    if (path == NULL) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Error opening disk image");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    if (nblocks == 0) {
+        nblocks = st.st_size / BLOCK_SIZE;
+    }
+    size_t length = (size_t)nblocks * BLOCK_SIZE;
+    if (length == 0) {
+        printf("Disk image %s is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Extending the file leaves a hole, so a large image is created instantly
+    if ((size_t)st.st_size < length && ftruncate(fd, length) != 0) {
+        perror("Error resizing disk image");
+        close(fd);
+        return NULL;
+    }
+
+    // No MAP_POPULATE: pages are faulted in lazily on first touch
+    uint8_t *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping disk image");
+        close(fd);
+        return NULL;
+    }
+
+    struct mmap_disk *md = malloc(sizeof(*md));
+    if (md == NULL) {
+        munmap(base, length);
+        close(fd);
+        return NULL;
+    }
+
+    md->fd = fd;
+    md->length = length;
+    md->backend.name = "mmap";
+    md->backend.nblocks = nblocks;
+    md->backend.base = base;
+    md->backend.read = NULL;
+    md->backend.write = NULL;
+    md->backend.sync = mmap_sync;
+    md->backend.write_now = NULL;
+    md->backend.priv = md;
+    return &md->backend;
+}
+
+int block_mmap_close(struct block_backend *be) {
+    if (be == NULL) {
+        return -1;
+    }
+
+    struct mmap_disk *md = be->priv;
+    int status = mmap_sync(be);
+    munmap(be->base, md->length);
+    close(md->fd);
+    free(md);
+    return status;
+}
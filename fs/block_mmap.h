@@ -0,0 +1,16 @@
+#ifndef BLOCK_MMAP_H
+#define BLOCK_MMAP_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+// Open (or create) a disk image file and map it as a block backend.
+// nblocks sets the capacity; 0 keeps the current size of the image. Growing
+// an image only extends the file, so untouched blocks cost no disk space and
+// are paged in on first access. Returns NULL on error.
+struct block_backend *block_mmap_open(const char *path, uint32_t nblocks);
+
+// Persist and unmap an image opened with block_mmap_open()
+int block_mmap_close(struct block_backend *be);
+
+#endif // BLOCK_MMAP_H
@@ -0,0 +1,334 @@
+#include "block_zram.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Keep a block compressed only if it shrinks to at most this size
+#define ZRAM_MAX_COMPRESSED (BLOCK_SIZE - BLOCK_SIZE / 4)
+
+#define ZRAM_HASH_BITS 12
+#define ZRAM_MIN_MATCH 4
+
+// Slot flags
+#define ZRAM_ZERO 0x01   // All zeros, no data stored
+#define ZRAM_RAW  0x02   // Stored uncompressed
+
+struct zram_slot {
+    uint8_t *data;    // NULL for unwritten and zero blocks
+    uint16_t len;     // Bytes at data
+    uint16_t flags;
+};
+
+struct zram_disk {
+    struct block_backend backend;
+    struct zram_slot *slots;
+    struct zram_stats stats;
+};
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - ZRAM_HASH_BITS);
+}
+
+static int lz_put_length(uint8_t **op, const uint8_t *end, uint32_t len) {
+    while (len >= 255) {
+        if (*op >= end) {
+            return -1;
+        }
+        *(*op)++ = 255;
+        len -= 255;
+    }
+    if (*op >= end) {
+        return -1;
+    }
+    *(*op)++ = (uint8_t)len;
+    return 0;
+}
+
+// One LZ4-style sequence: token (literal and match length nibbles),
+// literals, 16-bit offset, match length extension. A sequence without a
+// match ends the block.
+static int lz_put_sequence(uint8_t **op, const uint8_t *end, const uint8_t *lit, uint32_t nlit,
+                           uint32_t offset, uint32_t mlen) {
+    uint32_t mcode = mlen != 0 ? mlen - ZRAM_MIN_MATCH : 0;
+    if (*op >= end) {
+        return -1;
+    }
+    uint8_t *token = (*op)++;
+    *token = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (mcode < 15 ? mcode : 15));
+
+    if (nlit >= 15 && lz_put_length(op, end, nlit - 15) != 0) {
+        return -1;
+    }
+    if ((size_t)(end - *op) < nlit) {
+        return -1;
+    }
+    memcpy(*op, lit, nlit);
+    *op += nlit;
+
+    if (mlen == 0) {
+        return 0;
+    }
+    if (end - *op < 2) {
+        return -1;
+    }
+    *(*op)++ = (uint8_t)offset;
+    *(*op)++ = (uint8_t)(offset >> 8);
+    if (mcode >= 15 && lz_put_length(op, end, mcode - 15) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Compress one block into dst; returns the compressed size, or -1 if it
+// does not fit in cap bytes
+static int lz_compress(const uint8_t *src, uint8_t *dst, int cap) {
+    uint16_t table[1 << ZRAM_HASH_BITS];
+    const uint8_t *end = dst + cap;
+    uint8_t *op = dst;
+    uint32_t anchor = 0;
+    uint32_t ip = 0;
+    uint32_t misses = 0;
+
+    memset(table, 0, sizeof(table));
+    while (ip + ZRAM_MIN_MATCH <= BLOCK_SIZE) {
+        uint32_t v = read32(src + ip);
+        uint32_t h = lz_hash(v);
+        uint32_t ref = table[h];
+        table[h] = (uint16_t)ip;
+
+        if (ref >= ip || read32(src + ref) != v) {
+            // Skip faster through data that does not compress
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        uint32_t mlen = ZRAM_MIN_MATCH;
+        while (ip + mlen < BLOCK_SIZE && src[ref + mlen] == src[ip + mlen]) {
+            mlen++;
+        }
+        if (lz_put_sequence(&op, end, src + anchor, ip - anchor, ip - ref, mlen) != 0) {
+            return -1;
+        }
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if (lz_put_sequence(&op, end, src + anchor, BLOCK_SIZE - anchor, 0, 0) != 0) {
+        return -1;
+    }
+    return (int)(op - dst);
+}
+
+static int lz_get_length(const uint8_t **ip, const uint8_t *end, uint32_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Decompress into a BLOCK_SIZE buffer; every access is bounds checked
+static int lz_decompress(const uint8_t *src, int len, uint8_t *dst) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + len;
+    uint32_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        uint32_t nlit = token >> 4;
+        if (nlit == 15 && lz_get_length(&ip, end, &nlit) != 0) {
+            return -1;
+        }
+        if ((size_t)(end - ip) < nlit || op + nlit > BLOCK_SIZE) {
+            return -1;
+        }
+        memcpy(dst + op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == end) {
+            break; // Final literals
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | (uint32_t)ip[1] << 8;
+        ip += 2;
+        uint32_t mlen = token & 15;
+        if (mlen == 15 && lz_get_length(&ip, end, &mlen) != 0) {
+            return -1;
+        }
+        mlen += ZRAM_MIN_MATCH;
+        if (offset == 0 || offset > op || op + mlen > BLOCK_SIZE) {
+            return -1;
+        }
+        if (offset >= mlen) {
+            memcpy(dst + op, dst + op - offset, mlen);
+            op += mlen;
+        } else if (offset >= 8) {
+            // Overlapping, but each 8-byte step only reads finished bytes
+            uint32_t i = 0;
+            for (; i + 8 <= mlen; i += 8) {
+                memcpy(dst + op + i, dst + op + i - offset, 8);
+            }
+            for (; i < mlen; i++) {
+                dst[op + i] = dst[op + i - offset];
+            }
+            op += mlen;
+        } else {
+            // Short period (runs): byte by byte
+            for (uint32_t i = 0; i < mlen; i++, op++) {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+    return op == BLOCK_SIZE ? 0 : -1;
+}
+
+static int block_is_zero(const uint8_t *data) {
+    const uint64_t *w = (const uint64_t *)data;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < BLOCK_SIZE / sizeof(uint64_t); i++) {
+        acc |= w[i];
+    }
+    return acc == 0;
+}
+
+static void slot_drop(struct zram_disk *zd, struct zram_slot *slot) {
+    if (slot->flags & ZRAM_ZERO) {
+        zd->stats.zero--;
+    } else if (slot->data != NULL) {
+        if (slot->flags & ZRAM_RAW) {
+            zd->stats.raw--;
+        } else {
+            zd->stats.stored--;
+        }
+        zd->stats.orig_bytes -= BLOCK_SIZE;
+        zd->stats.compr_bytes -= slot->len;
+    }
+    free(slot->data);
+    slot->data = NULL;
+    slot->len = 0;
+    slot->flags = 0;
+}
+
+static int zram_store(struct zram_disk *zd, struct zram_slot *slot, const uint8_t *data) {
+    uint8_t packed[ZRAM_MAX_COMPRESSED];
+
+    slot_drop(zd, slot);
+    if (block_is_zero(data)) {
+        slot->flags = ZRAM_ZERO;
+        zd->stats.zero++;
+        return 0;
+    }
+
+    int len = lz_compress(data, packed, sizeof(packed));
+    const uint8_t *src = packed;
+    uint16_t flags = 0;
+    if (len < 0) {
+        len = BLOCK_SIZE;
+        src = data;
+        flags = ZRAM_RAW;
+    }
+
+    slot->data = malloc(len);
+    if (slot->data == NULL) {
+        return -1;
+    }
+    memcpy(slot->data, src, len);
+    slot->len = (uint16_t)len;
+    slot->flags = flags;
+    if (flags & ZRAM_RAW) {
+        zd->stats.raw++;
+    } else {
+        zd->stats.stored++;
+    }
+    zd->stats.orig_bytes += BLOCK_SIZE;
+    zd->stats.compr_bytes += len;
+    return 0;
+}
+
+static int zram_read(struct block_backend *be, uint32_t start, uint32_t count, void *buffer) {
+    struct zram_disk *zd = be->priv;
+    uint8_t *out = buffer;
+
+    for (uint32_t i = 0; i < count; i++, out += BLOCK_SIZE) {
+        const struct zram_slot *slot = &zd->slots[start + i];
+        if (slot->data == NULL) {
+            memset(out, 0, BLOCK_SIZE); // Unwritten or zero
+        } else if (slot->flags & ZRAM_RAW) {
+            memcpy(out, slot->data, BLOCK_SIZE);
+        } else if (lz_decompress(slot->data, slot->len, out) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int zram_write(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    struct zram_disk *zd = be->priv;
+    const uint8_t *in = buffer;
+
+    for (uint32_t i = 0; i < count; i++, in += BLOCK_SIZE) {
+        if (zram_store(zd, &zd->slots[start + i], in) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct block_backend *block_zram_open(uint32_t nblocks) {
+    if (nblocks == 0) {
+        return NULL;
+    }
+    struct zram_disk *zd = calloc(1, sizeof(*zd));
+    if (zd == NULL) {
+        return NULL;
+    }
+    zd->slots = calloc(nblocks, sizeof(*zd->slots));
+    if (zd->slots == NULL) {
+        free(zd);
+        return NULL;
+    }
+
+    zd->backend.name = "zram";
+    zd->backend.nblocks = nblocks;
+    zd->backend.base = NULL;
+    zd->backend.read = zram_read;
+    zd->backend.write = zram_write;
+    zd->backend.sync = NULL; // Nothing to persist
+    zd->backend.priv = zd;
+    return &zd->backend;
+}
+
+void block_zram_close(struct block_backend *be) {
+    struct zram_disk *zd = be->priv;
+    for (uint32_t i = 0; i < be->nblocks; i++) {
+        free(zd->slots[i].data);
+    }
+    free(zd->slots);
+    free(zd);
+}
+
+void block_zram_get_stats(struct block_backend *be, struct zram_stats *out) {
+    struct zram_disk *zd = be->priv;
+    *out = zd->stats;
+}
+
+double block_zram_ratio(struct block_backend *be) {
+    struct zram_disk *zd = be->priv;
+    if (zd->stats.compr_bytes == 0) {
+        return 1.0;
+    }
+    return (double)zd->stats.orig_bytes / (double)zd->stats.compr_bytes;
+}
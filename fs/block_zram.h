@@ -0,0 +1,26 @@
+#ifndef BLOCK_ZRAM_H
+#define BLOCK_ZRAM_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+struct zram_stats {
+    uint64_t stored;        // Blocks holding compressed data
+    uint64_t zero;          // Blocks recorded as all zeros (no storage)
+    uint64_t raw;           // Blocks that did not compress and are kept as is
+    uint64_t orig_bytes;    // Uncompressed size of the stored blocks
+    uint64_t compr_bytes;   // Memory used for block data
+};
+
+// RAM disk of nblocks blocks kept compressed in memory. Unwritten and
+// all-zero blocks cost no memory; the rest are stored LZ-compressed, or
+// uncompressed when compression would not save at least a quarter.
+struct block_backend *block_zram_open(uint32_t nblocks);
+void block_zram_close(struct block_backend *be);
+
+void block_zram_get_stats(struct block_backend *be, struct zram_stats *stats);
+
+// Compression ratio of the stored blocks (uncompressed / used memory)
+double block_zram_ratio(struct block_backend *be);
+
+#endif // BLOCK_ZRAM_H
@@ -0,0 +1,17 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32C (Castagnoli). Pass 0 as crc to start a new checksum, or the
+// previous result to continue one.
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// Implementation picked for this CPU ("sse4.2" or "slice8")
+const char *crc32c_impl(void);
+
+// Throughput benchmark over block-sized buffers
+int crc32c_bench(void);
+
+#endif // CRC32C_H
@@ -0,0 +1,161 @@
+#include "dcache.h"
+#include <string.h>
+
+static struct dentry entries[DCACHE_ENTRIES];
+static struct dentry *hash_table[DCACHE_HASH_SIZE];
+static struct dentry *lru_head = NULL;   // Most recently used
+static struct dentry *lru_tail = NULL;   // Eviction candidate
+static uint32_t entries_used = 0;
+static struct dcache_stats stats;
+
+// FNV-1a
+uint32_t dcache_hash_name(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t dcache_slot(const inode_t *parent, uint32_t hash) {
+    uintptr_t p = (uintptr_t)parent;
+    return (hash ^ (uint32_t)(p >> 4) ^ (uint32_t)(p >> 20)) % DCACHE_HASH_SIZE;
+}
+
+static void lru_unlink(struct dentry *d) {
+    if (d->lru_prev != NULL) {
+        d->lru_prev->lru_next = d->lru_next;
+    } else {
+        lru_head = d->lru_next;
+    }
+    if (d->lru_next != NULL) {
+        d->lru_next->lru_prev = d->lru_prev;
+    } else {
+        lru_tail = d->lru_prev;
+    }
+    d->lru_prev = NULL;
+    d->lru_next = NULL;
+}
+
+static void lru_push_front(struct dentry *d) {
+    d->lru_prev = NULL;
+    d->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = d;
+    }
+    lru_head = d;
+    if (lru_tail == NULL) {
+        lru_tail = d;
+    }
+}
+
+static void dentry_remove(struct dentry *d) {
+    struct dentry **link = &hash_table[dcache_slot(d->parent, d->name->hash)];
+    while (*link != NULL) {
+        if (*link == d) {
+            *link = d->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    lru_unlink(d);
+    iname_put(d->name);
+    d->name = NULL;
+    d->in_use = 0;
+    d->hash_next = NULL;
+}
+
+static struct dentry *dentry_find(inode_t *parent, const char *name, size_t len, uint32_t hash) {
+    struct dentry *d = hash_table[dcache_slot(parent, hash)];
+    for (; d != NULL; d = d->hash_next) {
+        if (d->name->hash == hash && d->parent == parent && d->name->len == len &&
+            memcmp(d->name->str, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static struct dentry *dentry_alloc(void) {
+    if (entries_used < DCACHE_ENTRIES) {
+        return &entries[entries_used++];
+    }
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        if (!entries[i].in_use) {
+            return &entries[i];
+        }
+    }
+
+    // Over the cap: recycle the least recently used entry
+    struct dentry *victim = lru_tail;
+    dentry_remove(victim);
+    stats.evictions++;
+    return victim;
+}
+
+int dcache_lookup(inode_t *parent, const char *name, size_t len, uint32_t hash, inode_t **inode) {
+    struct dentry *d = dentry_find(parent, name, len, hash);
+    if (d == NULL) {
+        stats.misses++;
+        return 0;
+    }
+
+    if (d != lru_head) {
+        lru_unlink(d);
+        lru_push_front(d);
+    }
+    if (d->inode != NULL) {
+        stats.hits++;
+    } else {
+        stats.negative_hits++;
+    }
+    *inode = d->inode;
+    return 1;
+}
+
+void dcache_add(inode_t *parent, const char *name, size_t len, uint32_t hash, inode_t *inode) {
+    struct dentry *d = dentry_find(parent, name, len, hash);
+    if (d != NULL) {
+        d->inode = inode;
+        if (d != lru_head) {
+            lru_unlink(d);
+            lru_push_front(d);
+        }
+        return;
+    }
+
+    const struct iname *iname = iname_get(name, len, hash);
+    if (iname == NULL) {
+        return;
+    }
+    d = dentry_alloc();
+    d->parent = parent;
+    d->inode = inode;
+    d->name = iname;
+    d->in_use = 1;
+
+    uint32_t slot = dcache_slot(parent, hash);
+    d->hash_next = hash_table[slot];
+    hash_table[slot] = d;
+    lru_push_front(d);
+}
+
+void dcache_invalidate(inode_t *parent, const char *name, size_t len, uint32_t hash) {
+    struct dentry *d = dentry_find(parent, name, len, hash);
+    if (d != NULL) {
+        dentry_remove(d);
+    }
+}
+
+void dcache_purge_inode(inode_t *inode) {
+    for (uint32_t i = 0; i < entries_used; i++) {
+        if (entries[i].in_use && (entries[i].parent == inode || entries[i].inode == inode)) {
+            dentry_remove(&entries[i]);
+        }
+    }
+}
+
+void dcache_get_stats(struct dcache_stats *out) {
+    *out = stats;
+}
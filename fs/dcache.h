@@ -0,0 +1,45 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fs.h"
+
+// Dentry cache budget and lookup hash size
+#define DCACHE_ENTRIES 512
+#define DCACHE_HASH_SIZE 1024
+
+// Cached (parent, name) -> inode translation. A NULL inode is a negative
+// entry: the name is known not to exist in the parent.
+struct dentry {
+    inode_t *parent;
+    inode_t *inode;
+    const struct iname *name;         // Interned; hash compared before the bytes
+    struct dentry *hash_next;
+    struct dentry *lru_prev;          // Towards most recently used
+    struct dentry *lru_next;          // Towards least recently used
+    int in_use;
+};
+
+struct dcache_stats {
+    uint64_t hits;            // Positive entries found
+    uint64_t negative_hits;   // Negative entries found
+    uint64_t misses;          // Lookups that had to search the directory
+    uint64_t evictions;       // Entries recycled under the memory cap
+};
+
+uint32_t dcache_hash_name(const char *name, size_t len);
+
+// Returns 1 and sets *inode (possibly NULL) on a hit, 0 on a miss
+int dcache_lookup(inode_t *parent, const char *name, size_t len, uint32_t hash, inode_t **inode);
+
+// Record a positive (inode != NULL) or negative entry, replacing any old one
+void dcache_add(inode_t *parent, const char *name, size_t len, uint32_t hash, inode_t *inode);
+
+// Forget one name, or every entry referring to an inode being freed
+void dcache_invalidate(inode_t *parent, const char *name, size_t len, uint32_t hash);
+void dcache_purge_inode(inode_t *inode);
+
+void dcache_get_stats(struct dcache_stats *stats);
+
+#endif // DCACHE_H
@@ -0,0 +1,839 @@
+#include "ext4.h"
+#include "bcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXT4_SUPER_OFFSET 1024
+#define EXT4_INCOMPAT_SUPPORTED (EXT4_INCOMPAT_FILETYPE | EXT4_INCOMPAT_EXTENTS | EXT4_INCOMPAT_64BIT | \
+                                 EXT4_INCOMPAT_MMP | EXT4_INCOMPAT_FLEX_BG | EXT4_INCOMPAT_CSUM_SEED | \
+                                 EXT4_INCOMPAT_LARGEDIR)
+#define EXT4_FLAGS_UNSIGNED_HASH 0x0002
+
+// htree hash versions
+#define DX_HASH_LEGACY   0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA      2
+#define DX_HASH_UNSIGNED 3   // Added to the above on unsigned-char platforms
+
+// On-disk superblock fields used by the driver (byte offsets)
+struct ext4_super {
+    uint32_t inodes_count;           // 0x00
+    uint32_t blocks_count_lo;        // 0x04
+    uint32_t r_blocks_count_lo;
+    uint32_t free_blocks_count_lo;
+    uint32_t free_inodes_count;      // 0x10
+    uint32_t first_data_block;
+    uint32_t log_block_size;
+    uint32_t log_cluster_size;
+    uint32_t blocks_per_group;       // 0x20
+    uint32_t clusters_per_group;
+    uint32_t inodes_per_group;
+    uint32_t mtime;
+    uint32_t wtime;                  // 0x30
+    uint16_t mnt_count;
+    uint16_t max_mnt_count;
+    uint16_t magic;                  // 0x38
+    uint16_t state;
+    uint16_t errors;
+    uint16_t minor_rev_level;
+    uint32_t lastcheck;              // 0x40
+    uint32_t checkinterval;
+    uint32_t creator_os;
+    uint32_t rev_level;
+    uint16_t def_resuid;             // 0x50
+    uint16_t def_resgid;
+    uint32_t first_ino;
+    uint16_t inode_size;             // 0x58
+    uint16_t block_group_nr;
+    uint32_t feature_compat;         // 0x5C
+    uint32_t feature_incompat;       // 0x60
+    uint32_t feature_ro_compat;
+    uint8_t uuid[16];                // 0x68
+    char volume_name[16];            // 0x78
+    char last_mounted[64];           // 0x88
+    uint32_t algorithm_usage_bitmap; // 0xC8
+    uint8_t prealloc_blocks;
+    uint8_t prealloc_dir_blocks;
+    uint16_t reserved_gdt_blocks;
+    uint8_t journal_uuid[16];        // 0xD0
+    uint32_t journal_inum;           // 0xE0
+    uint32_t journal_dev;
+    uint32_t last_orphan;
+    uint32_t hash_seed[4];           // 0xEC
+    uint8_t def_hash_version;        // 0xFC
+    uint8_t jnl_backup_type;
+    uint16_t desc_size;              // 0xFE
+    uint32_t default_mount_opts;     // 0x100
+    uint32_t first_meta_bg;
+    uint32_t mkfs_time;
+    uint32_t jnl_blocks[17];         // 0x10C
+    uint32_t blocks_count_hi;        // 0x150
+    uint32_t r_blocks_count_hi;
+    uint32_t free_blocks_count_hi;
+    uint16_t min_extra_isize;
+    uint16_t want_extra_isize;
+    uint32_t flags;                  // 0x160
+    uint16_t raid_stride;
+    uint16_t mmp_interval;
+    uint64_t mmp_block;
+    uint32_t raid_stripe_width;      // 0x170
+    uint8_t log_groups_per_flex;     // 0x174
+} __attribute__((packed));
+
+// Fields of the on-disk inode used by the driver
+struct ext4_inode {
+    uint16_t mode;
+    uint16_t uid;
+    uint32_t size_lo;
+    uint32_t atime;
+    uint32_t ctime;
+    uint32_t mtime;
+    uint32_t dtime;
+    uint16_t gid;
+    uint16_t links_count;
+    uint32_t blocks_lo;
+    uint32_t flags;                  // 0x20
+    uint32_t osd1;
+    uint8_t block[60];               // 0x28
+    uint32_t generation;
+    uint32_t file_acl_lo;
+    uint32_t size_high;              // 0x6C
+} __attribute__((packed));
+
+struct ext4_dir_entry {
+    uint32_t inode;
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t file_type;
+    char name[];
+} __attribute__((packed));
+
+// htree index entry; in entries[0] the hash field holds limit and count
+struct dx_entry {
+    uint32_t hash;
+    uint32_t block;                  // Logical block in the directory
+} __attribute__((packed));
+
+// Mounted volume
+struct ext4_volume {
+    int mounted;
+    uint32_t inodes_per_group;
+    uint32_t inode_size;
+    uint32_t group_count;
+    uint32_t groups_per_flex;
+    uint32_t feature_compat;
+    uint64_t blocks_count;
+    uint64_t *inode_tables;          // Cached from the group descriptors
+    uint32_t hash_seed[4];
+    int hash_unsigned;
+};
+
+// Copy of an extent tree or htree index block
+struct node_slot {
+    uint64_t block;
+    uint32_t last_use;
+    uint8_t valid;
+    uint8_t data[BLOCK_SIZE];
+};
+
+static struct ext4_volume vol;
+static struct node_slot node_cache[EXT4_NODE_CACHE];
+static uint32_t node_clock = 0;
+static struct ext4_stats stats;
+static struct ext4_file *page_file = NULL;   // File of the last readpage, with its leaf
+
+// Index block through the node cache; valid until the next node_get()
+static const uint8_t *node_get(uint64_t block) {
+    struct node_slot *victim = &node_cache[0];
+
+    for (int i = 0; i < EXT4_NODE_CACHE; i++) {
+        struct node_slot *slot = &node_cache[i];
+        if (slot->valid && slot->block == block) {
+            stats.node_hits++;
+            slot->last_use = ++node_clock;
+            return slot->data;
+        }
+        if (!slot->valid || (victim->valid && slot->last_use < victim->last_use)) {
+            victim = slot;
+        }
+    }
+
+    stats.node_misses++;
+    victim->valid = 0;
+    if (block >= vol.blocks_count || read_block((uint32_t)block, victim->data) != 0) {
+        return NULL;
+    }
+    victim->block = block;
+    victim->valid = 1;
+    victim->last_use = ++node_clock;
+    return victim->data;
+}
+
+static int inode_load(uint32_t ino, struct ext4_file *f) {
+    if (ino == 0 || ino > vol.inodes_per_group * vol.group_count) {
+        return -1;
+    }
+    uint32_t group = (ino - 1) / vol.inodes_per_group;
+    uint64_t byte = (uint64_t)((ino - 1) % vol.inodes_per_group) * vol.inode_size;
+    uint64_t block = vol.inode_tables[group] + byte / BLOCK_SIZE;
+    if (block >= vol.blocks_count) {
+        return -1;
+    }
+
+    struct buffer_head *bh = bread((uint32_t)block);
+    if (bh == NULL) {
+        return -1;
+    }
+    struct ext4_inode raw;
+    memcpy(&raw, bh->data + byte % BLOCK_SIZE, sizeof(raw));
+    brelse(bh);
+
+    f->ino = ino;
+    f->mode = raw.mode;
+    f->flags = raw.flags;
+    f->size = raw.size_lo | ((uint64_t)raw.size_high << 32);
+    memcpy(f->root, raw.block, sizeof(f->root));
+    f->leaf_first = 0;
+    f->leaf_end = 0;
+    f->leaf_count = 0;
+    return 0;
+}
+
+static int extent_header_ok(const struct ext4_extent_header *h, size_t bytes) {
+    return h->magic == EXT4_EXTENT_MAGIC && h->depth <= EXT4_MAX_DEPTH &&
+           h->entries <= (bytes - sizeof(*h)) / sizeof(struct ext4_extent);
+}
+
+// Walk the extent tree down to the leaf covering lblk and cache it in the file
+static int leaf_load(struct ext4_file *f, uint32_t lblk) {
+    const uint8_t *node = f->root;
+    size_t bytes = sizeof(f->root);
+    uint32_t first = 0;
+    uint64_t end = UINT32_MAX + 1ULL;
+
+    if (!(f->flags & EXT4_EXTENTS_FL)) {
+        printf("EXT4: inode %u uses indirect blocks, which are not supported\n", f->ino);
+        return -1;
+    }
+
+    for (int level = 0; level <= EXT4_MAX_DEPTH; level++) {
+        const struct ext4_extent_header *h = (const struct ext4_extent_header *)node;
+        if (!extent_header_ok(h, bytes)) {
+            printf("EXT4: bad extent header in inode %u\n", f->ino);
+            return -1;
+        }
+        if (h->depth == 0) {
+            memcpy(f->leaf, h + 1, h->entries * sizeof(struct ext4_extent));
+            f->leaf_count = h->entries;
+            f->leaf_first = first;
+            f->leaf_end = end > UINT32_MAX ? UINT32_MAX : (uint32_t)end;
+            return 0;
+        }
+
+        // Last index entry starting at or before lblk
+        const struct ext4_extent_idx *idx = (const struct ext4_extent_idx *)(h + 1);
+        int lo = 0, hi = h->entries - 1;
+        if (h->entries == 0 || idx[0].block > lblk) {
+            return -1;
+        }
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (idx[mid].block <= lblk) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        first = idx[lo].block;
+        if (lo + 1 < h->entries) {
+            end = idx[lo + 1].block;
+        }
+
+        node = node_get(idx[lo].leaf_lo | ((uint64_t)idx[lo].leaf_hi << 32));
+        bytes = BLOCK_SIZE;
+        if (node == NULL) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Map logical block lblk: *pblk is 0 for holes and unwritten extents, and
+// *len counts the following blocks mapped the same way
+static int file_map(struct ext4_file *f, uint32_t lblk, uint64_t *pblk, uint32_t *len) {
+    if (lblk >= f->leaf_first && lblk < f->leaf_end) {
+        stats.leaf_hits++;
+    } else if (leaf_load(f, lblk) != 0) {
+        return -1;
+    }
+
+    // Last extent starting at or before lblk
+    int lo = 0, hi = (int)f->leaf_count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (f->leaf[mid].block <= lblk) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (found >= 0) {
+        const struct ext4_extent *e = &f->leaf[found];
+        uint32_t elen = e->len > 32768 ? e->len - 32768u : e->len;
+        if (lblk - e->block < elen) {
+            *len = elen - (lblk - e->block);
+            *pblk = e->len > 32768 ? 0 : ((uint64_t)e->start_hi << 32 | e->start_lo) + (lblk - e->block);
+            return 0;
+        }
+    }
+
+    // Hole up to the next extent or the end of the leaf
+    uint32_t next = (uint32_t)(found + 1) < f->leaf_count ? f->leaf[found + 1].block : f->leaf_end;
+    *pblk = 0;
+    *len = next > lblk ? next - lblk : 1;
+    return 0;
+}
+
+long ext4_read(struct ext4_file *f, uint64_t offset, void *buffer, size_t len) {
+    uint8_t *out = buffer;
+    uint8_t bounce[BLOCK_SIZE];
+
+    if (f == NULL || (f->mode & EXT4_S_IFMT) == EXT4_S_IFDIR) {
+        return -1;
+    }
+    if (offset >= f->size || len == 0) {
+        return 0;
+    }
+    if (len > f->size - offset) {
+        len = (size_t)(f->size - offset);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t lblk = (uint32_t)(pos / BLOCK_SIZE);
+        size_t in_block = (size_t)(pos % BLOCK_SIZE);
+        uint64_t pblk;
+        uint32_t run;
+        if (file_map(f, lblk, &pblk, &run) != 0) {
+            return -1;
+        }
+
+        size_t chunk = (size_t)run * BLOCK_SIZE - in_block;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (pblk == 0) {
+            memset(out + done, 0, chunk); // Hole or unwritten extent
+        } else if (in_block != 0 || chunk < BLOCK_SIZE) {
+            // Partial block through the bounce buffer
+            chunk = BLOCK_SIZE - in_block < chunk ? BLOCK_SIZE - in_block : chunk;
+            if (pblk >= vol.blocks_count || read_block((uint32_t)pblk, bounce) != 0) {
+                return -1;
+            }
+            memcpy(out + done, bounce + in_block, chunk);
+        } else {
+            // Whole blocks of the extent straight into the caller's buffer
+            uint32_t count = (uint32_t)(chunk / BLOCK_SIZE);
+            chunk = (size_t)count * BLOCK_SIZE;
+            struct block_iovec iov = { out + done, chunk };
+            if (pblk + count > vol.blocks_count || read_blocks((uint32_t)pblk, count, &iov, 1) != 0) {
+                return -1;
+            }
+            stats.data_reads++;
+        }
+        done += chunk;
+    }
+    return (long)done;
+}
+
+// Physical block of a directory block, or 0 for a hole
+static uint64_t dir_block(struct ext4_file *dir, uint32_t lblk) {
+    uint64_t pblk;
+    uint32_t len;
+    if (file_map(dir, lblk, &pblk, &len) != 0 || pblk >= vol.blocks_count) {
+        return 0;
+    }
+    return pblk;
+}
+
+// Search one directory block for a name
+static int block_find(const uint8_t *data, const char *name, size_t len, uint32_t *ino) {
+    uint32_t pos = 0;
+    while (pos + 8 <= BLOCK_SIZE) {
+        const struct ext4_dir_entry *de = (const struct ext4_dir_entry *)(data + pos);
+        if (de->rec_len < 8 || pos + de->rec_len > BLOCK_SIZE || 8u + de->name_len > de->rec_len) {
+            return -1; // Corrupt block
+        }
+        if (de->inode != 0 && de->name_len == len && memcmp(de->name, name, len) == 0) {
+            *ino = de->inode;
+            return 0;
+        }
+        pos += de->rec_len;
+    }
+    return -1;
+}
+
+static int leaf_block_find(struct ext4_file *dir, uint32_t lblk, const char *name, size_t len, uint32_t *ino) {
+    uint64_t pblk = dir_block(dir, lblk);
+    if (pblk == 0) {
+        return -1;
+    }
+    struct buffer_head *bh = bread((uint32_t)pblk);
+    if (bh == NULL) {
+        return -1;
+    }
+    int status = block_find(bh->data, name, len, ino);
+    brelse(bh);
+    return status;
+}
+
+static int linear_find(struct ext4_file *dir, const char *name, size_t len, uint32_t *ino) {
+    uint32_t blocks = (uint32_t)((dir->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    stats.linear_lookups++;
+    for (uint32_t lblk = 0; lblk < blocks; lblk++) {
+        if (leaf_block_find(dir, lblk, name, len, ino) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Directory name hashes, as computed by Linux (fs/ext4/hash.c)
+#define DX_ROL(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = DX_ROL(a, s))
+#define DX_K2 013240474631U
+#define DX_K3 015666365641U
+
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    DX_ROUND(DX_F, a, b, c, d, in[0], 3);
+    DX_ROUND(DX_F, d, a, b, c, in[1], 7);
+    DX_ROUND(DX_F, c, d, a, b, in[2], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[3], 19);
+    DX_ROUND(DX_F, a, b, c, d, in[4], 3);
+    DX_ROUND(DX_F, d, a, b, c, in[5], 7);
+    DX_ROUND(DX_F, c, d, a, b, in[6], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[7], 19);
+
+    DX_ROUND(DX_G, a, b, c, d, in[1] + DX_K2, 3);
+    DX_ROUND(DX_G, d, a, b, c, in[3] + DX_K2, 5);
+    DX_ROUND(DX_G, c, d, a, b, in[5] + DX_K2, 9);
+    DX_ROUND(DX_G, b, c, d, a, in[7] + DX_K2, 13);
+    DX_ROUND(DX_G, a, b, c, d, in[0] + DX_K2, 3);
+    DX_ROUND(DX_G, d, a, b, c, in[2] + DX_K2, 5);
+    DX_ROUND(DX_G, c, d, a, b, in[4] + DX_K2, 9);
+    DX_ROUND(DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+    DX_ROUND(DX_H, a, b, c, d, in[3] + DX_K3, 3);
+    DX_ROUND(DX_H, d, a, b, c, in[7] + DX_K3, 9);
+    DX_ROUND(DX_H, c, d, a, b, in[2] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[6] + DX_K3, 15);
+    DX_ROUND(DX_H, a, b, c, d, in[1] + DX_K3, 3);
+    DX_ROUND(DX_H, d, a, b, c, in[5] + DX_K3, 9);
+    DX_ROUND(DX_H, c, d, a, b, in[0] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static uint32_t dx_hack_hash(const char *name, size_t len, int is_unsigned) {
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    for (size_t i = 0; i < len; i++) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+        if (hash & 0x80000000) {
+            hash -= 0x7fffffff;
+        }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, size_t len, uint32_t *buf, int num, int is_unsigned) {
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+
+    uint32_t val = pad;
+    if (len > (size_t)num * 4) {
+        len = (size_t)num * 4;
+    }
+    for (size_t i = 0; i < len; i++) {
+        int c = is_unsigned ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+        val = (uint32_t)c + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) {
+        *buf++ = val;
+    }
+    while (--num >= 0) {
+        *buf++ = pad;
+    }
+}
+
+static uint32_t dx_hash(const char *name, size_t len, int version) {
+    uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint32_t in[8];
+    uint32_t hash;
+    int is_unsigned = version >= DX_HASH_UNSIGNED;
+
+    if (vol.hash_seed[0] | vol.hash_seed[1] | vol.hash_seed[2] | vol.hash_seed[3]) {
+        memcpy(buf, vol.hash_seed, sizeof(buf));
+    }
+
+    switch (version % DX_HASH_UNSIGNED) {
+    case DX_HASH_LEGACY:
+        hash = dx_hack_hash(name, len, is_unsigned);
+        break;
+    case DX_HASH_HALF_MD4:
+        for (long left = (long)len; left > 0; left -= 32, name += 32) {
+            str2hashbuf(name, (size_t)left, in, 8, is_unsigned);
+            half_md4_transform(buf, in);
+        }
+        hash = buf[1];
+        break;
+    default: // DX_HASH_TEA
+        for (long left = (long)len; left > 0; left -= 16, name += 16) {
+            str2hashbuf(name, (size_t)left, in, 4, is_unsigned);
+            tea_transform(buf, in);
+        }
+        hash = buf[0];
+        break;
+    }
+
+    hash &= ~1u;
+    if (hash == (0x7fffffffu << 1)) {
+        hash = (0x7fffffffu - 1) << 1;
+    }
+    return hash;
+}
+
+// Find a name through the htree index; returns -2 when the index cannot be
+// used, so the caller falls back to a linear search
+static int dx_find(struct ext4_file *dir, const char *name, size_t len, uint32_t *ino) {
+    uint64_t pblk = dir_block(dir, 0);
+    const uint8_t *node = pblk != 0 ? node_get(pblk) : NULL;
+    if (node == NULL) {
+        return -2;
+    }
+
+    // dx_root: "." and ".." entries, then the root info and the first entries
+    uint8_t hash_version = node[0x1C];
+    uint8_t info_length = node[0x1D];
+    uint8_t levels = node[0x1E];
+    uint32_t reserved_zero;
+    memcpy(&reserved_zero, node + 0x18, 4);
+    if (reserved_zero != 0 || info_length != 8 || levels > 2 || hash_version > DX_HASH_TEA) {
+        return -2;
+    }
+    int version = hash_version + (vol.hash_unsigned ? DX_HASH_UNSIGNED : 0);
+    uint32_t hash = dx_hash(name, len, version);
+    size_t offset = 0x20;
+
+    for (int level = 0;; level++) {
+        const struct dx_entry *entries = (const struct dx_entry *)(node + offset);
+        uint16_t limit, count;
+        memcpy(&limit, node + offset, 2);
+        memcpy(&count, node + offset + 2, 2);
+        if (count == 0 || count > limit || offset + (size_t)limit * sizeof(struct dx_entry) > BLOCK_SIZE) {
+            return -2;
+        }
+
+        // Last entry whose hash is at or below the name's (entry 0 covers 0)
+        uint32_t lo = 0, hi = count - 1u;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (entries[mid].hash <= hash) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        uint32_t block = entries[lo].block;
+
+        if (level == levels) {
+            stats.dx_lookups++;
+            if (leaf_block_find(dir, block, name, len, ino) == 0) {
+                return 0;
+            }
+            // Names with this hash may continue in the next block
+            if (lo + 1 < count && (entries[lo + 1].hash & ~1u) == hash &&
+                leaf_block_find(dir, entries[lo + 1].block, name, len, ino) == 0) {
+                return 0;
+            }
+            return -1;
+        }
+
+        // dx_node: an empty entry spanning the block, then the entries
+        pblk = dir_block(dir, block);
+        node = pblk != 0 ? node_get(pblk) : NULL;
+        if (node == NULL) {
+            return -2;
+        }
+        offset = 8;
+    }
+}
+
+static int dir_find(struct ext4_file *dir, const char *name, size_t len, uint32_t *ino) {
+    if ((dir->flags & EXT4_INDEX_FL) && (vol.feature_compat & EXT4_COMPAT_DIR_INDEX)) {
+        int status = dx_find(dir, name, len, ino);
+        if (status != -2) {
+            return status;
+        }
+    }
+    return linear_find(dir, name, len, ino);
+}
+
+struct ext4_file *ext4_open(const char *path) {
+    if (!vol.mounted || path == NULL) {
+        return NULL;
+    }
+    struct ext4_file *f = malloc(sizeof(*f));
+    if (f == NULL || inode_load(EXT4_ROOT_INO, f) != 0) {
+        free(f);
+        return NULL;
+    }
+
+    while (*path != '\0') {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if (len == 0) {
+            break;
+        }
+        uint32_t ino;
+        if ((f->mode & EXT4_S_IFMT) != EXT4_S_IFDIR || len > 255 ||
+            dir_find(f, path, len, &ino) != 0 || inode_load(ino, f) != 0) {
+            free(f);
+            return NULL;
+        }
+        path += len;
+    }
+    return f;
+}
+
+void ext4_close(struct ext4_file *file) {
+    free(file);
+}
+
+int ext4_readdir(struct ext4_file *dir,
+                 int (*fn)(const char *name, size_t len, uint32_t ino, uint8_t type, void *arg), void *arg) {
+    if (dir == NULL || (dir->mode & EXT4_S_IFMT) != EXT4_S_IFDIR) {
+        return -1;
+    }
+
+    // Index blocks look like empty entries, so a linear pass sees every name
+    uint32_t blocks = (uint32_t)((dir->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (uint32_t lblk = 0; lblk < blocks; lblk++) {
+        uint64_t pblk = dir_block(dir, lblk);
+        if (pblk == 0) {
+            continue;
+        }
+        struct buffer_head *bh = bread((uint32_t)pblk);
+        if (bh == NULL) {
+            return -1;
+        }
+        uint32_t pos = 0;
+        while (pos + 8 <= BLOCK_SIZE) {
+            const struct ext4_dir_entry *de = (const struct ext4_dir_entry *)(bh->data + pos);
+            if (de->rec_len < 8 || pos + de->rec_len > BLOCK_SIZE || 8u + de->name_len > de->rec_len) {
+                break;
+            }
+            if (de->inode != 0) {
+                int status = fn(de->name, de->name_len, de->inode, de->file_type, arg);
+                if (status != 0) {
+                    brelse(bh);
+                    return status;
+                }
+            }
+            pos += de->rec_len;
+        }
+        brelse(bh);
+    }
+    return 0;
+}
+
+void ext4_get_stats(struct ext4_stats *out) {
+    *out = stats;
+}
+
+static int ext4_mount(const char *device) {
+    uint8_t block[BLOCK_SIZE];
+    const struct ext4_super *sb = (const struct ext4_super *)(block + EXT4_SUPER_OFFSET);
+    const char *name = device != NULL ? device : "device";
+
+    if (vol.mounted) {
+        printf("EXT4: a volume is already mounted\n");
+        return -1;
+    }
+    if (read_block(0, block) != 0) {
+        return -1;
+    }
+    if (sb->magic != EXT4_SUPER_MAGIC) {
+        printf("EXT4: %s does not hold an ext4 volume\n", name);
+        return -1;
+    }
+    if ((1024u << sb->log_block_size) != BLOCK_SIZE) {
+        printf("EXT4: %u-byte blocks are not supported\n", 1024u << sb->log_block_size);
+        return -1;
+    }
+    if (sb->feature_incompat & EXT4_INCOMPAT_RECOVER) {
+        printf("EXT4: %s needs journal recovery\n", name);
+        return -1;
+    }
+    if (sb->feature_incompat & ~EXT4_INCOMPAT_SUPPORTED) {
+        printf("EXT4: unsupported features 0x%X\n", sb->feature_incompat & ~EXT4_INCOMPAT_SUPPORTED);
+        return -1;
+    }
+    if (sb->blocks_per_group == 0 || sb->inodes_per_group == 0) {
+        return -1;
+    }
+
+    memset(&vol, 0, sizeof(vol));
+    vol.inodes_per_group = sb->inodes_per_group;
+    vol.inode_size = sb->rev_level == 0 ? 128 : sb->inode_size;
+    vol.feature_compat = sb->feature_compat;
+    vol.blocks_count = sb->blocks_count_lo;
+    if (sb->feature_incompat & EXT4_INCOMPAT_64BIT) {
+        vol.blocks_count |= (uint64_t)sb->blocks_count_hi << 32;
+    }
+    vol.group_count = (uint32_t)((vol.blocks_count - sb->first_data_block + sb->blocks_per_group - 1) /
+                                 sb->blocks_per_group);
+    vol.groups_per_flex = (sb->feature_incompat & EXT4_INCOMPAT_FLEX_BG) ? 1u << sb->log_groups_per_flex : 1;
+    memcpy(vol.hash_seed, sb->hash_seed, sizeof(vol.hash_seed));
+    vol.hash_unsigned = (sb->flags & EXT4_FLAGS_UNSIGNED_HASH) != 0;
+    if (vol.blocks_count > block_count()) {
+        printf("EXT4: volume is larger than the device\n");
+        return -1;
+    }
+    if (vol.inode_size < sizeof(struct ext4_inode) || vol.inode_size > BLOCK_SIZE) {
+        return -1;
+    }
+
+    // With flex_bg the inode tables of a flex group are packed together,
+    // anywhere on the disk: take every location from its descriptor
+    uint32_t desc_size = (sb->feature_incompat & EXT4_INCOMPAT_64BIT) && sb->desc_size >= 64 ? sb->desc_size : 32;
+    uint32_t per_block = BLOCK_SIZE / desc_size;
+    uint32_t gdt_block = sb->first_data_block + 1;
+    vol.inode_tables = malloc(vol.group_count * sizeof(uint64_t));
+    if (vol.inode_tables == NULL) {
+        return -1;
+    }
+    for (uint32_t g = 0; g < vol.group_count; g++) {
+        if (g % per_block == 0 && read_block(gdt_block + g / per_block, block) != 0) {
+            free(vol.inode_tables);
+            return -1;
+        }
+        const uint8_t *desc = block + (g % per_block) * desc_size;
+        uint32_t lo, hi = 0;
+        memcpy(&lo, desc + 0x08, 4);
+        if (desc_size >= 64) {
+            memcpy(&hi, desc + 0x28, 4);
+        }
+        vol.inode_tables[g] = lo | ((uint64_t)hi << 32);
+    }
+
+    memset(node_cache, 0, sizeof(node_cache));
+    vol.mounted = 1;
+    printf("EXT4: %u groups, %u per flex group, %llu blocks\n", vol.group_count, vol.groups_per_flex,
+           (unsigned long long)vol.blocks_count);
+    return 0;
+}
+
+static int ext4_unmount(void) {
+    if (!vol.mounted) {
+        return -1;
+    }
+    free(page_file);
+    page_file = NULL;
+    free(vol.inode_tables);
+    memset(&vol, 0, sizeof(vol));
+    memset(node_cache, 0, sizeof(node_cache));
+    return 0;
+}
+
+static int ext4_read_inode(inode_t *inode) {
+    struct ext4_file *f = malloc(sizeof(*f));
+    if (f == NULL || !vol.mounted || inode->ino > UINT32_MAX || inode_load((uint32_t)inode->ino, f) != 0) {
+        free(f);
+        return -1;
+    }
+    inode->is_directory = (f->mode & EXT4_S_IFMT) == EXT4_S_IFDIR;
+    free(f);
+    return 0;
+}
+
+// The volume is mounted read-only
+static int ext4_write_inode(inode_t *inode) {
+    (void)inode;
+    return -1;
+}
+
+static int ext4_sync(void) {
+    return vol.mounted ? 0 : -1;
+}
+
+static int ext4_readpage(void *ctx, uint64_t ino, uint64_t index, void *data) {
+    (void)ctx;
+    if (!vol.mounted || ino > UINT32_MAX) {
+        return -1;
+    }
+    if (page_file == NULL) {
+        page_file = malloc(sizeof(*page_file));
+        if (page_file == NULL) {
+            return -1;
+        }
+        page_file->ino = 0;
+    }
+    if (page_file->ino != ino && inode_load((uint32_t)ino, page_file) != 0) {
+        page_file->ino = 0;
+        return -1;
+    }
+
+    long n = ext4_read(page_file, index * PAGE_SIZE, data, PAGE_SIZE);
+    if (n < 0) {
+        return -1;
+    }
+    memset((uint8_t *)data + n, 0, PAGE_SIZE - (size_t)n);
+    return 0;
+}
+
+const struct page_cache_ops ext4_page_ops = {
+    .readpage = ext4_readpage,
+    .writepage = NULL,
+};
+
+fs_operations_t ext4_ops = {
+    .mount = ext4_mount,
+    .unmount = ext4_unmount,
+    .read_inode = ext4_read_inode,
+    .write_inode = ext4_write_inode,
+    .sync = ext4_sync,
+};
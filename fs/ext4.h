@@ -0,0 +1,102 @@
+#ifndef EXT4_H
+#define EXT4_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fs.h"
+#include "block_io.h"
+#include "page_cache.h"
+
+#define EXT4_SUPER_MAGIC 0xEF53
+#define EXT4_ROOT_INO 2
+#define EXT4_NODE_CACHE 32        // Extent tree and htree index blocks kept in memory
+#define EXT4_MAX_DEPTH 5          // Deepest extent tree accepted
+
+// Incompatible features the driver understands
+#define EXT4_INCOMPAT_FILETYPE  0x0002
+#define EXT4_INCOMPAT_RECOVER   0x0004
+#define EXT4_INCOMPAT_EXTENTS   0x0040
+#define EXT4_INCOMPAT_64BIT     0x0080
+#define EXT4_INCOMPAT_MMP       0x0100
+#define EXT4_INCOMPAT_FLEX_BG   0x0200
+#define EXT4_INCOMPAT_CSUM_SEED 0x2000
+#define EXT4_INCOMPAT_LARGEDIR  0x4000
+#define EXT4_COMPAT_DIR_INDEX   0x0020
+
+// Inode flags
+#define EXT4_INDEX_FL   0x00001000   // Directory has an htree index
+#define EXT4_EXTENTS_FL 0x00080000   // Blocks are mapped by an extent tree
+
+#define EXT4_S_IFMT  0xF000
+#define EXT4_S_IFDIR 0x4000
+#define EXT4_S_IFREG 0x8000
+
+// Extent tree node header, followed by index or leaf entries
+struct ext4_extent_header {
+    uint16_t magic;               // 0xF30A
+    uint16_t entries;
+    uint16_t max;
+    uint16_t depth;               // 0 for leaves
+    uint32_t generation;
+} __attribute__((packed));
+
+struct ext4_extent_idx {
+    uint32_t block;               // First logical block covered
+    uint32_t leaf_lo;             // Child node
+    uint16_t leaf_hi;
+    uint16_t unused;
+} __attribute__((packed));
+
+struct ext4_extent {
+    uint32_t block;               // First logical block
+    uint16_t len;                 // Above 32768: unwritten, reads as zeros
+    uint16_t start_hi;
+    uint32_t start_lo;
+} __attribute__((packed));
+
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_LEAF_MAX ((BLOCK_SIZE - sizeof(struct ext4_extent_header)) / sizeof(struct ext4_extent))
+
+// Open file or directory. The extent leaf used last is kept with the file,
+// so sequential reads map blocks without walking the tree again.
+struct ext4_file {
+    uint32_t ino;
+    uint16_t mode;
+    uint32_t flags;               // EXT4_*_FL
+    uint64_t size;
+    uint8_t root[60];             // i_block: root node of the extent tree
+    uint32_t leaf_first;          // Logical blocks [leaf_first, leaf_end) are
+    uint32_t leaf_end;            // mapped by the cached leaf
+    uint32_t leaf_count;
+    struct ext4_extent leaf[EXT4_LEAF_MAX];
+};
+
+struct ext4_stats {
+    uint64_t node_hits;           // Index blocks served from the node cache
+    uint64_t node_misses;         // Index blocks read from the device
+    uint64_t leaf_hits;           // Block mappings served by a file's cached leaf
+    uint64_t dx_lookups;          // Names found through an htree index
+    uint64_t linear_lookups;      // Names searched block by block
+    uint64_t data_reads;          // Vectored data read requests
+};
+
+// Read-only operations for vfs_mount(); the volume is read from the current backend
+extern fs_operations_t ext4_ops;
+
+// Paths are absolute within the volume
+struct ext4_file *ext4_open(const char *path);
+void ext4_close(struct ext4_file *file);
+
+// Return the number of bytes read (0 at the end of the file), or -1 on error
+long ext4_read(struct ext4_file *file, uint64_t offset, void *buffer, size_t len);
+
+// Call fn for each entry of a directory until it returns non-zero
+int ext4_readdir(struct ext4_file *dir,
+                 int (*fn)(const char *name, size_t len, uint32_t ino, uint8_t type, void *arg), void *arg);
+
+void ext4_get_stats(struct ext4_stats *stats);
+
+// Read-only page cache access to files by inode number (context unused)
+extern const struct page_cache_ops ext4_page_ops;
+
+#endif // EXT4_H
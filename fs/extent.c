@@ -0,0 +1,357 @@
+#include "inode.h"
+#include "bcache.h"
+#include <string.h>
+
+#define NODE_EXTENTS ((BLOCK_SIZE - sizeof(struct ion_extent_header)) / sizeof(struct ion_extent))
+#define NODE_INDEXES ((BLOCK_SIZE - sizeof(struct ion_extent_header)) / sizeof(struct ion_extent_index))
+
+// A tree node, either the inode root or a cached tree block
+struct extent_node {
+    struct ion_extent_header *hdr;
+    void *entries;
+    struct buffer_head *bh;   // NULL for the inode root
+};
+
+// Result of splitting a node: the new right sibling and its first key
+struct extent_split {
+    uint32_t logical;
+    uint32_t block;
+};
+
+static void node_root(struct ion_inode *inode, struct extent_node *node) {
+    node->hdr = &inode->root;
+    node->entries = inode->root_entries;
+    node->bh = NULL;
+}
+
+static int node_read(uint32_t block, struct extent_node *node) {
+    node->bh = bread(block);
+    if (node->bh == NULL) {
+        return -1;
+    }
+    node->hdr = (struct ion_extent_header *)node->bh->data;
+    node->entries = node->bh->data + sizeof(struct ion_extent_header);
+    if (node->hdr->magic != ION_EXTENT_MAGIC) {
+        brelse(node->bh);
+        return -1;
+    }
+    return 0;
+}
+
+static int node_new(struct ion_fs *fs, struct ion_inode *inode, uint16_t depth,
+                    uint32_t *block, struct extent_node *node) {
+    if (ion_alloc_block(fs, block) != 0) {
+        return -1;
+    }
+    node->bh = bgetblk(*block);
+    if (node->bh == NULL) {
+        ion_free_blocks(fs, *block, 1);
+        return -1;
+    }
+    memset(node->bh->data, 0, BLOCK_SIZE);
+    node->hdr = (struct ion_extent_header *)node->bh->data;
+    node->entries = node->bh->data + sizeof(struct ion_extent_header);
+    node->hdr->magic = ION_EXTENT_MAGIC;
+    node->hdr->entries = 0;
+    node->hdr->depth = depth;
+    node->hdr->max = depth == 0 ? NODE_EXTENTS : NODE_INDEXES;
+    inode->blocks++;
+    return 0;
+}
+
+static void node_dirty(struct extent_node *node) {
+    if (node->bh != NULL) {
+        bwrite(node->bh);
+    }
+}
+
+static void node_put(struct extent_node *node) {
+    if (node->bh != NULL) {
+        brelse(node->bh);
+    }
+}
+
+static inline size_t entry_size(const struct ion_extent_header *hdr) {
+    return hdr->depth == 0 ? sizeof(struct ion_extent) : sizeof(struct ion_extent_index);
+}
+
+// First key of the entry at i (extents and index entries both start with it)
+static inline uint32_t entry_key(const struct extent_node *node, int i) {
+    return *(const uint32_t *)((const uint8_t *)node->entries + i * entry_size(node->hdr));
+}
+
+// Index of the last entry whose key is <= logical, or -1
+static int node_search(const struct extent_node *node, uint32_t logical) {
+    int lo = 0;
+    int hi = node->hdr->entries - 1;
+    int found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (entry_key(node, mid) <= logical) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Insert a raw entry at pos, shifting the tail up (node must have room)
+static void node_put_entry(struct extent_node *node, int pos, const void *entry) {
+    size_t size = entry_size(node->hdr);
+    uint8_t *base = node->entries;
+    memmove(base + (pos + 1) * size, base + pos * size, (node->hdr->entries - pos) * size);
+    memcpy(base + pos * size, entry, size);
+    node->hdr->entries++;
+}
+
+// Move the upper half of a full node into a new sibling, then insert entry at pos
+static int node_split_insert(struct ion_fs *fs, struct ion_inode *inode, struct extent_node *node,
+                             int pos, const void *entry, struct extent_split *split) {
+    struct extent_node right;
+    uint32_t block;
+    if (node_new(fs, inode, node->hdr->depth, &block, &right) != 0) {
+        return -1;
+    }
+
+    size_t size = entry_size(node->hdr);
+    int keep = node->hdr->entries / 2;
+    int moved = node->hdr->entries - keep;
+    memcpy(right.entries, (uint8_t *)node->entries + keep * size, moved * size);
+    right.hdr->entries = moved;
+    node->hdr->entries = keep;
+
+    if (pos <= keep) {
+        node_put_entry(node, pos, entry);
+    } else {
+        node_put_entry(&right, pos - keep, entry);
+    }
+
+    split->logical = entry_key(&right, 0);
+    split->block = block;
+    node_dirty(&right);
+    node_put(&right);
+    return 1;
+}
+
+static inline int extents_adjacent(const struct ion_extent *a, const struct ion_extent *b) {
+    return a->logical + a->length == b->logical && a->physical + a->length == b->physical;
+}
+
+// Returns 0 when inserted in place, 1 when the node split, -1 on error
+static int leaf_insert(struct ion_fs *fs, struct ion_inode *inode, struct extent_node *node,
+                       const struct ion_extent *ext, struct extent_split *split) {
+    struct ion_extent *e = node->entries;
+    int n = node->hdr->entries;
+    int pos = node_search(node, ext->logical) + 1;
+
+    // Grow a neighbour instead of adding an entry when the blocks line up
+    if (pos > 0 && extents_adjacent(&e[pos - 1], ext)) {
+        e[pos - 1].length += ext->length;
+        if (pos < n && extents_adjacent(&e[pos - 1], &e[pos])) {
+            e[pos - 1].length += e[pos].length;
+            memmove(&e[pos], &e[pos + 1], (n - pos - 1) * sizeof(*e));
+            node->hdr->entries--;
+        }
+        return 0;
+    }
+    if (pos < n && extents_adjacent(ext, &e[pos])) {
+        e[pos].logical = ext->logical;
+        e[pos].physical = ext->physical;
+        e[pos].length += ext->length;
+        return 0;
+    }
+
+    if (n < node->hdr->max) {
+        node_put_entry(node, pos, ext);
+        return 0;
+    }
+    return node_split_insert(fs, inode, node, pos, ext, split);
+}
+
+static int node_insert(struct ion_fs *fs, struct ion_inode *inode, struct extent_node *node,
+                       const struct ion_extent *ext, struct extent_split *split) {
+    if (node->hdr->depth == 0) {
+        return leaf_insert(fs, inode, node, ext, split);
+    }
+
+    struct ion_extent_index *idx = node->entries;
+    int i = node_search(node, ext->logical);
+    if (i < 0) {
+        // New lowest key: the first child now starts here
+        i = 0;
+        idx[0].logical = ext->logical;
+    }
+
+    struct extent_node child;
+    struct extent_split child_split;
+    if (node_read(idx[i].child, &child) != 0) {
+        return -1;
+    }
+    int status = node_insert(fs, inode, &child, ext, &child_split);
+    if (status >= 0) {
+        node_dirty(&child);
+    }
+    node_put(&child);
+    if (status <= 0) {
+        return status;
+    }
+
+    struct ion_extent_index entry = { child_split.logical, child_split.block };
+    if (node->hdr->entries < node->hdr->max) {
+        node_put_entry(node, i + 1, &entry);
+        return 0;
+    }
+    return node_split_insert(fs, inode, node, i + 1, &entry, split);
+}
+
+int ion_extent_insert(struct ion_fs *fs, struct ion_inode *inode, const struct ion_extent *ext) {
+    struct extent_node root;
+    struct extent_split split;
+
+    if (ext->length == 0) {
+        return 0;
+    }
+    if (inode->flags & ION_INODE_INLINE) {
+        return -1; // No tree until the inline data is moved out
+    }
+
+    node_root(inode, &root);
+    int status = node_insert(fs, inode, &root, ext, &split);
+    if (status <= 0) {
+        return status;
+    }
+
+    // The root split: move what it kept into a new block and grow the tree
+    struct extent_node left;
+    uint32_t block;
+    if (node_new(fs, inode, root.hdr->depth, &block, &left) != 0) {
+        return -1;
+    }
+    memcpy(left.entries, root.entries, root.hdr->entries * entry_size(root.hdr));
+    left.hdr->entries = root.hdr->entries;
+
+    struct ion_extent_index *idx = root.entries;
+    idx[0].logical = entry_key(&left, 0);
+    idx[0].child = block;
+    idx[1].logical = split.logical;
+    idx[1].child = split.block;
+    root.hdr->depth++;
+    root.hdr->entries = 2;
+    root.hdr->max = ION_ROOT_INDEXES;
+
+    node_dirty(&left);
+    node_put(&left);
+    return 0;
+}
+
+int ion_extent_map(struct ion_fs *fs, struct ion_inode *inode, uint32_t logical,
+                   uint32_t *physical, uint32_t *len) {
+    struct extent_node node;
+    uint32_t limit = UINT32_MAX; // Start of the next subtree to the right
+    (void)fs;
+
+    if (inode->flags & ION_INODE_INLINE) {
+        return -1;
+    }
+
+    node_root(inode, &node);
+    while (node.hdr->depth > 0) {
+        struct ion_extent_index *idx = node.entries;
+        int i = node_search(&node, logical);
+        if (i < 0) {
+            // Before the first extent: a hole up to it
+            uint32_t next = node.hdr->entries > 0 ? idx[0].logical : UINT32_MAX;
+            node_put(&node);
+            *physical = 0;
+            *len = (next < limit ? next : limit) - logical;
+            return 0;
+        }
+        if (i + 1 < node.hdr->entries) {
+            limit = idx[i + 1].logical;
+        }
+        uint32_t child = idx[i].child;
+        node_put(&node);
+        if (node_read(child, &node) != 0) {
+            return -1;
+        }
+    }
+
+    struct ion_extent *e = node.entries;
+    int i = node_search(&node, logical);
+    if (i >= 0 && logical < e[i].logical + e[i].length) {
+        *physical = e[i].physical + (logical - e[i].logical);
+        *len = e[i].logical + e[i].length - logical;
+    } else {
+        uint32_t next = i + 1 < node.hdr->entries ? e[i + 1].logical : limit;
+        *physical = 0;
+        *len = next - logical;
+    }
+    node_put(&node);
+    return 0;
+}
+
+// Free a run under a handle of its own, sized for the bitmap blocks it
+// clears, so a large or fragmented tree spreads over as many transactions
+// as it needs
+static int run_free(struct ion_fs *fs, struct ion_inode *inode, uint32_t start, uint32_t count) {
+    if (ion_begin(fs, ION_CREDITS_FREE(count)) != 0) {
+        return -1;
+    }
+    ion_free_blocks(fs, start, count);
+    inode->blocks -= count;
+    ion_end(fs);
+    return 0;
+}
+
+static int node_free(struct ion_fs *fs, struct ion_inode *inode, struct extent_node *node) {
+    int status = 0;
+    if (node->hdr->depth == 0) {
+        struct ion_extent *e = node->entries;
+        for (int i = 0; i < node->hdr->entries; i++) {
+            if (run_free(fs, inode, e[i].physical, e[i].length) != 0) {
+                status = -1;
+            }
+        }
+        return status;
+    }
+
+    struct ion_extent_index *idx = node->entries;
+    for (int i = 0; i < node->hdr->entries; i++) {
+        struct extent_node child;
+        if (node_read(idx[i].child, &child) != 0) {
+            status = -1;
+            continue;
+        }
+        if (node_free(fs, inode, &child) != 0) {
+            status = -1;
+        }
+        node_put(&child);
+        if (run_free(fs, inode, idx[i].child, 1) != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int ion_extent_free_all(struct ion_fs *fs, struct ion_inode *inode) {
+    struct extent_node root;
+    int status = 0;
+
+    if (inode->flags & ION_INODE_INLINE) {
+        // Nothing allocated: drop the data and bring back an empty root
+        memset(inode->inline_data, 0, sizeof(inode->inline_data));
+        inode->flags &= ~ION_INODE_INLINE;
+        inode->root.magic = ION_EXTENT_MAGIC;
+        node_root(inode, &root);
+    } else {
+        node_root(inode, &root);
+        status = node_free(fs, inode, &root);
+    }
+
+    root.hdr->entries = 0;
+    root.hdr->depth = 0;
+    root.hdr->max = ION_ROOT_EXTENTS;
+    return status;
+}
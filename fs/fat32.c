@@ -0,0 +1,1018 @@
+#include "fat32.h"
+#include "bcache.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIRENTS_PER_BLOCK (BLOCK_SIZE / sizeof(struct fat32_dirent))
+#define FSINFO_LEAD 0x41615252
+#define FSINFO_STRUCT 0x61417272
+#define FSINFO_TRAIL 0xAA550000
+#define FSINFO_UNKNOWN 0xFFFFFFFF
+
+// Geometry of the mounted volume, in device blocks
+struct fat32_volume {
+    int mounted;
+    uint32_t blocks_per_cluster;
+    uint32_t fat_block;          // First block of the first FAT
+    uint32_t fat_blocks;         // Blocks per FAT copy
+    uint32_t num_fats;
+    uint32_t data_block;         // Block of cluster 2
+    uint32_t cluster_count;      // Clusters 2 .. cluster_count + 1 hold data
+    uint32_t root_cluster;
+    uint32_t fsinfo_block;       // 0 offset 0 means no FSInfo
+    uint32_t fsinfo_offset;
+    uint32_t free_count;
+    uint32_t next_free;          // Allocation hint
+};
+
+// One cached FAT block, written to every FAT copy when flushed
+struct fat_slot {
+    uint32_t block;              // Relative to the start of a FAT
+    uint32_t last_use;
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t data[BLOCK_SIZE];
+};
+
+static struct fat32_volume vol;
+static struct fat_slot fat_cache[FAT32_FAT_CACHE];
+static uint32_t fat_clock = 0;
+static struct fat32_stats stats;
+static struct fat32_file *page_file = NULL;  // File of the last page I/O, with its runs
+
+static inline uint32_t cluster_block(uint32_t cluster) {
+    return vol.data_block + (cluster - 2) * vol.blocks_per_cluster;
+}
+
+static inline int cluster_valid(uint32_t cluster) {
+    return cluster >= 2 && cluster < vol.cluster_count + 2;
+}
+
+static inline uint32_t dirent_cluster(const struct fat32_dirent *ent) {
+    return ((uint32_t)ent->cluster_hi << 16) | ent->cluster_lo;
+}
+
+static inline void dirent_set_cluster(struct fat32_dirent *ent, uint32_t cluster) {
+    ent->cluster_hi = (uint16_t)(cluster >> 16);
+    ent->cluster_lo = (uint16_t)cluster;
+}
+
+static int fat_slot_flush(struct fat_slot *slot) {
+    if (!slot->dirty) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < vol.num_fats; i++) {
+        if (write_block(vol.fat_block + i * vol.fat_blocks + slot->block, slot->data) != 0) {
+            return -1;
+        }
+    }
+    slot->dirty = 0;
+    return 0;
+}
+
+static int fat_flush(void) {
+    int status = 0;
+    for (int i = 0; i < FAT32_FAT_CACHE; i++) {
+        if (fat_cache[i].valid && fat_slot_flush(&fat_cache[i]) != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+// FAT block holding the entry of a cluster, loaded into the least recently used slot on a miss
+static struct fat_slot *fat_slot_get(uint32_t cluster) {
+    uint32_t block = cluster / (BLOCK_SIZE / 4);
+    struct fat_slot *victim = &fat_cache[0];
+
+    for (int i = 0; i < FAT32_FAT_CACHE; i++) {
+        struct fat_slot *slot = &fat_cache[i];
+        if (slot->valid && slot->block == block) {
+            stats.fat_hits++;
+            slot->last_use = ++fat_clock;
+            return slot;
+        }
+        if (!slot->valid || (victim->valid && slot->last_use < victim->last_use)) {
+            victim = slot;
+        }
+    }
+
+    stats.fat_misses++;
+    if (victim->valid && fat_slot_flush(victim) != 0) {
+        return NULL;
+    }
+    victim->valid = 0;
+    if (read_block(vol.fat_block + block, victim->data) != 0) {
+        return NULL;
+    }
+    victim->block = block;
+    victim->valid = 1;
+    victim->last_use = ++fat_clock;
+    return victim;
+}
+
+static int fat_get(uint32_t cluster, uint32_t *value) {
+    struct fat_slot *slot = fat_slot_get(cluster);
+    if (slot == NULL) {
+        return -1;
+    }
+    uint32_t raw;
+    memcpy(&raw, slot->data + (cluster % (BLOCK_SIZE / 4)) * 4, 4);
+    *value = raw & FAT32_MASK;
+    return 0;
+}
+
+static int fat_set(uint32_t cluster, uint32_t value) {
+    struct fat_slot *slot = fat_slot_get(cluster);
+    if (slot == NULL) {
+        return -1;
+    }
+    uint8_t *entry = slot->data + (cluster % (BLOCK_SIZE / 4)) * 4;
+    uint32_t raw;
+    memcpy(&raw, entry, 4);
+    raw = (raw & ~FAT32_MASK) | (value & FAT32_MASK);
+    memcpy(entry, &raw, 4);
+    slot->dirty = 1;
+    return 0;
+}
+
+// Allocate a free cluster, starting at the hint, and append it to prev's
+// chain (prev == 0 starts a new chain); returns 0 when the volume is full
+static uint32_t cluster_alloc(uint32_t prev) {
+    uint32_t cluster = cluster_valid(vol.next_free) ? vol.next_free : 2;
+
+    for (uint32_t scanned = 0; scanned < vol.cluster_count; scanned++) {
+        uint32_t value;
+        if (fat_get(cluster, &value) != 0) {
+            return 0;
+        }
+        if (value == 0) {
+            if (fat_set(cluster, FAT32_MASK) != 0 || (prev != 0 && fat_set(prev, cluster) != 0)) {
+                return 0;
+            }
+            vol.next_free = cluster + 1 < vol.cluster_count + 2 ? cluster + 1 : 2;
+            if (vol.free_count != FSINFO_UNKNOWN) {
+                vol.free_count--;
+            }
+            return cluster;
+        }
+        cluster = cluster + 1 < vol.cluster_count + 2 ? cluster + 1 : 2;
+    }
+    printf("FAT32: volume is full\n");
+    return 0;
+}
+
+// Return a cluster allocated by cluster_alloc(prev == 0) to the free pool,
+// dropping whatever the buffer cache still holds for it
+static void cluster_free(uint32_t cluster) {
+    if (fat_set(cluster, 0) != 0) {
+        return;
+    }
+    bcache_drop(cluster_block(cluster), vol.blocks_per_cluster);
+    if (vol.free_count != FSINFO_UNKNOWN) {
+        vol.free_count++;
+    }
+}
+
+static int cluster_zero(uint32_t cluster) {
+    for (uint32_t b = 0; b < vol.blocks_per_cluster; b++) {
+        struct buffer_head *bh = bgetblk(cluster_block(cluster) + b);
+        if (bh == NULL) {
+            return -1;
+        }
+        memset(bh->data, 0, BLOCK_SIZE);
+        bwrite(bh);
+        brelse(bh);
+    }
+    return 0;
+}
+
+// Map file cluster index to a device cluster. *len is the number of file
+// clusters from index on known to be contiguous (extended up to want).
+// Past the end of the chain -1 is returned and *cluster is the last
+// cluster of the chain (0 for an empty file).
+static int file_map(struct fat32_file *f, uint32_t index, uint32_t want, uint32_t *cluster, uint32_t *len) {
+    *cluster = 0;
+    if (f->first_cluster == 0) {
+        return -1;
+    }
+    if (f->nruns == 0) {
+        f->runs[0] = (struct fat32_run){ 0, f->first_cluster, 1 };
+        f->nruns = 1;
+    }
+
+    for (uint32_t i = 0; i + 1 < f->nruns; i++) {
+        struct fat32_run *run = &f->runs[i];
+        if (index >= run->index && index < run->index + run->len) {
+            stats.run_hits++;
+            *cluster = run->cluster + (index - run->index);
+            *len = run->index + run->len - index;
+            return 0;
+        }
+    }
+
+    // The last run may still grow: follow the chain from its end until
+    // index is covered and the contiguous stretch reaches want clusters
+    struct fat32_run *tail = &f->runs[f->nruns - 1];
+    struct fat32_run cur = *tail;
+    int in_table = 1;
+    int status = 0;
+    if (index >= cur.index && index < cur.index + cur.len) {
+        stats.run_hits++;
+    }
+    while (index >= cur.index + cur.len || (index >= cur.index && cur.index + cur.len - index < want)) {
+        uint32_t last = cur.cluster + cur.len - 1;
+        uint32_t next;
+        if (fat_get(last, &next) != 0) {
+            status = -1;
+            break;
+        }
+        stats.chain_steps++;
+        if (!cluster_valid(next)) {
+            if (index >= cur.index + cur.len) {
+                *cluster = last; // End of chain before index
+                status = -1;
+            }
+            break;
+        }
+        if (next == last + 1) {
+            cur.len++;
+            continue;
+        }
+
+        if (index < cur.index + cur.len) {
+            break; // Covered; the contiguous stretch just ends early
+        }
+
+        // Chain jumps: start a new run, remembered while there is room
+        if (in_table) {
+            *tail = cur;
+        }
+        if (f->nruns < FAT32_RUNS_MAX) {
+            tail = &f->runs[f->nruns++];
+            in_table = 1;
+        } else {
+            in_table = 0;
+        }
+        cur = (struct fat32_run){ cur.index + cur.len, next, 1 };
+    }
+    if (in_table) {
+        *tail = cur;
+    }
+    if (status != 0) {
+        return -1;
+    }
+    *cluster = cur.cluster + (index - cur.index);
+    *len = cur.index + cur.len - index;
+    return 0;
+}
+
+// Move len bytes at byte in_block of block: partial blocks go through a
+// bounce buffer, the whole blocks between them in one vectored request
+static int data_io(uint32_t block, size_t in_block, uint8_t *buf, size_t len, int to_disk) {
+    uint8_t bounce[BLOCK_SIZE];
+
+    while (len > 0) {
+        if (in_block != 0 || len < BLOCK_SIZE) {
+            size_t chunk = BLOCK_SIZE - in_block < len ? BLOCK_SIZE - in_block : len;
+            if (read_block(block, bounce) != 0) {
+                return -1;
+            }
+            if (to_disk) {
+                memcpy(bounce + in_block, buf, chunk);
+                if (write_block(block, bounce) != 0) {
+                    return -1;
+                }
+                bcache_forget(block, 1);
+            } else {
+                memcpy(buf, bounce + in_block, chunk);
+            }
+            block++;
+            in_block = 0;
+            buf += chunk;
+            len -= chunk;
+            continue;
+        }
+
+        uint32_t count = (uint32_t)(len / BLOCK_SIZE);
+        struct block_iovec iov = { buf, (size_t)count * BLOCK_SIZE };
+        if (to_disk) {
+            stats.data_writes++;
+            if (write_blocks(block, count, &iov, 1) != 0) {
+                return -1;
+            }
+            bcache_forget(block, count);
+        } else {
+            stats.data_reads++;
+            if (read_blocks(block, count, &iov, 1) != 0) {
+                return -1;
+            }
+        }
+        block += count;
+        buf += iov.len;
+        len -= iov.len;
+    }
+    return 0;
+}
+
+// Copy len bytes between the file and memory; the chain must cover the range
+static long file_io(struct fat32_file *f, uint32_t offset, uint8_t *buf, size_t len, int to_disk) {
+    uint32_t csize = vol.blocks_per_cluster * BLOCK_SIZE;
+    uint32_t last_index = (uint32_t)((offset + len - 1) / csize);
+    size_t done = 0;
+
+    while (done < len) {
+        uint64_t pos = (uint64_t)offset + done;
+        uint32_t index = (uint32_t)(pos / csize);
+        uint32_t in_cluster = (uint32_t)(pos % csize);
+        uint32_t cluster, run;
+        if (file_map(f, index, last_index - index + 1, &cluster, &run) != 0) {
+            return -1;
+        }
+
+        size_t chunk = (size_t)run * csize - in_cluster;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (data_io(cluster_block(cluster) + in_cluster / BLOCK_SIZE, in_cluster % BLOCK_SIZE,
+                    buf + done, chunk, to_disk) != 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+    return (long)done;
+}
+
+// Load or store a directory entry by inode number
+static int dirent_io(unsigned long ino, struct fat32_dirent *ent, int store) {
+    struct buffer_head *bh = bread((uint32_t)(ino / DIRENTS_PER_BLOCK));
+    if (bh == NULL) {
+        return -1;
+    }
+    struct fat32_dirent *slot = (struct fat32_dirent *)bh->data + ino % DIRENTS_PER_BLOCK;
+    if (store) {
+        *slot = *ent;
+        bwrite(bh);
+    } else {
+        *ent = *slot;
+    }
+    brelse(bh);
+    return 0;
+}
+
+// Convert a path component to a space-padded, upper-case 8.3 name
+static int name_83(const char *name, size_t len, char out[11]) {
+    memset(out, ' ', 11);
+    if (len == 1 && name[0] == '.') {
+        out[0] = '.';
+        return 0;
+    }
+    if (len == 2 && name[0] == '.' && name[1] == '.') {
+        out[0] = out[1] = '.';
+        return 0;
+    }
+
+    size_t base = len;
+    for (size_t i = len; i > 1; i--) {
+        if (name[i - 1] == '.') {
+            base = i - 1;
+            break;
+        }
+    }
+    size_t ext = base < len ? len - base - 1 : 0;
+    if (base == 0 || base > 8 || ext > 3) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (i == base) {
+            continue;
+        }
+        if (c < 0x20 || strchr("\"*+,./:;<=>?[\\]| ", c) != NULL) {
+            return -1;
+        }
+        if (i < base) {
+            out[i] = (char)toupper(c);
+        } else {
+            out[8 + (i - base - 1)] = (char)toupper(c);
+        }
+    }
+    return 0;
+}
+
+// Search a directory for a short name; the entry and its inode number are returned
+static int dir_find(uint32_t dir, const char name[11], struct fat32_dirent *out, unsigned long *ino) {
+    uint32_t cluster = dir;
+
+    while (cluster_valid(cluster)) {
+        for (uint32_t b = 0; b < vol.blocks_per_cluster; b++) {
+            uint32_t block = cluster_block(cluster) + b;
+            struct buffer_head *bh = bread(block);
+            if (bh == NULL) {
+                return -1;
+            }
+            const struct fat32_dirent *ents = (const struct fat32_dirent *)bh->data;
+            for (uint32_t e = 0; e < DIRENTS_PER_BLOCK; e++) {
+                if (ents[e].name[0] == 0) {
+                    brelse(bh);
+                    return -1; // End of directory
+                }
+                if ((uint8_t)ents[e].name[0] == 0xE5 || ents[e].attr == FAT32_ATTR_LFN ||
+                    (ents[e].attr & FAT32_ATTR_VOLUME_ID)) {
+                    continue;
+                }
+                if (memcmp(ents[e].name, name, 11) == 0) {
+                    *out = ents[e];
+                    *ino = (unsigned long)block * DIRENTS_PER_BLOCK + e;
+                    brelse(bh);
+                    return 0;
+                }
+            }
+            brelse(bh);
+        }
+        if (fat_get(cluster, &cluster) != 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Store an entry in the first free slot, growing the directory if it is full
+static int dir_add(uint32_t dir, const struct fat32_dirent *ent, unsigned long *ino) {
+    uint32_t cluster = dir;
+    uint32_t last = dir;
+
+    while (cluster_valid(cluster)) {
+        for (uint32_t b = 0; b < vol.blocks_per_cluster; b++) {
+            uint32_t block = cluster_block(cluster) + b;
+            struct buffer_head *bh = bread(block);
+            if (bh == NULL) {
+                return -1;
+            }
+            struct fat32_dirent *ents = (struct fat32_dirent *)bh->data;
+            for (uint32_t e = 0; e < DIRENTS_PER_BLOCK; e++) {
+                if (ents[e].name[0] == 0 || (uint8_t)ents[e].name[0] == 0xE5) {
+                    ents[e] = *ent;
+                    bwrite(bh);
+                    brelse(bh);
+                    *ino = (unsigned long)block * DIRENTS_PER_BLOCK + e;
+                    return 0;
+                }
+            }
+            brelse(bh);
+        }
+        last = cluster;
+        if (fat_get(cluster, &cluster) != 0) {
+            return -1;
+        }
+    }
+
+    cluster = cluster_alloc(last);
+    if (cluster == 0 || cluster_zero(cluster) != 0) {
+        return -1;
+    }
+    *ino = (unsigned long)cluster_block(cluster) * DIRENTS_PER_BLOCK;
+    return dirent_io(*ino, (struct fat32_dirent *)ent, 1);
+}
+
+static void root_dirent(struct fat32_dirent *ent) {
+    memset(ent, 0, sizeof(*ent));
+    ent->attr = FAT32_ATTR_DIRECTORY;
+    dirent_set_cluster(ent, vol.root_cluster);
+}
+
+// Resolve a path to its directory entry. With last != NULL the final
+// component is not looked up: *ent is its parent directory instead.
+static int walk(const char *path, struct fat32_dirent *ent, unsigned long *ino, const char **last, size_t *last_len) {
+    if (!vol.mounted || path == NULL) {
+        return -1;
+    }
+    root_dirent(ent);
+    *ino = FAT32_ROOT_INO;
+
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if (len == 0) {
+            return last != NULL ? -1 : 0;
+        }
+        const char *rest = path + len;
+        while (*rest == '/') {
+            rest++;
+        }
+        if (last != NULL && *rest == '\0') {
+            *last = path;
+            *last_len = len;
+            return (ent->attr & FAT32_ATTR_DIRECTORY) ? 0 : -1;
+        }
+
+        char name[11];
+        if (!(ent->attr & FAT32_ATTR_DIRECTORY) || name_83(path, len, name) != 0) {
+            return -1;
+        }
+        uint32_t dir = dirent_cluster(ent);
+        if (dir == 0) {
+            dir = vol.root_cluster;
+        }
+        if (dir == vol.root_cluster && name[0] == '.') {
+            // The root has no "." and ".." entries
+            root_dirent(ent);
+            *ino = FAT32_ROOT_INO;
+        } else if (dir_find(dir, name, ent, ino) != 0) {
+            return -1;
+        } else if (ent->name[0] == '.' && dirent_cluster(ent) == 0) {
+            root_dirent(ent); // ".." of a top-level directory
+            *ino = FAT32_ROOT_INO;
+        }
+        path = rest;
+    }
+}
+
+static struct fat32_file *file_new(const struct fat32_dirent *ent, unsigned long ino) {
+    struct fat32_file *f = calloc(1, sizeof(*f));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->ino = ino;
+    f->first_cluster = dirent_cluster(ent);
+    f->size = ent->size;
+    f->is_directory = (ent->attr & FAT32_ATTR_DIRECTORY) != 0;
+    return f;
+}
+
+// Create an entry in the parent directory of path
+static int entry_create(const char *path, uint8_t attr, uint32_t cluster, struct fat32_dirent *ent, unsigned long *ino,
+                        uint32_t *parent) {
+    struct fat32_dirent dir;
+    const char *name;
+    size_t len;
+    char name83[11];
+
+    if (walk(path, &dir, ino, &name, &len) != 0 || name_83(name, len, name83) != 0 || name83[0] == '.') {
+        return -1;
+    }
+    *parent = dirent_cluster(&dir);
+    if (dir_find(*parent, name83, ent, ino) == 0) {
+        return -1; // Already exists
+    }
+
+    memset(ent, 0, sizeof(*ent));
+    memcpy(ent->name, name83, 11);
+    ent->attr = attr;
+    dirent_set_cluster(ent, cluster);
+    return dir_add(*parent, ent, ino);
+}
+
+struct fat32_file *fat32_open(const char *path) {
+    struct fat32_dirent ent;
+    unsigned long ino;
+    if (walk(path, &ent, &ino, NULL, NULL) != 0) {
+        return NULL;
+    }
+    return file_new(&ent, ino);
+}
+
+struct fat32_file *fat32_create(const char *path) {
+    struct fat32_dirent ent;
+    unsigned long ino;
+    uint32_t parent;
+    if (entry_create(path, FAT32_ATTR_ARCHIVE, 0, &ent, &ino, &parent) != 0) {
+        return NULL;
+    }
+    return file_new(&ent, ino);
+}
+
+int fat32_mkdir(const char *path) {
+    struct fat32_dirent ent;
+    unsigned long ino;
+    uint32_t parent;
+
+    // Refuse an existing name before a cluster is spent on it
+    if (walk(path, &ent, &ino, NULL, NULL) == 0) {
+        return -1;
+    }
+    uint32_t cluster = cluster_alloc(0);
+    if (cluster == 0) {
+        return -1;
+    }
+    if (cluster_zero(cluster) != 0 ||
+        entry_create(path, FAT32_ATTR_DIRECTORY, cluster, &ent, &ino, &parent) != 0) {
+        cluster_free(cluster);
+        return -1;
+    }
+
+    // "." and ".." (cluster 0 stands for the root)
+    struct fat32_dirent dots[2];
+    memset(dots, 0, sizeof(dots));
+    memset(dots[0].name, ' ', 11);
+    memset(dots[1].name, ' ', 11);
+    dots[0].name[0] = '.';
+    dots[1].name[0] = dots[1].name[1] = '.';
+    dots[0].attr = dots[1].attr = FAT32_ATTR_DIRECTORY;
+    dirent_set_cluster(&dots[0], cluster);
+    dirent_set_cluster(&dots[1], parent == vol.root_cluster ? 0 : parent);
+
+    unsigned long first = (unsigned long)cluster_block(cluster) * DIRENTS_PER_BLOCK;
+    if (dirent_io(first, &dots[0], 1) != 0 || dirent_io(first + 1, &dots[1], 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void fat32_close(struct fat32_file *file) {
+    free(file);
+}
+
+// Pick up the size and first cluster another handle may have stored in the
+// directory entry. Chains only grow, so the run cache stays valid while the
+// first cluster is unchanged.
+static int file_refresh(struct fat32_file *f) {
+    struct fat32_dirent ent;
+    if (f->ino == FAT32_ROOT_INO) {
+        return 0;
+    }
+    if (dirent_io(f->ino, &ent, 0) != 0) {
+        return -1;
+    }
+    if (dirent_cluster(&ent) != f->first_cluster) {
+        f->first_cluster = dirent_cluster(&ent);
+        f->nruns = 0;
+    }
+    f->size = ent.size;
+    return 0;
+}
+
+long fat32_read(struct fat32_file *file, uint32_t offset, void *buffer, size_t len) {
+    if (file == NULL || file->is_directory || file_refresh(file) != 0) {
+        return -1;
+    }
+    if (offset >= file->size || len == 0) {
+        return 0;
+    }
+    if (len > file->size - offset) {
+        len = file->size - offset;
+    }
+    return file_io(file, offset, buffer, len, 0);
+}
+
+// Grow the chain so it covers byte end - 1
+static int file_reserve(struct fat32_file *f, uint64_t end) {
+    uint32_t csize = vol.blocks_per_cluster * BLOCK_SIZE;
+    uint32_t index = (uint32_t)((end - 1) / csize);
+    uint32_t cluster, len;
+
+    while (file_map(f, index, 1, &cluster, &len) != 0) {
+        uint32_t next = cluster_alloc(cluster);
+        if (next == 0) {
+            return -1;
+        }
+        if (f->first_cluster == 0) {
+            f->first_cluster = next;
+            f->nruns = 0;
+        }
+    }
+    return 0;
+}
+
+static long file_write(struct fat32_file *file, uint32_t offset, const void *buffer, size_t len) {
+    static const uint8_t zeros[BLOCK_SIZE];
+
+    if (len == 0) {
+        return 0;
+    }
+    if (file_refresh(file) != 0 || file_reserve(file, (uint64_t)offset + len) != 0) {
+        return -1;
+    }
+
+    // FAT has no holes: a gap past the old end is written out as zeros
+    for (uint32_t pos = file->size; pos < offset;) {
+        size_t chunk = offset - pos < BLOCK_SIZE ? offset - pos : BLOCK_SIZE;
+        if (file_io(file, pos, (uint8_t *)zeros, chunk, 1) < 0) {
+            return -1;
+        }
+        pos += (uint32_t)chunk;
+    }
+
+    long done = file_io(file, offset, (uint8_t *)buffer, len, 1);
+    if (done < 0) {
+        return -1;
+    }
+
+    // Record the size and first cluster in the directory entry
+    struct fat32_dirent ent;
+    if (offset + len > file->size) {
+        file->size = (uint32_t)(offset + len);
+    }
+    if (dirent_io(file->ino, &ent, 0) != 0) {
+        return -1;
+    }
+    ent.size = file->size;
+    dirent_set_cluster(&ent, file->first_cluster);
+    if (dirent_io(file->ino, &ent, 1) != 0) {
+        return -1;
+    }
+    return done;
+}
+
+long fat32_write(struct fat32_file *file, uint32_t offset, const void *buffer, size_t len) {
+    if (file == NULL || file->is_directory || (uint64_t)offset + len > UINT32_MAX) {
+        return -1;
+    }
+
+    // Cached pages of the file would hide this write, and dirty ones would
+    // later be written over it
+    struct page_mapping *m = page_cache_find(&fat32_page_ops, NULL, file->ino);
+    if (m != NULL && page_cache_invalidate(m) != 0) {
+        return -1;
+    }
+    long done = file_write(file, offset, buffer, len);
+    if (done > 0) {
+        page_cache_resize(&fat32_page_ops, NULL, file->ino, file->size);
+    }
+    return done;
+}
+
+uint32_t fat32_free_clusters(void) {
+    return vol.free_count;
+}
+
+void fat32_get_stats(struct fat32_stats *out) {
+    *out = stats;
+}
+
+// Zero count blocks starting at start
+static int zero_blocks(uint32_t start, uint32_t count) {
+    static const uint8_t zeros[BLOCK_SIZE];
+    for (uint32_t b = 0; b < count; b++) {
+        if (write_block(start + b, zeros) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int fat32_format(uint32_t total_blocks) {
+    const uint32_t bps = 512;
+    const uint32_t spb = BLOCK_SIZE / bps;
+    const uint32_t spc = spb;             // One block per cluster
+    const uint32_t reserved = 4 * spb;
+
+    if (vol.mounted || total_blocks > block_count() || binvalidate() != 0) {
+        return -1;
+    }
+
+    // The FAT and the data area stay block aligned
+    uint32_t total_sectors = total_blocks * spb;
+    uint32_t fat_size = spb;
+    uint32_t clusters;
+    for (;;) {
+        if (reserved + 2 * fat_size + spc > total_sectors) {
+            return -1;
+        }
+        clusters = (total_sectors - reserved - 2 * fat_size) / spc;
+        uint32_t need = ((clusters + 2) * 4 + bps - 1) / bps;
+        need = (need + spb - 1) / spb * spb;
+        if (need <= fat_size) {
+            break;
+        }
+        fat_size = need;
+    }
+
+    uint8_t block[BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    struct fat32_bpb *bpb = (struct fat32_bpb *)block;
+    bpb->jump[0] = 0xEB;
+    bpb->jump[1] = 0x58;
+    bpb->jump[2] = 0x90;
+    memcpy(bpb->oem, "IONFAT32", 8);
+    bpb->bytes_per_sector = (uint16_t)bps;
+    bpb->sectors_per_cluster = (uint8_t)spc;
+    bpb->reserved_sectors = (uint16_t)reserved;
+    bpb->num_fats = 2;
+    bpb->media = 0xF8;
+    bpb->total_sectors32 = total_sectors;
+    bpb->fat_size32 = fat_size;
+    bpb->root_cluster = 2;
+    bpb->fsinfo_sector = 1;
+    bpb->boot_signature = 0x29;
+    memcpy(bpb->volume_label, "NO NAME    ", 11);
+    memcpy(bpb->fs_type, "FAT32   ", 8);
+    block[510] = 0x55;
+    block[511] = 0xAA;
+
+    struct fat32_fsinfo *info = (struct fat32_fsinfo *)(block + bps);
+    info->lead_signature = FSINFO_LEAD;
+    info->struct_signature = FSINFO_STRUCT;
+    info->free_count = clusters - 1;      // The root directory uses cluster 2
+    info->next_free = 3;
+    info->trail_signature = FSINFO_TRAIL;
+
+    uint32_t fat_blocks = fat_size / spb;
+    uint32_t data_block = (reserved + 2 * fat_size) / spb;
+    if (write_block(0, block) != 0 || zero_blocks(1, data_block - 1) != 0) {
+        return -1;
+    }
+
+    // Media descriptor, reserved entry and the root directory's chain
+    memset(block, 0, sizeof(block));
+    uint32_t head[3] = { 0x0FFFFF00 | 0xF8, 0x0FFFFFFF, 0x0FFFFFFF };
+    memcpy(block, head, sizeof(head));
+    for (uint32_t i = 0; i < 2; i++) {
+        if (write_block(reserved / spb + i * fat_blocks, block) != 0) {
+            return -1;
+        }
+    }
+    return zero_blocks(data_block, 1);
+}
+
+static int fat32_mount(const char *device) {
+    uint8_t block[BLOCK_SIZE];
+    const struct fat32_bpb *bpb = (const struct fat32_bpb *)block;
+
+    if (vol.mounted) {
+        printf("FAT32: a volume is already mounted\n");
+        return -1;
+    }
+    if (read_block(0, block) != 0) {
+        return -1;
+    }
+    if (block[510] != 0x55 || block[511] != 0xAA || bpb->fat_size16 != 0 || bpb->fat_size32 == 0 ||
+        bpb->root_entries != 0 || bpb->num_fats == 0 || bpb->sectors_per_cluster == 0) {
+        printf("FAT32: %s does not hold a FAT32 volume\n", device != NULL ? device : "device");
+        return -1;
+    }
+
+    // Clusters, the FATs and the data area must fall on block boundaries
+    uint32_t bps = bpb->bytes_per_sector;
+    if (bps < 512 || bps > BLOCK_SIZE || (bps & (bps - 1)) != 0) {
+        printf("FAT32: unsupported sector size %u\n", bps);
+        return -1;
+    }
+    uint32_t spb = BLOCK_SIZE / bps;
+    uint32_t data_sector = bpb->reserved_sectors + bpb->num_fats * bpb->fat_size32;
+    if (bpb->sectors_per_cluster % spb != 0 || bpb->reserved_sectors % spb != 0 || bpb->fat_size32 % spb != 0) {
+        printf("FAT32: clusters are not aligned to %u-byte blocks\n", BLOCK_SIZE);
+        return -1;
+    }
+
+    memset(&vol, 0, sizeof(vol));
+    vol.blocks_per_cluster = bpb->sectors_per_cluster / spb;
+    vol.fat_block = bpb->reserved_sectors / spb;
+    vol.fat_blocks = bpb->fat_size32 / spb;
+    vol.num_fats = bpb->num_fats;
+    vol.data_block = data_sector / spb;
+    vol.cluster_count = (bpb->total_sectors32 - data_sector) / bpb->sectors_per_cluster;
+    vol.root_cluster = bpb->root_cluster;
+    vol.free_count = FSINFO_UNKNOWN;
+    vol.next_free = 2;
+    if (vol.cluster_count > vol.fat_blocks * (BLOCK_SIZE / 4) - 2) {
+        vol.cluster_count = vol.fat_blocks * (BLOCK_SIZE / 4) - 2; // Clusters the FAT can describe
+    }
+    if (vol.data_block + vol.cluster_count * vol.blocks_per_cluster > block_count() ||
+        !cluster_valid(vol.root_cluster)) {
+        printf("FAT32: volume is larger than the device\n");
+        return -1;
+    }
+
+    // The allocation hint and free count, when the FSInfo sector is sane
+    if (bpb->fsinfo_sector != 0 && bpb->fsinfo_sector < bpb->reserved_sectors) {
+        uint32_t byte = bpb->fsinfo_sector * bps;
+        struct fat32_fsinfo info;
+        struct buffer_head *bh = bread(byte / BLOCK_SIZE);
+        if (bh == NULL) {
+            return -1;
+        }
+        memcpy(&info, bh->data + byte % BLOCK_SIZE, sizeof(info));
+        brelse(bh);
+        if (info.lead_signature == FSINFO_LEAD && info.struct_signature == FSINFO_STRUCT) {
+            vol.fsinfo_block = byte / BLOCK_SIZE;
+            vol.fsinfo_offset = byte % BLOCK_SIZE;
+            vol.free_count = info.free_count;
+            vol.next_free = cluster_valid(info.next_free) ? info.next_free : 2;
+        }
+    }
+
+    memset(fat_cache, 0, sizeof(fat_cache));
+    vol.mounted = 1;
+    return 0;
+}
+
+static int fat32_sync(void) {
+    int status = 0;
+
+    if (!vol.mounted) {
+        return -1;
+    }
+    if (fat_flush() != 0) {
+        status = -1;
+    }
+    if (vol.fsinfo_offset != 0 || vol.fsinfo_block != 0) {
+        struct buffer_head *bh = bread(vol.fsinfo_block);
+        if (bh == NULL) {
+            return -1;
+        }
+        struct fat32_fsinfo *info = (struct fat32_fsinfo *)(bh->data + vol.fsinfo_offset);
+        info->free_count = vol.free_count;
+        info->next_free = vol.next_free;
+        bwrite(bh);
+        brelse(bh);
+    }
+    if (bflush() != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+static int fat32_unmount(void) {
+    if (!vol.mounted) {
+        return -1;
+    }
+    int status = fat32_sync();
+    free(page_file);
+    page_file = NULL;
+    vol.mounted = 0;
+    memset(fat_cache, 0, sizeof(fat_cache));
+    return status;
+}
+
+static int fat32_read_inode(inode_t *inode) {
+    struct fat32_dirent ent;
+
+    if (!vol.mounted) {
+        return -1;
+    }
+    if (inode->ino == FAT32_ROOT_INO) {
+        inode->is_directory = 1;
+        return 0;
+    }
+    if (dirent_io(inode->ino, &ent, 0) != 0 || ent.name[0] == 0 || (uint8_t)ent.name[0] == 0xE5) {
+        return -1;
+    }
+    inode->is_directory = (ent.attr & FAT32_ATTR_DIRECTORY) != 0;
+    return 0;
+}
+
+// Sizes and clusters reach the directory entry on every write
+static int fat32_write_inode(inode_t *inode) {
+    (void)inode;
+    return vol.mounted ? 0 : -1;
+}
+
+// Open file behind page I/O on ino, kept with its run cache until page
+// I/O moves to another file
+static struct fat32_file *page_file_get(uint64_t ino) {
+    struct fat32_dirent ent;
+
+    if (!vol.mounted || ino == FAT32_ROOT_INO) {
+        return NULL;
+    }
+    if (page_file != NULL && page_file->ino == ino) {
+        return page_file;
+    }
+    if (dirent_io((unsigned long)ino, &ent, 0) != 0 || (ent.attr & FAT32_ATTR_DIRECTORY)) {
+        return NULL;
+    }
+    free(page_file);
+    page_file = file_new(&ent, (unsigned long)ino);
+    return page_file;
+}
+
+static int fat32_readpage(void *ctx, uint64_t ino, uint64_t index, void *data) {
+    (void)ctx;
+    struct fat32_file *f = page_file_get(ino);
+    if (f == NULL || index * PAGE_SIZE > UINT32_MAX) {
+        return -1;
+    }
+    long n = fat32_read(f, (uint32_t)(index * PAGE_SIZE), data, PAGE_SIZE);
+    if (n < 0) {
+        return -1;
+    }
+    memset((uint8_t *)data + n, 0, PAGE_SIZE - (size_t)n);
+    return 0;
+}
+
+static int fat32_writepage(void *ctx, uint64_t ino, uint64_t index, const void *data, size_t len) {
+    (void)ctx;
+    struct fat32_file *f = page_file_get(ino);
+    if (f == NULL || index * PAGE_SIZE > UINT32_MAX) {
+        return -1;
+    }
+    return file_write(f, (uint32_t)(index * PAGE_SIZE), data, len) == (long)len ? 0 : -1;
+}
+
+const struct page_cache_ops fat32_page_ops = {
+    .readpage = fat32_readpage,
+    .writepage = fat32_writepage,
+};
+
+fs_operations_t fat32_ops = {
+    .mount = fat32_mount,
+    .unmount = fat32_unmount,
+    .read_inode = fat32_read_inode,
+    .write_inode = fat32_write_inode,
+    .sync = fat32_sync,
+};
@@ -0,0 +1,139 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fs.h"
+#include "block_io.h"
+#include "page_cache.h"
+
+#define FAT32_FAT_CACHE 16        // FAT blocks kept in memory
+#define FAT32_RUNS_MAX 32         // Cluster runs remembered per open file
+#define FAT32_ROOT_INO 1          // Inode number of the root directory
+
+#define FAT32_EOC 0x0FFFFFF8      // Entries at or above this end a chain
+#define FAT32_MASK 0x0FFFFFFF     // The top four bits of an entry are reserved
+
+// Directory entry attributes
+#define FAT32_ATTR_READ_ONLY 0x01
+#define FAT32_ATTR_HIDDEN    0x02
+#define FAT32_ATTR_SYSTEM    0x04
+#define FAT32_ATTR_VOLUME_ID 0x08
+#define FAT32_ATTR_DIRECTORY 0x10
+#define FAT32_ATTR_ARCHIVE   0x20
+#define FAT32_ATTR_LFN       0x0F
+
+// BIOS parameter block at the start of the volume
+struct fat32_bpb {
+    uint8_t jump[3];
+    char oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t num_fats;
+    uint16_t root_entries;        // 0 on FAT32
+    uint16_t total_sectors16;     // 0 on FAT32
+    uint8_t media;
+    uint16_t fat_size16;          // 0 on FAT32
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors32;
+    uint32_t fat_size32;          // Sectors per FAT
+    uint16_t ext_flags;
+    uint16_t fs_version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;
+    uint16_t backup_boot_sector;
+    uint8_t reserved[12];
+    uint8_t drive_number;
+    uint8_t reserved1;
+    uint8_t boot_signature;
+    uint32_t volume_id;
+    char volume_label[11];
+    char fs_type[8];
+} __attribute__((packed));
+
+// FSInfo sector: free-cluster count and allocation hint
+struct fat32_fsinfo {
+    uint32_t lead_signature;      // 0x41615252
+    uint8_t reserved[480];
+    uint32_t struct_signature;    // 0x61417272
+    uint32_t free_count;          // 0xFFFFFFFF if unknown
+    uint32_t next_free;           // Where to start looking for a free cluster
+    uint8_t reserved2[12];
+    uint32_t trail_signature;     // 0xAA550000
+} __attribute__((packed));
+
+// Short (8.3) directory entry
+struct fat32_dirent {
+    char name[11];
+    uint8_t attr;
+    uint8_t nt_reserved;
+    uint8_t create_time_tenth;
+    uint16_t create_time;
+    uint16_t create_date;
+    uint16_t access_date;
+    uint16_t cluster_hi;
+    uint16_t write_time;
+    uint16_t write_date;
+    uint16_t cluster_lo;
+    uint32_t size;
+} __attribute__((packed));
+
+// Contiguous clusters of a file: file clusters [index, index + len) live in
+// clusters [cluster, cluster + len)
+struct fat32_run {
+    uint32_t index;
+    uint32_t cluster;
+    uint32_t len;
+};
+
+// Open file or directory. The run cache maps file offsets to clusters
+// without walking the chain from the first cluster on every seek. Several
+// handles may be open on one file: each read and write first reloads the
+// size and first cluster from the directory entry.
+struct fat32_file {
+    unsigned long ino;            // Location of the directory entry
+    uint32_t first_cluster;       // 0 for an empty file
+    uint32_t size;
+    uint8_t is_directory;
+    uint32_t nruns;
+    struct fat32_run runs[FAT32_RUNS_MAX];
+};
+
+struct fat32_stats {
+    uint64_t fat_hits;            // FAT lookups served from the FAT cache
+    uint64_t fat_misses;          // FAT blocks read from the device
+    uint64_t run_hits;            // Cluster lookups served by a file's run cache
+    uint64_t chain_steps;         // FAT entries followed to extend run caches
+    uint64_t data_reads;          // Vectored data read requests
+    uint64_t data_writes;         // Vectored data write requests
+};
+
+// Operations for vfs_mount(); the volume is read from the current backend
+extern fs_operations_t fat32_ops;
+
+// Write an empty FAT32 volume covering total_blocks of the current backend
+int fat32_format(uint32_t total_blocks);
+
+// Paths are absolute within the volume; names are 8.3 and case-insensitive
+struct fat32_file *fat32_open(const char *path);
+struct fat32_file *fat32_create(const char *path);
+int fat32_mkdir(const char *path);
+void fat32_close(struct fat32_file *file);
+
+// Return the number of bytes moved, or -1 on error
+long fat32_read(struct fat32_file *file, uint32_t offset, void *buffer, size_t len);
+long fat32_write(struct fat32_file *file, uint32_t offset, const void *buffer, size_t len);
+
+// Free clusters (FSInfo count, kept current while mounted)
+uint32_t fat32_free_clusters(void);
+
+void fat32_get_stats(struct fat32_stats *stats);
+
+// Page cache access to files by inode number, with a NULL context.
+// fat32_write() writes back and drops the file's cached pages first.
+extern const struct page_cache_ops fat32_page_ops;
+
+#endif // FAT32_H
@@ -0,0 +1,233 @@
+#include "icache.h"
+#include "dcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(inode_t) == 64, "inode_t must stay one cache line");
+
+// Slab of inode objects carved from one ICACHE_SLAB_SIZE allocation
+struct icache_slab {
+    struct icache_slab *next;
+    inode_t objects[];
+};
+
+#define INODES_PER_SLAB ((ICACHE_SLAB_SIZE - offsetof(struct icache_slab, objects)) / sizeof(inode_t))
+
+static inode_t *hash_table[ICACHE_HASH_SIZE];
+static inode_t *free_list = NULL;          // Free objects, linked by hash_next
+static struct icache_slab *slabs = NULL;
+static struct icache_slab *clock_slab = NULL;   // Reclaim clock position
+static size_t clock_index = 0;
+static struct icache_stats stats;
+
+static inline uint32_t icache_slot(const struct superblock *sb, unsigned long ino) {
+    uintptr_t p = (uintptr_t)sb;
+    return (uint32_t)((ino * 2654435761u) ^ (p >> 4)) % ICACHE_HASH_SIZE;
+}
+
+static void icache_unhash(inode_t *inode) {
+    inode_t **link = &hash_table[icache_slot(inode->sb, inode->ino)];
+    while (*link != NULL) {
+        if (*link == inode) {
+            *link = inode->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    inode->hash_next = NULL;
+    inode->state &= ~I_HASHED;
+}
+
+static void slab_free(inode_t *inode) {
+    dcache_purge_inode(inode);
+    iname_put(inode->name);
+    inode->name = NULL;
+    inode->state = I_FREE;
+    inode->hash_next = free_list;
+    free_list = inode;
+    stats.active--;
+}
+
+static int icache_writeback(inode_t *inode) {
+    if (!(inode->state & I_DIRTY)) {
+        return 0;
+    }
+    if (inode->sb != NULL && inode->sb->ops != NULL && inode->sb->ops->write_inode != NULL) {
+        if (inode->sb->ops->write_inode(inode) != 0) {
+            return -1;
+        }
+        stats.writebacks++;
+    }
+    inode->state &= ~I_DIRTY;
+    return 0;
+}
+
+// Cached but unreferenced: candidate for reclaim
+static inline int icache_idle(const inode_t *inode) {
+    return (inode->state & (I_HASHED | I_FREE)) == I_HASHED && inode->count == 0;
+}
+
+// CLOCK over the slabs: drop the first idle inode not used since the hand
+// last passed it
+static int icache_reclaim(void) {
+    size_t total = (size_t)stats.slabs * INODES_PER_SLAB;
+    for (size_t scanned = 0; scanned < 2 * total; scanned++) {
+        if (clock_slab == NULL || clock_index == INODES_PER_SLAB) {
+            clock_slab = clock_slab != NULL && clock_slab->next != NULL ? clock_slab->next : slabs;
+            clock_index = 0;
+        }
+        inode_t *victim = &clock_slab->objects[clock_index++];
+
+        if (!icache_idle(victim)) {
+            continue;
+        }
+        if (victim->state & I_REFERENCED) {
+            victim->state &= ~I_REFERENCED;
+            continue;
+        }
+        if (icache_writeback(victim) != 0) {
+            continue;
+        }
+        icache_unhash(victim);
+        slab_free(victim);
+        stats.reclaims++;
+        return 0;
+    }
+    return -1;
+}
+
+static inode_t *slab_alloc(void) {
+    if (free_list == NULL && stats.active >= ICACHE_MAX_INODES) {
+        icache_reclaim();
+    }
+
+    if (free_list == NULL) {
+        // Everything is referenced: grow by one slab
+        struct icache_slab *slab = aligned_alloc(ICACHE_SLAB_SIZE, ICACHE_SLAB_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->next = slabs;
+        slabs = slab;
+        stats.slabs++;
+        for (size_t i = 0; i < INODES_PER_SLAB; i++) {
+            slab->objects[i].state = I_FREE;
+            slab->objects[i].hash_next = free_list;
+            free_list = &slab->objects[i];
+        }
+    }
+
+    inode_t *inode = free_list;
+    free_list = inode->hash_next;
+    memset(inode, 0, sizeof(*inode));
+    stats.active++;
+    return inode;
+}
+
+inode_t *inode_alloc(struct superblock *sb) {
+    inode_t *inode = slab_alloc();
+    if (inode != NULL) {
+        inode->sb = sb;
+        inode->count = 1;
+    }
+    return inode;
+}
+
+inode_t *iget(struct superblock *sb, unsigned long ino) {
+    uint32_t slot = icache_slot(sb, ino);
+    for (inode_t *inode = hash_table[slot]; inode != NULL; inode = inode->hash_next) {
+        if (inode->sb == sb && inode->ino == ino) {
+            inode->count++;
+            inode->state |= I_REFERENCED;
+            stats.hits++;
+            return inode;
+        }
+    }
+
+    stats.misses++;
+    inode_t *inode = inode_alloc(sb);
+    if (inode == NULL) {
+        return NULL;
+    }
+    inode->ino = ino;
+    if (sb != NULL && sb->ops != NULL && sb->ops->read_inode != NULL && sb->ops->read_inode(inode) != 0) {
+        slab_free(inode);
+        return NULL;
+    }
+
+    inode->state |= I_HASHED | I_REFERENCED;
+    inode->hash_next = hash_table[slot];
+    hash_table[slot] = inode;
+    return inode;
+}
+
+// References may be taken by lock-free path walks, so counts change atomically
+inode_t *igrab(inode_t *inode) {
+    if (inode != NULL) {
+        __atomic_add_fetch(&inode->count, 1, __ATOMIC_ACQ_REL);
+    }
+    return inode;
+}
+
+void iput(inode_t *inode) {
+    if (inode == NULL || inode->count <= 0 || __atomic_sub_fetch(&inode->count, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    if (!(inode->state & I_HASHED)) {
+        icache_writeback(inode);
+        slab_free(inode);
+    }
+    // Hashed inodes stay cached until the reclaim clock gets to them
+}
+
+void mark_inode_dirty(inode_t *inode) {
+    inode->state |= I_DIRTY;
+}
+
+int icache_sync(struct superblock *sb) {
+    int status = 0;
+    for (int i = 0; i < ICACHE_HASH_SIZE; i++) {
+        for (inode_t *inode = hash_table[i]; inode != NULL; inode = inode->hash_next) {
+            if (inode->sb == sb && icache_writeback(inode) != 0) {
+                status = -1;
+            }
+        }
+    }
+    return status;
+}
+
+int icache_evict_sb(struct superblock *sb) {
+    int status = 0;
+    for (struct icache_slab *slab = slabs; slab != NULL; slab = slab->next) {
+        for (size_t i = 0; i < INODES_PER_SLAB; i++) {
+            inode_t *inode = &slab->objects[i];
+            if (!icache_idle(inode) || inode->sb != sb) {
+                continue;
+            }
+            if (icache_writeback(inode) == 0) {
+                icache_unhash(inode);
+                slab_free(inode);
+            } else {
+                status = -1;
+            }
+        }
+    }
+    return status;
+}
+
+void icache_get_stats(struct icache_stats *out) {
+    *out = stats;
+}
+
+int icache_sb_busy(struct superblock *sb) {
+    for (struct icache_slab *slab = slabs; slab != NULL; slab = slab->next) {
+        for (size_t i = 0; i < INODES_PER_SLAB; i++) {
+            const inode_t *inode = &slab->objects[i];
+            if ((inode->state & (I_HASHED | I_FREE)) == I_HASHED && inode->sb == sb && inode->count > 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <stdint.h>
+#include "fs.h"
+
+#define ICACHE_SLAB_SIZE 4096     // Bytes per slab
+#define ICACHE_MAX_INODES 1024    // Reclaim unreferenced inodes above this
+#define ICACHE_HASH_SIZE 256
+
+struct icache_stats {
+    uint64_t hits;        // iget() served from the cache
+    uint64_t misses;      // iget() that called read_inode
+    uint64_t reclaims;    // Unreferenced inodes dropped by the reclaim clock
+    uint64_t writebacks;  // Dirty inodes written through write_inode
+    uint32_t slabs;       // Slabs allocated
+    uint32_t active;      // Inodes currently allocated
+};
+
+void icache_get_stats(struct icache_stats *stats);
+
+// Drop every unreferenced inode of sb (after writing it back), e.g. on unmount
+int icache_evict_sb(struct superblock *sb);
+
+// Whether a cached inode of sb is still referenced
+int icache_sb_busy(struct superblock *sb);
+
+#endif // ICACHE_H
@@ -0,0 +1,102 @@
+#include "fs.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INAME_HASH_SIZE 1024
+#define INAME_CHUNK_SIZE 65536              // Arena growth step
+#define INAME_ALIGN 8
+#define INAME_CLASSES ((sizeof(struct iname) + VFS_NAME_MAX + 1 + INAME_ALIGN - 1) / INAME_ALIGN + 1)
+
+// Names are carved from large chunks; freed ones are kept on per-size free
+// lists (linked through next) for the next name of the same size
+struct iname_chunk {
+    struct iname_chunk *prev;
+    size_t used;
+    uint8_t data[];
+};
+
+static struct iname *table[INAME_HASH_SIZE];
+static struct iname *free_lists[INAME_CLASSES];
+static struct iname_chunk *chunk = NULL;
+static size_t arena_bytes = 0;
+
+static inline size_t iname_class(size_t len) {
+    return (sizeof(struct iname) + len + 1 + INAME_ALIGN - 1) / INAME_ALIGN;
+}
+
+static struct iname *iname_alloc(size_t len) {
+    size_t cls = iname_class(len);
+    struct iname *n = free_lists[cls];
+    if (n != NULL) {
+        free_lists[cls] = n->next;
+        return n;
+    }
+
+    size_t size = cls * INAME_ALIGN;
+    if (chunk == NULL || chunk->used + size > INAME_CHUNK_SIZE - sizeof(struct iname_chunk)) {
+        struct iname_chunk *c = malloc(INAME_CHUNK_SIZE);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->prev = chunk;
+        c->used = 0;
+        chunk = c;
+        arena_bytes += INAME_CHUNK_SIZE;
+    }
+    n = (struct iname *)(chunk->data + chunk->used);
+    chunk->used += size;
+    return n;
+}
+
+const struct iname *iname_get(const char *name, size_t len, uint32_t hash) {
+    if (len > VFS_NAME_MAX) {
+        return NULL;
+    }
+
+    struct iname **bucket = &table[hash % INAME_HASH_SIZE];
+    for (struct iname *n = *bucket; n != NULL; n = n->next) {
+        if (n->hash == hash && n->len == len && memcmp(n->str, name, len) == 0) {
+            n->refs++;
+            return n;
+        }
+    }
+
+    struct iname *n = iname_alloc(len);
+    if (n == NULL) {
+        return NULL;
+    }
+    n->hash = hash;
+    n->refs = 1;
+    n->len = (uint16_t)len;
+    memcpy(n->str, name, len);
+    n->str[len] = '\0';
+    n->next = *bucket;
+    *bucket = n;
+    return n;
+}
+
+const struct iname *iname_dup(const struct iname *name) {
+    ((struct iname *)name)->refs++;
+    return name;
+}
+
+void iname_put(const struct iname *name) {
+    struct iname *n = (struct iname *)name;
+    if (n == NULL || --n->refs > 0) {
+        return;
+    }
+
+    struct iname **link = &table[n->hash % INAME_HASH_SIZE];
+    while (*link != n) {
+        link = &(*link)->next;
+    }
+    *link = n->next;
+
+    size_t cls = iname_class(n->len);
+    n->next = free_lists[cls];
+    free_lists[cls] = n;
+}
+
+size_t iname_arena_bytes(void) {
+    return arena_bytes;
+}
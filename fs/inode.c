@@ -0,0 +1,340 @@
+#include "inode.h"
+#include "bcache.h"
+#include <stdio.h>
+#include <string.h>
+
+#define INODES_PER_BLOCK (BLOCK_SIZE / ION_INODE_SIZE)
+#define ION_WRITE_CHUNK (16 * CSUM_PER_BLOCK)  // Most blocks written under one handle
+
+void ion_inode_init(struct ion_inode *inode, uint16_t type) {
+    memset(inode, 0, sizeof(*inode));
+    inode->type = type;
+    inode->links = 1;
+    inode->root.magic = ION_EXTENT_MAGIC;
+    inode->root.max = ION_ROOT_EXTENTS;
+}
+
+int ion_read_inode(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode) {
+    if (ino >= fs->sb.total_inodes) {
+        return -1;
+    }
+
+    struct buffer_head *bh = bread(fs->sb.inode_table + ino / INODES_PER_BLOCK);
+    if (bh == NULL) {
+        return -1;
+    }
+    memcpy(inode, bh->data + (ino % INODES_PER_BLOCK) * ION_INODE_SIZE, sizeof(*inode));
+    brelse(bh);
+    return 0;
+}
+
+int ion_write_inode(struct ion_fs *fs, uint32_t ino, const struct ion_inode *inode) {
+    if (ino >= fs->sb.total_inodes) {
+        return -1;
+    }
+
+    if (ion_begin(fs, ION_CREDITS_INODE) != 0) {
+        return -1;
+    }
+    struct buffer_head *bh = bread(fs->sb.inode_table + ino / INODES_PER_BLOCK);
+    if (bh == NULL) {
+        ion_end(fs);
+        return -1;
+    }
+    memcpy(bh->data + (ino % INODES_PER_BLOCK) * ION_INODE_SIZE, inode, sizeof(*inode));
+    bwrite(bh);
+    brelse(bh);
+    ion_end(fs);
+    return 0;
+}
+
+static int file_write(struct ion_fs *fs, struct ion_inode *inode, uint32_t first, uint32_t count, const void *buffer);
+
+// Cached pages of a file would hide a write made around the page cache.
+// Clean ones are dropped; dirty ones would later be written over it, and
+// writing them back here would change the inode under the caller's copy,
+// so the caller flushes them (page_cache_writeback()) and re-reads the
+// inode first.
+static int file_uncache(struct ion_fs *fs, uint32_t ino) {
+    struct page_mapping *m = page_cache_find(&ion_page_ops, fs, ino);
+    if (m != NULL && page_cache_drop_clean(m) != 0) {
+        printf("ION: inode %u has dirty cached pages\n", ino);
+        return -1;
+    }
+    return 0;
+}
+
+// Inline data reads as block 0 of the file, the rest is a hole
+static void inline_read(const struct ion_inode *inode, uint32_t first, uint32_t count, uint8_t *out) {
+    memset(out, 0, (size_t)count * BLOCK_SIZE);
+    if (first == 0 && count > 0) {
+        memcpy(out, inode->inline_data, inode->size < ION_INLINE_MAX ? inode->size : ION_INLINE_MAX);
+    }
+}
+
+// Move inline data into a real block so the file can grow through the tree
+static int inline_expand(struct ion_fs *fs, struct ion_inode *inode) {
+    uint8_t block[BLOCK_SIZE];
+    uint64_t size = inode->size;
+
+    if (!(inode->flags & ION_INODE_INLINE)) {
+        return 0;
+    }
+    inline_read(inode, 0, 1, block);
+    ion_extent_free_all(fs, inode);
+    if (size == 0) {
+        return 0;
+    }
+
+    int status = file_write(fs, inode, 0, 1, block);
+    inode->size = size;
+    return status;
+}
+
+int ion_file_read(struct ion_fs *fs, struct ion_inode *inode, uint32_t first, uint32_t count, void *buffer) {
+    uint8_t *out = buffer;
+
+    if (inode->flags & ION_INODE_INLINE) {
+        inline_read(inode, first, count, out);
+        return 0;
+    }
+
+    while (count > 0) {
+        uint32_t physical, len;
+        if (ion_extent_map(fs, inode, first, &physical, &len) != 0) {
+            return -1;
+        }
+        if (len > count) {
+            len = count;
+        }
+
+        if (physical == 0) {
+            memset(out, 0, (size_t)len * BLOCK_SIZE); // Hole
+        } else {
+            struct block_iovec iov = { out, (size_t)len * BLOCK_SIZE };
+            if (read_blocks(physical, len, &iov, 1) != 0) {
+                return -1;
+            }
+        }
+
+        first += len;
+        count -= len;
+        out += (size_t)len * BLOCK_SIZE;
+    }
+    return 0;
+}
+
+int ion_file_store(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode, const void *data, size_t len) {
+    uint32_t full = (uint32_t)(len / BLOCK_SIZE);
+    size_t tail = len % BLOCK_SIZE;
+
+    if (file_uncache(fs, ino) != 0 || ion_extent_free_all(fs, inode) != 0) {
+        return -1;
+    }
+
+    if (len <= ION_INLINE_MAX) {
+        memset(inode->inline_data, 0, sizeof(inode->inline_data));
+        memcpy(inode->inline_data, data, len);
+        inode->flags |= ION_INODE_INLINE;
+        inode->size = len;
+        page_cache_resize(&ion_page_ops, fs, ino, len);
+        return 0;
+    }
+
+    if (full > 0 && file_write(fs, inode, 0, full, data) != 0) {
+        return -1;
+    }
+    if (tail > 0) {
+        uint8_t block[BLOCK_SIZE];
+        memset(block, 0, sizeof(block));
+        memcpy(block, (const uint8_t *)data + (size_t)full * BLOCK_SIZE, tail);
+        if (file_write(fs, inode, full, 1, block) != 0) {
+            return -1;
+        }
+    }
+    inode->size = len;
+    page_cache_resize(&ion_page_ops, fs, ino, len);
+    return 0;
+}
+
+long ion_file_load(struct ion_fs *fs, struct ion_inode *inode, void *buffer, size_t cap) {
+    size_t len = inode->size < cap ? (size_t)inode->size : cap;
+    uint32_t full = (uint32_t)(len / BLOCK_SIZE);
+    size_t tail = len % BLOCK_SIZE;
+
+    if (inode->flags & ION_INODE_INLINE) {
+        // No block lookup, no I/O; past the inline bytes the file is a hole
+        size_t stored = len < ION_INLINE_MAX ? len : ION_INLINE_MAX;
+        memcpy(buffer, inode->inline_data, stored);
+        memset((uint8_t *)buffer + stored, 0, len - stored);
+        return (long)len;
+    }
+
+    if (full > 0 && ion_file_read(fs, inode, 0, full, buffer) != 0) {
+        return -1;
+    }
+    if (tail > 0) {
+        uint8_t block[BLOCK_SIZE];
+        if (ion_file_read(fs, inode, full, 1, block) != 0) {
+            return -1;
+        }
+        memcpy((uint8_t *)buffer + (size_t)full * BLOCK_SIZE, block, tail);
+    }
+    return (long)len;
+}
+
+int ion_file_prealloc(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode, uint64_t size) {
+    if (inode->type != ION_INODE_FILE) {
+        return -1;
+    }
+    // Inline data cannot describe a hole, so a file growing past it moves
+    // to the extent tree first
+    if (size > ION_INLINE_MAX && inline_expand(fs, inode) != 0) {
+        return -1;
+    }
+    if (size > inode->size) {
+        inode->size = size;
+        page_cache_resize(&ion_page_ops, fs, ino, size);
+    }
+    return 0;
+}
+
+int ion_file_read_stream(struct ion_fs *fs, struct ion_inode *inode, struct readahead *ra,
+                         uint32_t first, uint32_t count, void *buffer) {
+    uint8_t *out = buffer;
+
+    if (inode->flags & ION_INODE_INLINE) {
+        inline_read(inode, first, count, out);
+        return 0;
+    }
+
+    while (count > 0) {
+        uint32_t physical, len;
+        if (ion_extent_map(fs, inode, first, &physical, &len) != 0) {
+            return -1;
+        }
+        if (len > count) {
+            len = count;
+        }
+
+        if (physical == 0) {
+            memset(out, 0, (size_t)len * BLOCK_SIZE); // Hole
+        } else if (readahead_read(ra, physical, len, out) != 0) {
+            return -1;
+        }
+
+        first += len;
+        count -= len;
+        out += (size_t)len * BLOCK_SIZE;
+    }
+    return 0;
+}
+
+static int file_write(struct ion_fs *fs, struct ion_inode *inode, uint32_t first, uint32_t count, const void *buffer) {
+    const uint8_t *in = buffer;
+    uint64_t end = ((uint64_t)first + count) * BLOCK_SIZE;
+
+    if (inline_expand(fs, inode) != 0) {
+        return -1;
+    }
+
+    while (count > 0) {
+        uint32_t physical, len;
+        if (ion_extent_map(fs, inode, first, &physical, &len) != 0) {
+            return -1;
+        }
+        if (len > count) {
+            len = count;
+        }
+        if (len > ION_WRITE_CHUNK) {
+            len = ION_WRITE_CHUNK;
+        }
+
+        // One handle per extent keeps each step within a transaction
+        if (ion_begin(fs, ION_CREDITS_EXTENT + ION_CREDITS_DATA(len)) != 0) {
+            return -1;
+        }
+        if (physical == 0) {
+            // Fill the hole with as long a contiguous run as the allocator has
+            len = ion_alloc_blocks(fs, len, &physical);
+            if (len == 0) {
+                ion_end(fs);
+                return -1;
+            }
+            struct ion_extent ext = { first, physical, len };
+            if (ion_extent_insert(fs, inode, &ext) != 0) {
+                ion_free_blocks(fs, physical, len);
+                ion_end(fs);
+                return -1;
+            }
+            inode->blocks += len;
+        }
+
+        struct block_iovec iov = { (void *)in, (size_t)len * BLOCK_SIZE };
+        int status = write_blocks(physical, len, &iov, 1);
+        ion_end(fs);
+        if (status != 0) {
+            return -1;
+        }
+        bcache_forget(physical, len); // Stale readahead copies
+
+        first += len;
+        count -= len;
+        in += (size_t)len * BLOCK_SIZE;
+    }
+
+    if (end > inode->size) {
+        inode->size = end;
+    }
+    return 0;
+}
+
+int ion_file_write(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode,
+                   uint32_t first, uint32_t count, const void *buffer) {
+    if (file_uncache(fs, ino) != 0 || file_write(fs, inode, first, count, buffer) != 0) {
+        return -1;
+    }
+    page_cache_resize(&ion_page_ops, fs, ino, inode->size);
+    return 0;
+}
+
+static int ion_readpage(void *ctx, uint64_t ino, uint64_t index, void *data) {
+    struct ion_fs *fs = ctx;
+    struct ion_inode inode;
+
+    if (ino > UINT32_MAX || index >= UINT32_MAX || ion_read_inode(fs, (uint32_t)ino, &inode) != 0 ||
+        ion_file_read(fs, &inode, (uint32_t)index, 1, data) != 0) {
+        return -1;
+    }
+    uint64_t start = index * PAGE_SIZE;
+    size_t valid = start >= inode.size ? 0 : inode.size - start < PAGE_SIZE ? (size_t)(inode.size - start) : PAGE_SIZE;
+    memset((uint8_t *)data + valid, 0, PAGE_SIZE - valid);
+    return 0;
+}
+
+static int ion_writepage(void *ctx, uint64_t ino, uint64_t index, const void *data, size_t len) {
+    struct ion_fs *fs = ctx;
+    struct ion_inode inode;
+
+    if (ino > UINT32_MAX || index >= UINT32_MAX || ion_read_inode(fs, (uint32_t)ino, &inode) != 0) {
+        return -1;
+    }
+    // The page past len is zero, so the whole block can be written. The
+    // new mapping commits together with the inode that points to it.
+    uint64_t size = inode.size;
+    if (ion_begin(fs, ION_CREDITS_EXTENT + ION_CREDITS_DATA(1) + ION_CREDITS_INODE) != 0) {
+        return -1;
+    }
+    int status = file_write(fs, &inode, (uint32_t)index, 1, data);
+    if (status == 0) {
+        inode.size = index * PAGE_SIZE + len > size ? index * PAGE_SIZE + len : size;
+        status = ion_write_inode(fs, (uint32_t)ino, &inode);
+    }
+    ion_end(fs);
+    return status;
+}
+
+const struct page_cache_ops ion_page_ops = {
+    .readpage = ion_readpage,
+    .writepage = ion_writepage,
+};
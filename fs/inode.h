@@ -0,0 +1,119 @@
+#ifndef INODE_H
+#define INODE_H
+
+#include <stdint.h>
+#include "superblock.h"
+#include "readahead.h"
+#include "page_cache.h"
+
+// Inode types
+#define ION_INODE_FREE 0
+#define ION_INODE_FILE 1
+#define ION_INODE_DIR  2
+#define ION_INODE_DEV  3
+
+// Inode flags
+#define ION_INODE_INLINE 0x0001   // Data lives in the inode instead of the extent tree
+
+#define ION_EXTENT_MAGIC 0xE10F
+
+// Header of every extent tree node (inode root or tree block)
+struct ion_extent_header {
+    uint16_t magic;
+    uint16_t entries;   // Entries in use
+    uint16_t max;       // Capacity of the node
+    uint16_t depth;     // 0 = entries are extents, otherwise index entries
+};
+
+// Contiguous run of file blocks
+struct ion_extent {
+    uint32_t logical;   // First file block
+    uint32_t physical;  // First disk block
+    uint32_t length;    // Number of blocks
+};
+
+// Interior tree entry: child covers file blocks from logical up to the next entry
+struct ion_extent_index {
+    uint32_t logical;
+    uint32_t child;     // Block of the child node
+};
+
+#define ION_ROOT_BYTES 48
+#define ION_ROOT_EXTENTS (ION_ROOT_BYTES / sizeof(struct ion_extent))
+#define ION_ROOT_INDEXES (ION_ROOT_BYTES / sizeof(struct ion_extent_index))
+
+// Bytes of file data that fit in the inode itself
+#define ION_INLINE_MAX (ION_INODE_SIZE - 24)
+
+// On-disk inode. The extent tree root lives inline; once the file needs
+// more extents than fit here, they move to a small B-tree of blocks.
+// Files of up to ION_INLINE_MAX bytes (ION_INODE_INLINE) keep their data
+// in place of the tree and use no blocks at all.
+struct ion_inode {
+    uint16_t type;        // ION_INODE_*
+    uint16_t flags;       // ION_INODE_INLINE
+    uint32_t links;
+    uint64_t size;        // File size in bytes
+    uint32_t blocks;      // Data and tree blocks in use
+    uint32_t mtime;
+    union {
+        struct {
+            struct ion_extent_header root;
+            uint8_t root_entries[ION_ROOT_BYTES];
+            uint8_t reserved[ION_INODE_SIZE - 80];
+        };
+        uint8_t inline_data[ION_INLINE_MAX];
+    };
+};
+
+_Static_assert(sizeof(struct ion_inode) == ION_INODE_SIZE, "on-disk inode size");
+
+// Inode changes live in the caller's struct ion_inode until
+// ion_write_inode(); an operation wraps its changes and that write in
+// ion_begin()/ion_end() so the journal commits them together. Each call
+// below also runs in its own handle, so on its own it never straddles a
+// commit.
+
+// Inode table access (through the buffer cache)
+int ion_read_inode(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode);
+int ion_write_inode(struct ion_fs *fs, uint32_t ino, const struct ion_inode *inode);
+void ion_inode_init(struct ion_inode *inode, uint16_t type);
+
+// Extent tree
+// Map a file block: *physical is 0 for a hole, *len is the number of blocks
+// from logical that keep the same mapping (contiguous data or hole).
+int ion_extent_map(struct ion_fs *fs, struct ion_inode *inode, uint32_t logical,
+                   uint32_t *physical, uint32_t *len);
+int ion_extent_insert(struct ion_fs *fs, struct ion_inode *inode, const struct ion_extent *ext);
+// Free every block of a file and leave an empty root. Runs are freed one
+// handle each, so a big file may take several transactions.
+int ion_extent_free_all(struct ion_fs *fs, struct ion_inode *inode);
+
+// Whole-block file I/O: each mapped extent becomes one vectored request.
+// The writers below take the inode number to keep the page cache in step:
+// they drop its clean pages of the file and fail while it has dirty ones.
+int ion_file_read(struct ion_fs *fs, struct ion_inode *inode, uint32_t first, uint32_t count, void *buffer);
+int ion_file_write(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode,
+                   uint32_t first, uint32_t count, const void *buffer);
+
+// Replace the contents of a file with len bytes; small payloads are stored
+// inline in the inode
+int ion_file_store(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode, const void *data, size_t len);
+
+// Copy up to cap bytes of a file into buffer; returns the bytes copied or -1
+long ion_file_load(struct ion_fs *fs, struct ion_inode *inode, void *buffer, size_t cap);
+
+// Grow a file to size bytes without allocating: the new range is left as a
+// hole, reads back as zeros and gets blocks on first write. Inline data is
+// moved to a block once the size passes ION_INLINE_MAX.
+int ion_file_prealloc(struct ion_fs *fs, uint32_t ino, struct ion_inode *inode, uint64_t size);
+
+// Block-at-a-time reads of an open file: served from the buffer cache with
+// the stream's readahead window prefetched ahead of the reader
+int ion_file_read_stream(struct ion_fs *fs, struct ion_inode *inode, struct readahead *ra,
+                         uint32_t first, uint32_t count, void *buffer);
+
+// Page cache access to ION files; the context is the struct ion_fs
+extern const struct page_cache_ops ion_page_ops;
+
+#endif // INODE_H
@@ -0,0 +1,524 @@
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DESC_MAX ((BLOCK_SIZE - sizeof(struct journal_block_header)) / sizeof(uint32_t))
+
+_Static_assert(JOURNAL_TX_MAX <= DESC_MAX, "transaction must fit one descriptor");
+
+// Committed image waiting for checkpoint
+struct journal_entry {
+    uint32_t block;
+    uint8_t *data;
+};
+
+struct journal {
+    struct block_backend backend;   // Installed as the active backend
+    struct block_backend *lower;    // Device underneath the log
+    uint32_t start;                 // Log region (start holds the JOURNAL_SUPER block)
+    uint32_t nblocks;
+    uint32_t limit;                 // Blocks below limit are journaled
+    uint32_t head;                  // Next free log block, relative to start
+    uint32_t seq;                   // Sequence of the running transaction
+
+    // Running transaction, laid out exactly as it is written to the log:
+    // descriptor, JOURNAL_TX_MAX image slots, commit record
+    uint8_t *staging;
+    uint32_t tx_count;
+    uint32_t handles;               // Open operation handles
+    int overflow;                   // A block did not fit: never commit again
+
+    struct journal_entry *ckpt;     // Committed, not yet written home
+    uint32_t ckpt_count;
+    uint32_t ckpt_cap;
+
+    struct journal_stats stats;
+};
+
+// A transaction buffer holds the descriptor, the images and room for the
+// commit record, exactly as they are written to the log
+static inline uint32_t *tx_blocks(uint8_t *tx) {
+    return (uint32_t *)(tx + sizeof(struct journal_block_header));
+}
+
+static inline uint8_t *tx_image(uint8_t *tx, uint32_t i) {
+    return tx + (size_t)(1 + i) * BLOCK_SIZE;
+}
+
+static inline uint32_t *staging_blocks(struct journal *j) {
+    return tx_blocks(j->staging);
+}
+
+static inline uint8_t *staging_image(struct journal *j, uint32_t i) {
+    return tx_image(j->staging, i);
+}
+
+static uint32_t journal_checksum(const uint32_t *blocks, uint32_t count, const uint8_t *images) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < count; i++) {
+        hash = (hash ^ blocks[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < (size_t)count * BLOCK_SIZE; i++) {
+        hash = (hash ^ images[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int lower_sync(struct block_backend *lower) {
+    return lower->sync != NULL ? lower->sync(lower) : 0;
+}
+
+static int journal_write_super(struct block_backend *lower, uint32_t start, uint32_t seq) {
+    uint8_t block[BLOCK_SIZE];
+    struct journal_block_header *hdr = (struct journal_block_header *)block;
+    memset(block, 0, sizeof(block));
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->type = JOURNAL_SUPER;
+    hdr->seq = seq;
+    if (block_backend_io(lower, start, 1, block, 1) != 0) {
+        return -1;
+    }
+    return lower_sync(lower);
+}
+
+int journal_format(uint32_t start, uint32_t nblocks) {
+    if (nblocks < JOURNAL_TX_MAX + 3) {
+        return -1;
+    }
+    return journal_write_super(block_get_backend(), start, 1);
+}
+
+int journal_recover(uint32_t start, uint32_t nblocks, uint32_t limit) {
+    struct block_backend *lower = block_get_backend();
+    uint8_t block[BLOCK_SIZE];
+    struct journal_block_header *hdr = (struct journal_block_header *)block;
+
+    if (block_backend_io(lower, start, 1, block, 0) != 0 ||
+        hdr->magic != JOURNAL_MAGIC || hdr->type != JOURNAL_SUPER) {
+        return -1;
+    }
+
+    uint32_t seq = hdr->seq;
+    uint32_t pos = 1;
+    int replayed = 0;
+    uint32_t homes[DESC_MAX];
+    uint8_t *images = malloc((size_t)JOURNAL_TX_MAX * BLOCK_SIZE);
+    if (images == NULL) {
+        return -1;
+    }
+
+    for (;;) {
+        // Descriptor, images and commit record must all be intact
+        if (pos + 1 >= nblocks || block_backend_io(lower, start + pos, 1, block, 0) != 0 ||
+            hdr->magic != JOURNAL_MAGIC || hdr->type != JOURNAL_DESC || hdr->seq != seq ||
+            hdr->count == 0 || hdr->count > JOURNAL_TX_MAX || pos + hdr->count + 1 >= nblocks) {
+            break;
+        }
+        uint32_t count = hdr->count;
+        memcpy(homes, block + sizeof(*hdr), count * sizeof(uint32_t));
+
+        // Only journaled blocks have a home to replay to
+        uint32_t bad = 0;
+        while (bad < count && homes[bad] < limit && (homes[bad] < start || homes[bad] >= start + nblocks)) {
+            bad++;
+        }
+        if (bad < count) {
+            printf("Journal: transaction %u logs block %u outside the journaled area\n", seq, homes[bad]);
+            break;
+        }
+
+        if (block_backend_io(lower, start + pos + 1, count, images, 0) != 0 ||
+            block_backend_io(lower, start + pos + 1 + count, 1, block, 0) != 0 ||
+            hdr->magic != JOURNAL_MAGIC || hdr->type != JOURNAL_COMMIT || hdr->seq != seq ||
+            *(uint32_t *)(block + sizeof(*hdr)) != journal_checksum(homes, count, images)) {
+            break; // Torn transaction: never committed
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            block_backend_io(lower, homes[i], 1, images + (size_t)i * BLOCK_SIZE, 1);
+        }
+        pos += count + 2;
+        seq++;
+        replayed++;
+    }
+    free(images);
+
+    if (replayed > 0) {
+        printf("Journal: replayed %d transaction(s)\n", replayed);
+    }
+    // Everything replayed is home now; start the log over
+    if (lower_sync(lower) != 0 || journal_write_super(lower, start, seq) != 0) {
+        return -1;
+    }
+    return replayed;
+}
+
+static struct journal_entry *ckpt_find(struct journal *j, uint32_t block) {
+    for (uint32_t i = 0; i < j->ckpt_count; i++) {
+        if (j->ckpt[i].block == block) {
+            return &j->ckpt[i];
+        }
+    }
+    return NULL;
+}
+
+static int tx_find(struct journal *j, uint32_t block) {
+    uint32_t *blocks = staging_blocks(j);
+    for (uint32_t i = 0; i < j->tx_count; i++) {
+        if (blocks[i] == block) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int ckpt_cmp(const void *a, const void *b) {
+    uint32_t x = ((const struct journal_entry *)a)->block;
+    uint32_t y = ((const struct journal_entry *)b)->block;
+    return x < y ? -1 : x > y;
+}
+
+// Write the committed images home, then the count images of tx, which
+// supersede them, and empty the log
+static int checkpoint(struct journal *j, uint8_t *tx, uint32_t count) {
+    int status = 0;
+
+    // Home writes in block order
+    qsort(j->ckpt, j->ckpt_count, sizeof(*j->ckpt), ckpt_cmp);
+    for (uint32_t i = 0; i < j->ckpt_count; i++) {
+        if (block_backend_io(j->lower, j->ckpt[i].block, 1, j->ckpt[i].data, 1) != 0) {
+            status = -1;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (block_backend_io(j->lower, tx_blocks(tx)[i], 1, tx_image(tx, i), 1) != 0) {
+            status = -1;
+        }
+    }
+    if (status != 0 || lower_sync(j->lower) != 0) {
+        return -1;
+    }
+
+    // Only once the home locations are durable may the log be reused
+    if (journal_write_super(j->lower, j->start, j->seq) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < j->ckpt_count; i++) {
+        free(j->ckpt[i].data);
+    }
+    j->ckpt_count = 0;
+    j->head = 1;
+    j->stats.checkpoints++;
+    return 0;
+}
+
+int journal_checkpoint(struct journal *j) {
+    return checkpoint(j, NULL, 0);
+}
+
+// Keep committed images in memory until they are checkpointed. The new
+// entries are set up first, so the images go in all together or not at all.
+static int ckpt_absorb(struct journal *j, uint8_t *tx, uint32_t count) {
+    uint32_t *blocks = tx_blocks(tx);
+    uint32_t added = j->ckpt_count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (ckpt_find(j, blocks[i]) != NULL) {
+            continue;
+        }
+        uint8_t *data = added < j->ckpt_cap ? malloc(BLOCK_SIZE) : NULL;
+        if (data == NULL) {
+            while (added > j->ckpt_count) {
+                free(j->ckpt[--added].data);
+            }
+            return -1;
+        }
+        j->ckpt[added].block = blocks[i];
+        j->ckpt[added].data = data;
+        added++;
+    }
+    j->ckpt_count = added;
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(ckpt_find(j, blocks[i])->data, tx_image(tx, i), BLOCK_SIZE);
+    }
+    return 0;
+}
+
+// Write a filled transaction buffer to the log as the next transaction
+static int tx_write(struct journal *j, uint8_t *tx, uint32_t count) {
+    if (j->head + count + 2 > j->nblocks && journal_checkpoint(j) != 0) {
+        return -1;
+    }
+
+    struct journal_block_header *desc = (struct journal_block_header *)tx;
+    desc->magic = JOURNAL_MAGIC;
+    desc->type = JOURNAL_DESC;
+    desc->seq = j->seq;
+    desc->count = count;
+
+    // The commit record goes right after the last image, so the whole
+    // transaction is one contiguous, sequential write
+    uint8_t *commit = tx_image(tx, count);
+    struct journal_block_header *hdr = (struct journal_block_header *)commit;
+    memset(commit, 0, BLOCK_SIZE);
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->type = JOURNAL_COMMIT;
+    hdr->seq = j->seq;
+    hdr->count = count;
+    *(uint32_t *)(commit + sizeof(*hdr)) = journal_checksum(tx_blocks(tx), count, tx_image(tx, 0));
+
+    if (block_backend_io(j->lower, j->start + j->head, count + 2, tx, 1) != 0 ||
+        lower_sync(j->lower) != 0) {
+        return -1;
+    }
+
+    j->head += count + 2;
+    j->seq++;
+    j->stats.commits++;
+    j->stats.logged += count;
+    if (ckpt_absorb(j, tx, count) != 0) {
+        // Out of checkpoint memory: the log is durable, so write it home
+        // now, this transaction included
+        return checkpoint(j, tx, count);
+    }
+    return 0;
+}
+
+void journal_begin(struct journal *j) {
+    j->handles++;
+}
+
+void journal_end(struct journal *j) {
+    if (j->handles > 0) {
+        j->handles--;
+    }
+}
+
+uint32_t journal_handles(const struct journal *j) {
+    return j->handles;
+}
+
+uint32_t journal_staged(const struct journal *j) {
+    return j->tx_count;
+}
+
+int journal_overflowed(const struct journal *j) {
+    return j->overflow;
+}
+
+void journal_abort(struct journal *j) {
+    j->tx_count = 0;
+    j->overflow = 0;
+}
+
+int journal_commit(struct journal *j) {
+    uint32_t count = j->tx_count;
+    if (j->handles > 0 || j->overflow) {
+        return -1; // Mid-operation, or missing part of one
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    if (tx_write(j, j->staging, count) != 0) {
+        return -1;
+    }
+    j->tx_count = 0;
+    return 0;
+}
+
+// Add or refresh a block image in the running transaction
+static int journal_log(struct journal *j, uint32_t block, const uint8_t *data) {
+    int i = tx_find(j, block);
+    if (i >= 0) {
+        memcpy(staging_image(j, i), data, BLOCK_SIZE);
+        j->stats.absorbed++;
+        return 0;
+    }
+
+    // Committing here could split an operation; the owner reserves room
+    // before each one, so running out means it wrote more than it asked for
+    if (j->tx_count == JOURNAL_TX_MAX) {
+        printf("Journal: transaction full, block %u not logged\n", block);
+        j->overflow = 1;
+        return -1;
+    }
+    staging_blocks(j)[j->tx_count] = block;
+    memcpy(staging_image(j, j->tx_count), data, BLOCK_SIZE);
+    j->tx_count++;
+    return 0;
+}
+
+static inline int journaled(const struct journal *j, uint32_t block) {
+    return block < j->limit && (block < j->start || block >= j->start + j->nblocks);
+}
+
+static int journal_read(struct block_backend *be, uint32_t start, uint32_t count, void *buffer) {
+    struct journal *j = be->priv;
+    uint8_t *out = buffer;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = start + i;
+        uint8_t *dst = out + (size_t)i * BLOCK_SIZE;
+        int slot = journaled(j, block) ? tx_find(j, block) : -1;
+        struct journal_entry *e = journaled(j, block) && slot < 0 ? ckpt_find(j, block) : NULL;
+
+        if (slot >= 0) {
+            memcpy(dst, staging_image(j, slot), BLOCK_SIZE);
+        } else if (e != NULL) {
+            memcpy(dst, e->data, BLOCK_SIZE);
+        } else {
+            // Pass the rest of an unjournaled run through in one call
+            uint32_t run = 1;
+            while (i + run < count && !journaled(j, block + run)) {
+                run++;
+            }
+            if (block_backend_io(j->lower, block, run, dst, 0) != 0) {
+                return -1;
+            }
+            i += run - 1;
+        }
+    }
+    return 0;
+}
+
+static int journal_write(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    struct journal *j = be->priv;
+    const uint8_t *in = buffer;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = start + i;
+        const uint8_t *src = in + (size_t)i * BLOCK_SIZE;
+        if (journaled(j, block)) {
+            if (journal_log(j, block, src) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        uint32_t run = 1;
+        while (i + run < count && !journaled(j, block + run)) {
+            run++;
+        }
+        if (block_backend_io(j->lower, block, run, (void *)src, 1) != 0) {
+            return -1;
+        }
+        i += run - 1;
+    }
+    return 0;
+}
+
+// Commit the blocks as transactions of their own, ahead of the running one
+static int journal_write_now(struct block_backend *be, uint32_t start, uint32_t count, const void *buffer) {
+    struct journal *j = be->priv;
+    const uint8_t *in = buffer;
+    uint8_t *tx = malloc((size_t)(JOURNAL_TX_MAX + 2) * BLOCK_SIZE);
+    uint32_t n = 0;
+    int status = 0;
+
+    if (tx == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count && status == 0; i++) {
+        uint32_t block = start + i;
+        const uint8_t *src = in + (size_t)i * BLOCK_SIZE;
+        if (!journaled(j, block)) {
+            status = block_backend_io(j->lower, block, 1, (void *)src, 1);
+            continue;
+        }
+        // The running transaction must not bring the older image back
+        int slot = tx_find(j, block);
+        if (slot >= 0) {
+            memcpy(staging_image(j, slot), src, BLOCK_SIZE);
+        }
+        tx_blocks(tx)[n] = block;
+        memcpy(tx_image(tx, n), src, BLOCK_SIZE);
+        if (++n == JOURNAL_TX_MAX) {
+            status = tx_write(j, tx, n);
+            n = 0;
+        }
+    }
+    if (status == 0 && n > 0) {
+        status = tx_write(j, tx, n);
+    }
+    free(tx);
+    if (status != 0) {
+        return -1;
+    }
+    return lower_sync(j->lower);
+}
+
+// Makes the data written around the log durable; logged blocks wait for
+// the owner's journal_commit()
+static int journal_sync(struct block_backend *be) {
+    struct journal *j = be->priv;
+    return lower_sync(j->lower);
+}
+
+struct journal *journal_open(uint32_t start, uint32_t nblocks, uint32_t limit) {
+    struct block_backend *lower = block_get_backend();
+    uint8_t block[BLOCK_SIZE];
+    struct journal_block_header *hdr = (struct journal_block_header *)block;
+
+    if (nblocks < JOURNAL_TX_MAX + 3 || block_backend_io(lower, start, 1, block, 0) != 0 ||
+        hdr->magic != JOURNAL_MAGIC || hdr->type != JOURNAL_SUPER) {
+        return NULL;
+    }
+
+    struct journal *j = calloc(1, sizeof(*j));
+    if (j == NULL) {
+        return NULL;
+    }
+    j->staging = malloc((size_t)(JOURNAL_TX_MAX + 2) * BLOCK_SIZE);
+    j->ckpt_cap = nblocks;
+    j->ckpt = calloc(j->ckpt_cap, sizeof(*j->ckpt));
+    if (j->staging == NULL || j->ckpt == NULL) {
+        free(j->staging);
+        free(j->ckpt);
+        free(j);
+        return NULL;
+    }
+
+    j->lower = lower;
+    j->start = start;
+    j->nblocks = nblocks;
+    j->limit = limit;
+    j->head = 1;
+    j->seq = hdr->seq;
+
+    j->backend.name = "journal";
+    j->backend.nblocks = lower->nblocks;
+    j->backend.base = NULL;
+    j->backend.read = journal_read;
+    j->backend.write = journal_write;
+    j->backend.sync = journal_sync;
+    j->backend.write_now = journal_write_now;
+    j->backend.priv = j;
+
+    if (block_set_backend(&j->backend) != 0) {
+        free(j->staging);
+        free(j->ckpt);
+        free(j);
+        return NULL;
+    }
+    return j;
+}
+
+int journal_close(struct journal *j) {
+    int status = 0;
+    if (journal_commit(j) != 0 || journal_checkpoint(j) != 0) {
+        status = -1;
+    }
+    if (block_set_backend(j->lower) != 0) {
+        return -1; // Blocks still borrowed through the journal
+    }
+    free(j->staging);
+    free(j->ckpt);
+    free(j);
+    return status;
+}
+
+void journal_get_stats(const struct journal *j, struct journal_stats *out) {
+    *out = j->stats;
+}
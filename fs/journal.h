@@ -0,0 +1,82 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "block_io.h"
+
+#define JOURNAL_MAGIC 0x4A4E4C31   // "JNL1"
+#define JOURNAL_TX_MAX 64          // Most blocks in one transaction
+
+// Journal block types
+#define JOURNAL_SUPER  1   // First block of the region: oldest live sequence
+#define JOURNAL_DESC   2   // Descriptor: home block numbers of the images that follow
+#define JOURNAL_COMMIT 3   // Commit record closing a transaction
+
+struct journal_block_header {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t seq;
+    uint32_t count;      // Images in the transaction (DESC/COMMIT)
+};
+
+struct journal_stats {
+    uint64_t commits;       // Transactions written to the log
+    uint64_t logged;        // Block images written to the log
+    uint64_t absorbed;      // Metadata writes folded into an already logged image
+    uint64_t checkpoints;   // Times the log was written home and emptied
+};
+
+// Write-ahead log stacked on top of a block backend. Writes to blocks below
+// limit are collected in a running transaction and reach the disk as one
+// sequential log write per commit; their home locations are only written
+// at checkpoint time, when the log runs out of space.
+//
+// The owner commits explicitly, between operations: each operation runs
+// inside a handle (journal_begin()/journal_end(), nestable) and nothing is
+// committed while one is open, so an operation is replayed entirely or not
+// at all. Syncing the backend only syncs the device underneath. A
+// transaction never exceeds JOURNAL_TX_MAX blocks; the owner commits before
+// starting an operation that might not fit. A block that does not fit is
+// refused, and the journal stops committing rather than log a partial
+// operation, until the owner drops the running transaction with
+// journal_abort(). block_backend_write_now() commits the blocks it is given as a
+// transaction of their own, ahead of the running one; the caller makes
+// sure they are consistent without it.
+struct journal;
+
+// Prepare an empty log in [start, start + nblocks) of the current backend
+int journal_format(uint32_t start, uint32_t nblocks);
+
+// Replay committed transactions from the log; returns the number replayed.
+// Replay stops at a transaction logging a block that is not journaled
+// (at or above limit, or inside the log).
+int journal_recover(uint32_t start, uint32_t nblocks, uint32_t limit);
+
+// Stack a journal over the current backend and make it the active backend
+struct journal *journal_open(uint32_t start, uint32_t nblocks, uint32_t limit);
+
+// Open and close an operation handle
+void journal_begin(struct journal *j);
+void journal_end(struct journal *j);
+
+// Number of open handles, and of blocks in the running transaction
+uint32_t journal_handles(const struct journal *j);
+uint32_t journal_staged(const struct journal *j);
+
+// Whether a block was refused, and dropping the running transaction (with
+// no handle open) so that committing can resume
+int journal_overflowed(const struct journal *j);
+void journal_abort(struct journal *j);
+
+// Commit the running transaction (fails while a handle is open)
+int journal_commit(struct journal *j);
+
+// Write every committed block home and empty the log
+int journal_checkpoint(struct journal *j);
+
+// Commit, checkpoint and restore the underlying backend
+int journal_close(struct journal *j);
+
+void journal_get_stats(const struct journal *j, struct journal_stats *stats);
+
+#endif // JOURNAL_H
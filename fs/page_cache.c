@@ -0,0 +1,436 @@
+#include "page_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RADIX_SLOTS (1u << PAGE_RADIX_SHIFT)
+#define RADIX_MASK (RADIX_SLOTS - 1)
+
+struct radix_node {
+    void *slots[RADIX_SLOTS];       // Child nodes, or pages at the bottom level
+    uint32_t count;                 // Non-empty slots
+};
+
+static struct page_mapping *mappings[PAGE_CACHE_HASH_SIZE];
+static struct page *clock_hand = NULL;  // Reclaim ring, NULL when empty
+static struct page_cache_stats stats;
+
+static inline uint32_t mapping_hash(const struct page_cache_ops *ops, void *ctx, uint64_t ino) {
+    uint64_t key = (uint64_t)(uintptr_t)ops ^ ((uint64_t)(uintptr_t)ctx << 7) ^ (ino * 0x9E3779B97F4A7C15ULL);
+    return (uint32_t)(key >> 32 ^ key) % PAGE_CACHE_HASH_SIZE;
+}
+
+// Largest index a tree of the given height can hold
+static inline uint64_t radix_max(uint32_t height) {
+    return height * PAGE_RADIX_SHIFT >= 64 ? UINT64_MAX : (1ULL << (height * PAGE_RADIX_SHIFT)) - 1;
+}
+
+static struct page *radix_lookup(const struct page_mapping *m, uint64_t index) {
+    if (m->height == 0 || index > radix_max(m->height)) {
+        return NULL;
+    }
+    struct radix_node *node = m->root;
+    for (uint32_t level = m->height - 1; node != NULL; level--) {
+        void *slot = node->slots[(index >> (level * PAGE_RADIX_SHIFT)) & RADIX_MASK];
+        if (level == 0) {
+            return slot;
+        }
+        node = slot;
+    }
+    return NULL;
+}
+
+static int radix_insert(struct page_mapping *m, uint64_t index, struct page *page) {
+    // Grow from the top until the index fits
+    while (m->height == 0 || index > radix_max(m->height)) {
+        struct radix_node *top = calloc(1, sizeof(*top));
+        if (top == NULL) {
+            return -1;
+        }
+        if (m->root != NULL) {
+            top->slots[0] = m->root;
+            top->count = 1;
+        }
+        m->root = top;
+        m->height++;
+    }
+
+    struct radix_node *node = m->root;
+    for (uint32_t level = m->height - 1; level > 0; level--) {
+        void **slot = &node->slots[(index >> (level * PAGE_RADIX_SHIFT)) & RADIX_MASK];
+        if (*slot == NULL) {
+            *slot = calloc(1, sizeof(struct radix_node));
+            if (*slot == NULL) {
+                return -1;
+            }
+            node->count++;
+        }
+        node = *slot;
+    }
+    node->slots[index & RADIX_MASK] = page;
+    node->count++;
+    return 0;
+}
+
+// Remove an index, freeing the nodes it leaves empty
+static void radix_delete(struct page_mapping *m, uint64_t index) {
+    struct radix_node *path[(64 + PAGE_RADIX_SHIFT - 1) / PAGE_RADIX_SHIFT];
+    uint32_t slots[(64 + PAGE_RADIX_SHIFT - 1) / PAGE_RADIX_SHIFT];
+
+    if (m->height == 0 || index > radix_max(m->height)) {
+        return;
+    }
+    struct radix_node *node = m->root;
+    for (uint32_t level = m->height; level-- > 0;) {
+        if (node == NULL) {
+            return;
+        }
+        path[level] = node;
+        slots[level] = (uint32_t)(index >> (level * PAGE_RADIX_SHIFT)) & RADIX_MASK;
+        node = node->slots[slots[level]];
+    }
+    if (node == NULL) {
+        return;
+    }
+
+    for (uint32_t level = 0; level < m->height; level++) {
+        path[level]->slots[slots[level]] = NULL;
+        if (--path[level]->count != 0) {
+            return;
+        }
+        if (level + 1 == m->height) {
+            m->root = NULL;
+            m->height = 0;
+        }
+        free(path[level]);
+    }
+}
+
+// Visit the pages of a subtree in index order
+static int radix_walk(struct radix_node *node, uint32_t level, int (*fn)(struct page *page)) {
+    int status = 0;
+    for (uint32_t i = 0; i < RADIX_SLOTS && node != NULL; i++) {
+        if (node->slots[i] == NULL) {
+            continue;
+        }
+        int s = level == 0 ? fn(node->slots[i]) : radix_walk(node->slots[i], level - 1, fn);
+        if (s != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+static void clock_insert(struct page *page) {
+    if (clock_hand == NULL) {
+        page->clock_prev = page->clock_next = page;
+        clock_hand = page;
+        return;
+    }
+    // Just behind the hand: the last page the clock reaches
+    page->clock_next = clock_hand;
+    page->clock_prev = clock_hand->clock_prev;
+    clock_hand->clock_prev->clock_next = page;
+    clock_hand->clock_prev = page;
+}
+
+static void clock_remove(struct page *page) {
+    if (page->clock_next == page) {
+        clock_hand = NULL;
+    } else {
+        if (clock_hand == page) {
+            clock_hand = page->clock_next;
+        }
+        page->clock_prev->clock_next = page->clock_next;
+        page->clock_next->clock_prev = page->clock_prev;
+    }
+    page->clock_prev = page->clock_next = NULL;
+}
+
+static void mapping_free_if_unused(struct page_mapping *m) {
+    if (m->refs != 0 || m->nrpages != 0) {
+        return;
+    }
+    struct page_mapping **link = &mappings[mapping_hash(m->ops, m->ctx, m->ino)];
+    while (*link != NULL) {
+        if (*link == m) {
+            *link = m->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    free(m);
+}
+
+static int page_write(struct page *page) {
+    struct page_mapping *m = page->mapping;
+    uint64_t start = page->index * PAGE_SIZE;
+
+    if (!(page->flags & PG_DIRTY)) {
+        return 0;
+    }
+    if (start < m->size) {
+        size_t len = m->size - start < PAGE_SIZE ? (size_t)(m->size - start) : PAGE_SIZE;
+        if (m->ops->writepage == NULL || m->ops->writepage(m->ctx, m->ino, page->index, page->data, len) != 0) {
+            return -1;
+        }
+        stats.writebacks++;
+    }
+    page->flags &= ~PG_DIRTY;
+    m->ndirty--;
+    stats.dirty--;
+    return 0;
+}
+
+static void page_free(struct page *page) {
+    struct page_mapping *m = page->mapping;
+    if (page->flags & PG_DIRTY) {
+        m->ndirty--;
+        stats.dirty--;
+    }
+    radix_delete(m, page->index);
+    clock_remove(page);
+    m->nrpages--;
+    stats.pages--;
+    free(page->data);
+    free(page);
+}
+
+// CLOCK reclaim down to the budget: referenced pages get a second chance,
+// dirty ones are written back before they are dropped
+static void page_reclaim(void) {
+    for (uint32_t scanned = 0; stats.pages >= PAGE_CACHE_MAX_PAGES && scanned < 2 * stats.pages; scanned++) {
+        struct page *page = clock_hand;
+        clock_hand = page->clock_next;
+
+        if (page->flags & PG_REFERENCED) {
+            page->flags &= ~PG_REFERENCED;
+            continue;
+        }
+        if (page_write(page) != 0) {
+            continue;
+        }
+        struct page_mapping *m = page->mapping;
+        page_free(page);
+        stats.reclaims++;
+        mapping_free_if_unused(m);
+    }
+}
+
+// Find or add a page; a new page is filled from the file when fill is set
+// and zeroed otherwise (the caller overwrites it)
+static struct page *page_get(struct page_mapping *m, uint64_t index, int fill) {
+    struct page *page = radix_lookup(m, index);
+    if (page != NULL) {
+        stats.hits++;
+        page->flags |= PG_REFERENCED;
+        return page;
+    }
+
+    page_reclaim();
+    page = calloc(1, sizeof(*page));
+    if (page == NULL) {
+        return NULL;
+    }
+    page->data = malloc(PAGE_SIZE);
+    if (page->data == NULL) {
+        free(page);
+        return NULL;
+    }
+    if (fill) {
+        stats.misses++;
+        if (m->ops->readpage(m->ctx, m->ino, index, page->data) != 0) {
+            free(page->data);
+            free(page);
+            return NULL;
+        }
+    } else {
+        memset(page->data, 0, PAGE_SIZE);
+    }
+    if (radix_insert(m, index, page) != 0) {
+        free(page->data);
+        free(page);
+        return NULL;
+    }
+
+    page->mapping = m;
+    page->index = index;
+    page->flags = PG_UPTODATE | PG_REFERENCED;
+    clock_insert(page);
+    m->nrpages++;
+    stats.pages++;
+    return page;
+}
+
+struct page_mapping *page_cache_find(const struct page_cache_ops *ops, void *ctx, uint64_t ino) {
+    struct page_mapping *m = mappings[mapping_hash(ops, ctx, ino)];
+    while (m != NULL && (m->ops != ops || m->ctx != ctx || m->ino != ino)) {
+        m = m->hash_next;
+    }
+    return m;
+}
+
+struct page_mapping *page_cache_get(const struct page_cache_ops *ops, void *ctx, uint64_t ino, uint64_t size) {
+    uint32_t slot = mapping_hash(ops, ctx, ino);
+    struct page_mapping *m = page_cache_find(ops, ctx, ino);
+
+    if (m == NULL) {
+        m = calloc(1, sizeof(*m));
+        if (m == NULL) {
+            return NULL;
+        }
+        m->ops = ops;
+        m->ctx = ctx;
+        m->ino = ino;
+        m->size = size;
+        m->hash_next = mappings[slot];
+        mappings[slot] = m;
+    }
+    m->refs++;
+    return m;
+}
+
+void page_cache_put(struct page_mapping *mapping) {
+    if (mapping != NULL && mapping->refs > 0) {
+        mapping->refs--;
+        mapping_free_if_unused(mapping);
+    }
+}
+
+long page_cache_read(struct page_mapping *m, uint64_t offset, void *buffer, size_t len) {
+    uint8_t *out = buffer;
+
+    if (offset >= m->size) {
+        return 0;
+    }
+    if (len > m->size - offset) {
+        len = (size_t)(m->size - offset);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        size_t in_page = (size_t)(pos % PAGE_SIZE);
+        size_t chunk = PAGE_SIZE - in_page < len - done ? PAGE_SIZE - in_page : len - done;
+        struct page *page = page_get(m, pos / PAGE_SIZE, 1);
+        if (page == NULL) {
+            return done > 0 ? (long)done : -1;
+        }
+        memcpy(out + done, page->data + in_page, chunk);
+        done += chunk;
+    }
+    return (long)done;
+}
+
+long page_cache_write(struct page_mapping *m, uint64_t offset, const void *buffer, size_t len) {
+    const uint8_t *in = buffer;
+
+    if (m->ops->writepage == NULL) {
+        return -1; // Read-only filesystem
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint64_t index = pos / PAGE_SIZE;
+        size_t in_page = (size_t)(pos % PAGE_SIZE);
+        size_t chunk = PAGE_SIZE - in_page < len - done ? PAGE_SIZE - in_page : len - done;
+
+        // Only a partial page that holds file data needs reading first
+        int fill = chunk != PAGE_SIZE && index * PAGE_SIZE < m->size;
+        struct page *page = page_get(m, index, fill);
+        if (page == NULL) {
+            break;
+        }
+        memcpy(page->data + in_page, in + done, chunk);
+        if (!(page->flags & PG_DIRTY)) {
+            page->flags |= PG_DIRTY;
+            m->ndirty++;
+            stats.dirty++;
+        }
+        done += chunk;
+        if (pos + chunk > m->size) {
+            m->size = pos + chunk;
+        }
+    }
+    return done > 0 || len == 0 ? (long)done : -1;
+}
+
+static int mapping_writeback(struct page_mapping *m) {
+    if (m->ndirty == 0) {
+        return 0;
+    }
+    return radix_walk(m->root, m->height - 1, page_write);
+}
+
+int page_cache_writeback(struct page_mapping *mapping) {
+    if (mapping != NULL) {
+        return mapping_writeback(mapping);
+    }
+
+    int status = 0;
+    for (int i = 0; i < PAGE_CACHE_HASH_SIZE; i++) {
+        for (struct page_mapping *m = mappings[i]; m != NULL; m = m->hash_next) {
+            if (mapping_writeback(m) != 0) {
+                status = -1;
+            }
+        }
+    }
+    return status;
+}
+
+// Drop the clean pages of a mapping, found on the reclaim ring
+static void mapping_drop_clean(struct page_mapping *m) {
+    struct page *page = clock_hand;
+    for (uint32_t n = stats.pages; n > 0 && m->nrpages > m->ndirty; n--) {
+        struct page *next = page->clock_next;
+        if (page->mapping == m && !(page->flags & PG_DIRTY)) {
+            page_free(page);
+        }
+        page = next;
+    }
+}
+
+int page_cache_invalidate(struct page_mapping *m) {
+    if (mapping_writeback(m) != 0) {
+        // Keep the dirty pages, whose data exists nowhere else
+        mapping_drop_clean(m);
+        return -1;
+    }
+
+    // Dropping the last page frees the tree, so restart from the lowest index
+    while (m->nrpages > 0) {
+        struct radix_node *node = m->root;
+        for (uint32_t level = m->height - 1; level > 0; level--) {
+            uint32_t i = 0;
+            while (node->slots[i] == NULL) {
+                i++;
+            }
+            node = node->slots[i];
+        }
+        uint32_t i = 0;
+        while (node->slots[i] == NULL) {
+            i++;
+        }
+        page_free(node->slots[i]);
+    }
+    mapping_free_if_unused(m);
+    return 0;
+}
+
+uint32_t page_cache_drop_clean(struct page_mapping *m) {
+    mapping_drop_clean(m);
+    uint32_t ndirty = m->ndirty;
+    mapping_free_if_unused(m);
+    return ndirty;
+}
+
+void page_cache_resize(const struct page_cache_ops *ops, void *ctx, uint64_t ino, uint64_t size) {
+    struct page_mapping *m = page_cache_find(ops, ctx, ino);
+    if (m != NULL) {
+        m->size = size;
+    }
+}
+
+void page_cache_get_stats(struct page_cache_stats *out) {
+    *out = stats;
+}
@@ -0,0 +1,93 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "block_io.h"
+
+#define PAGE_SIZE BLOCK_SIZE
+#define PAGE_CACHE_MAX_PAGES 2048   // Reclaim clean pages above this budget
+#define PAGE_CACHE_HASH_SIZE 256    // Mapping lookup hash
+#define PAGE_RADIX_SHIFT 6          // 64 slots per radix tree node
+
+// Page state flags
+#define PG_UPTODATE   0x01  // Data matches (or supersedes) the file
+#define PG_DIRTY      0x02  // Must be written back before reclaim
+#define PG_REFERENCED 0x04  // CLOCK reference bit
+
+// How a filesystem moves one page of a file, addressed by inode number.
+// readpage zeroes whatever lies past the end of the file; writepage
+// stores the first len bytes and extends the file if needed (NULL for
+// read-only filesystems).
+struct page_cache_ops {
+    int (*readpage)(void *ctx, uint64_t ino, uint64_t index, void *data);
+    int (*writepage)(void *ctx, uint64_t ino, uint64_t index, const void *data, size_t len);
+};
+
+struct page_mapping;
+
+struct page {
+    struct page_mapping *mapping;
+    uint64_t index;                 // Page offset in the file
+    uint16_t flags;                 // PG_* flags
+    struct page *clock_prev;        // Ring walked by the reclaim clock
+    struct page *clock_next;
+    uint8_t *data;
+};
+
+// Cached pages of one file, indexed by page offset in a radix tree
+struct page_mapping {
+    const struct page_cache_ops *ops;
+    void *ctx;                      // Filesystem instance passed to ops
+    uint64_t ino;
+    uint64_t size;                  // File size as seen through the cache
+    void *root;                     // Radix tree node, or the page at height 0
+    uint32_t height;
+    uint32_t nrpages;
+    uint32_t ndirty;
+    uint32_t refs;                  // Openers; pages outlive them until reclaim
+    struct page_mapping *hash_next;
+};
+
+struct page_cache_stats {
+    uint64_t hits;          // Pages found in the cache
+    uint64_t misses;        // Pages filled through readpage
+    uint64_t writebacks;    // Dirty pages written through writepage
+    uint64_t reclaims;      // Pages dropped to stay within the budget
+    uint32_t pages;         // Pages currently cached
+    uint32_t dirty;         // Pages waiting for writeback
+};
+
+// Find or create the mapping of a file and take a reference on it. size
+// is the file size as the filesystem reports it, used for a new mapping.
+struct page_mapping *page_cache_get(const struct page_cache_ops *ops, void *ctx, uint64_t ino, uint64_t size);
+
+// Find the mapping of a file without taking a reference (NULL when the
+// file has neither cached pages nor openers)
+struct page_mapping *page_cache_find(const struct page_cache_ops *ops, void *ctx, uint64_t ino);
+
+// Drop a reference; the cached pages stay for the next opener
+void page_cache_put(struct page_mapping *mapping);
+
+// Copy file data through the cache; return the byte count or -1
+long page_cache_read(struct page_mapping *mapping, uint64_t offset, void *buffer, size_t len);
+long page_cache_write(struct page_mapping *mapping, uint64_t offset, const void *buffer, size_t len);
+
+// Write dirty pages back in page order (NULL: every mapping)
+int page_cache_writeback(struct page_mapping *mapping);
+
+// Write back and drop the cached pages of a file, e.g. before it is changed
+// around the cache; a mapping without openers goes with its pages. If
+// writeback fails, only the clean pages are dropped and -1 is returned.
+int page_cache_invalidate(struct page_mapping *mapping);
+
+// Drop only the clean cached pages of a file; returns the number of dirty
+// pages left (a mapping without openers goes once it is empty)
+uint32_t page_cache_drop_clean(struct page_mapping *mapping);
+
+// Tell the cache that a file's size changed around it
+void page_cache_resize(const struct page_cache_ops *ops, void *ctx, uint64_t ino, uint64_t size);
+
+void page_cache_get_stats(struct page_cache_stats *stats);
+
+#endif // PAGE_CACHE_H
@@ -0,0 +1,48 @@
+#define _GNU_SOURCE
+#include "percpu_counter.h"
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static inline unsigned current_cpu(void) {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return (unsigned)cpu % PERCPU_MAX_CPUS;
+    }
+#endif
+    return 0;
+}
+
+void percpu_counter_init(struct percpu_counter *pc, int64_t value) {
+    memset(pc, 0, sizeof(*pc));
+    pc->count = value;
+}
+
+void percpu_counter_add(struct percpu_counter *pc, int32_t delta) {
+    // Atomic, since a thread can migrate between reading its CPU number and
+    // the update; the line is only shared when that happens
+    int32_t *local = &pc->cpu[current_cpu()].delta;
+    int32_t now = __atomic_add_fetch(local, delta, __ATOMIC_RELAXED);
+
+    if (now >= PERCPU_COUNTER_BATCH || now <= -PERCPU_COUNTER_BATCH) {
+        int32_t folded = __atomic_exchange_n(local, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pc->count, folded, __ATOMIC_RELAXED);
+    }
+}
+
+int64_t percpu_counter_read(const struct percpu_counter *pc) {
+    return __atomic_load_n(&pc->count, __ATOMIC_RELAXED);
+}
+
+int64_t percpu_counter_sum(struct percpu_counter *pc) {
+    for (int i = 0; i < PERCPU_MAX_CPUS; i++) {
+        int32_t folded = __atomic_exchange_n(&pc->cpu[i].delta, 0, __ATOMIC_RELAXED);
+        if (folded != 0) {
+            __atomic_add_fetch(&pc->count, folded, __ATOMIC_RELAXED);
+        }
+    }
+    return __atomic_load_n(&pc->count, __ATOMIC_RELAXED);
+}
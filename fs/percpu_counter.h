@@ -0,0 +1,29 @@
+#ifndef PERCPU_COUNTER_H
+#define PERCPU_COUNTER_H
+
+#include <stdint.h>
+
+#define PERCPU_MAX_CPUS 64
+#define PERCPU_COUNTER_BATCH 32   // Local drift allowed before folding into the total
+
+// Counter that each CPU updates in its own cache line. Updates stay local
+// until they drift by PERCPU_COUNTER_BATCH, so percpu_counter_read() is off
+// by at most PERCPU_MAX_CPUS * PERCPU_COUNTER_BATCH; percpu_counter_sum()
+// is exact.
+struct percpu_counter {
+    int64_t count;   // Folded total
+    struct {
+        int32_t delta;
+    } __attribute__((aligned(64))) cpu[PERCPU_MAX_CPUS];
+};
+
+void percpu_counter_init(struct percpu_counter *pc, int64_t value);
+void percpu_counter_add(struct percpu_counter *pc, int32_t delta);
+
+// Approximate value without touching the per-CPU lines
+int64_t percpu_counter_read(const struct percpu_counter *pc);
+
+// Exact value; folds every per-CPU delta into the total
+int64_t percpu_counter_sum(struct percpu_counter *pc);
+
+#endif // PERCPU_COUNTER_H
@@ -0,0 +1,490 @@
+#include "ramfs.h"
+#include "dcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nodes are found by inode number for read_inode/write_inode
+static struct ramfs_node **nodes = NULL;
+static uint32_t nodes_cap = 0;
+static uint32_t ino_hint = RAMFS_ROOT_INO;
+static struct ramfs_node *root = NULL;
+static struct ramfs_stats stats;
+
+static int ino_alloc(struct ramfs_node *node) {
+    uint32_t ino = ino_hint;
+    while (ino < nodes_cap && nodes[ino] != NULL) {
+        ino++;
+    }
+    if (ino >= nodes_cap) {
+        uint32_t cap = nodes_cap != 0 ? nodes_cap * 2 : 64;
+        struct ramfs_node **grown = realloc(nodes, cap * sizeof(*nodes));
+        if (grown == NULL) {
+            return -1;
+        }
+        memset(grown + nodes_cap, 0, (cap - nodes_cap) * sizeof(*nodes));
+        nodes = grown;
+        nodes_cap = cap;
+    }
+    nodes[ino] = node;
+    node->ino = ino;
+    ino_hint = ino + 1;
+    return 0;
+}
+
+static struct ramfs_node *node_alloc(uint16_t type) {
+    struct ramfs_node *node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->type = type;
+    if (type == RAMFS_DIR) {
+        node->buckets = calloc(RAMFS_DIR_BUCKETS, sizeof(*node->buckets));
+        node->nbuckets = RAMFS_DIR_BUCKETS;
+        if (node->buckets == NULL) {
+            free(node);
+            return NULL;
+        }
+    }
+    if (ino_alloc(node) != 0) {
+        free(node->buckets);
+        free(node);
+        return NULL;
+    }
+    stats.nodes++;
+    return node;
+}
+
+static void node_free_pages(struct ramfs_node *node, uint32_t from) {
+    for (uint32_t i = from; i < node->npages; i++) {
+        if (node->pages[i] != NULL) {
+            free(node->pages[i]);
+            node->pages[i] = NULL;
+            stats.pages--;
+        }
+    }
+}
+
+static void node_free(struct ramfs_node *node) {
+    if (node->type == RAMFS_DIR) {
+        free(node->buckets);
+    } else {
+        node_free_pages(node, 0);
+        free(node->pages);
+    }
+    if (node->name != NULL) {
+        iname_put(node->name);
+    }
+    nodes[node->ino] = NULL;
+    if (node->ino < ino_hint) {
+        ino_hint = node->ino;
+    }
+    stats.nodes--;
+    free(node);
+}
+
+static void tree_free(struct ramfs_node *dir) {
+    for (uint32_t b = 0; b < dir->nbuckets; b++) {
+        struct ramfs_node *node = dir->buckets[b];
+        while (node != NULL) {
+            struct ramfs_node *next = node->hash_next;
+            if (node->type == RAMFS_DIR) {
+                tree_free(node);
+            } else {
+                node_free(node);
+            }
+            node = next;
+        }
+    }
+    node_free(dir);
+}
+
+static struct ramfs_node *dir_find(const struct ramfs_node *dir, const char *name, size_t len, uint32_t hash) {
+    struct ramfs_node *node = dir->buckets[hash & (dir->nbuckets - 1)];
+    while (node != NULL) {
+        const struct iname *n = node->name;
+        if (n->hash == hash && n->len == len && memcmp(n->str, name, len) == 0) {
+            return node;
+        }
+        node = node->hash_next;
+    }
+    return NULL;
+}
+
+// Double the table once it averages one entry per bucket
+static void dir_grow(struct ramfs_node *dir) {
+    uint32_t nbuckets = dir->nbuckets * 2;
+    struct ramfs_node **buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        return; // Keep the longer chains
+    }
+    for (uint32_t b = 0; b < dir->nbuckets; b++) {
+        struct ramfs_node *node = dir->buckets[b];
+        while (node != NULL) {
+            struct ramfs_node *next = node->hash_next;
+            uint32_t slot = node->name->hash & (nbuckets - 1);
+            node->hash_next = buckets[slot];
+            buckets[slot] = node;
+            node = next;
+        }
+    }
+    free(dir->buckets);
+    dir->buckets = buckets;
+    dir->nbuckets = nbuckets;
+    stats.rehashes++;
+}
+
+static void dir_insert(struct ramfs_node *dir, struct ramfs_node *node) {
+    if (dir->nentries >= dir->nbuckets) {
+        dir_grow(dir);
+    }
+    uint32_t slot = node->name->hash & (dir->nbuckets - 1);
+    node->hash_next = dir->buckets[slot];
+    dir->buckets[slot] = node;
+    node->parent = dir;
+    dir->nentries++;
+}
+
+static void dir_remove(struct ramfs_node *dir, struct ramfs_node *node) {
+    struct ramfs_node **link = &dir->buckets[node->name->hash & (dir->nbuckets - 1)];
+    while (*link != NULL) {
+        if (*link == node) {
+            *link = node->hash_next;
+            dir->nentries--;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    node->hash_next = NULL;
+}
+
+// Resolve a path. With last != NULL the final component is not looked up:
+// its parent directory is returned and the component is stored in last.
+static struct ramfs_node *walk(const char *path, const char **last, size_t *last_len) {
+    struct ramfs_node *node = root;
+
+    if (root == NULL || path == NULL) {
+        return NULL;
+    }
+    while (node != NULL) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if (len == 0) {
+            return last != NULL ? NULL : node; // No final component to create
+        }
+
+        const char *rest = path + len;
+        while (*rest == '/') {
+            rest++;
+        }
+        if (last != NULL && *rest == '\0') {
+            *last = path;
+            *last_len = len;
+            return node;
+        }
+
+        if (node->type != RAMFS_DIR || len > VFS_NAME_MAX) {
+            return NULL;
+        }
+        stats.lookups++;
+        if (len == 1 && path[0] == '.') {
+            // Stay
+        } else if (len == 2 && path[0] == '.' && path[1] == '.') {
+            node = node->parent != NULL ? node->parent : node;
+        } else {
+            node = dir_find(node, path, len, dcache_hash_name(path, len));
+        }
+        path = rest;
+    }
+    return NULL;
+}
+
+static struct ramfs_node *ramfs_new(const char *path, uint16_t type) {
+    const char *name;
+    size_t len;
+    struct ramfs_node *dir = walk(path, &name, &len);
+
+    if (dir == NULL || dir->type != RAMFS_DIR || len > VFS_NAME_MAX ||
+        (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.')) {
+        return NULL;
+    }
+    uint32_t hash = dcache_hash_name(name, len);
+    if (dir_find(dir, name, len, hash) != NULL) {
+        return NULL; // Already exists
+    }
+
+    struct ramfs_node *node = node_alloc(type);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->name = iname_get(name, len, hash);
+    if (node->name == NULL) {
+        node_free(node);
+        return NULL;
+    }
+    dir_insert(dir, node);
+    return node;
+}
+
+struct ramfs_node *ramfs_lookup(const char *path) {
+    return walk(path, NULL, NULL);
+}
+
+struct ramfs_node *ramfs_mkdir(const char *path) {
+    return ramfs_new(path, RAMFS_DIR);
+}
+
+struct ramfs_node *ramfs_create(const char *path) {
+    return ramfs_new(path, RAMFS_FILE);
+}
+
+struct ramfs_node *ramfs_mknod(const char *path, const void *config, size_t len) {
+    struct ramfs_node *node = ramfs_new(path, RAMFS_DEV);
+    if (node != NULL && len > 0 && ramfs_write(node, 0, config, len) != (long)len) {
+        ramfs_unlink(path);
+        return NULL;
+    }
+    return node;
+}
+
+int ramfs_unlink(const char *path) {
+    struct ramfs_node *node = ramfs_lookup(path);
+    if (node == NULL || node == root || (node->type == RAMFS_DIR && node->nentries != 0)) {
+        return -1;
+    }
+    dir_remove(node->parent, node);
+    node_free(node);
+    return 0;
+}
+
+// Make room for page index in the page array
+static int pages_reserve(struct ramfs_node *node, uint32_t npages) {
+    if (npages <= node->npages) {
+        return 0;
+    }
+    if (npages > RAMFS_MAX_PAGES) {
+        return -1;
+    }
+    uint64_t cap = node->npages != 0 ? node->npages : 4;
+    while (cap < npages) {
+        cap *= 2;
+    }
+    if (cap > RAMFS_MAX_PAGES) {
+        cap = RAMFS_MAX_PAGES;
+    }
+    uint8_t **pages = realloc(node->pages, (size_t)cap * sizeof(*pages));
+    if (pages == NULL) {
+        return -1;
+    }
+    memset(pages + node->npages, 0, (cap - node->npages) * sizeof(*pages));
+    node->pages = pages;
+    node->npages = (uint32_t)cap;
+    return 0;
+}
+
+long ramfs_read(struct ramfs_node *node, uint64_t offset, void *buffer, size_t len) {
+    uint8_t *out = buffer;
+
+    if (node == NULL || node->type == RAMFS_DIR) {
+        return -1;
+    }
+    if (offset >= node->size) {
+        return 0;
+    }
+    if (len > node->size - offset) {
+        len = (size_t)(node->size - offset);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos / RAMFS_PAGE_SIZE);
+        size_t in_page = (size_t)(pos % RAMFS_PAGE_SIZE);
+        size_t chunk = RAMFS_PAGE_SIZE - in_page;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (index < node->npages && node->pages[index] != NULL) {
+            memcpy(out + done, node->pages[index] + in_page, chunk);
+        } else {
+            memset(out + done, 0, chunk); // Hole
+        }
+        done += chunk;
+    }
+    return (long)len;
+}
+
+static long node_write(struct ramfs_node *node, uint64_t offset, const void *buffer, size_t len) {
+    const uint8_t *in = buffer;
+
+    if (len == 0) {
+        return 0;
+    }
+    if (offset > UINT64_MAX - len || (offset + len - 1) / RAMFS_PAGE_SIZE >= RAMFS_MAX_PAGES ||
+        pages_reserve(node, (uint32_t)((offset + len - 1) / RAMFS_PAGE_SIZE) + 1) != 0) {
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t index = (uint32_t)(pos / RAMFS_PAGE_SIZE);
+        size_t in_page = (size_t)(pos % RAMFS_PAGE_SIZE);
+        size_t chunk = RAMFS_PAGE_SIZE - in_page;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (node->pages[index] == NULL) {
+            node->pages[index] = malloc(RAMFS_PAGE_SIZE);
+            if (node->pages[index] == NULL) {
+                break;
+            }
+            if (chunk != RAMFS_PAGE_SIZE) {
+                memset(node->pages[index], 0, RAMFS_PAGE_SIZE);
+            }
+            stats.pages++;
+        }
+        memcpy(node->pages[index] + in_page, in + done, chunk);
+        done += chunk;
+    }
+
+    if (offset + done > node->size) {
+        node->size = offset + done;
+    }
+    return done > 0 ? (long)done : -1;
+}
+
+// Cached pages of a file would hide a change made around the cache, and
+// dirty ones would later be written over it
+static int node_uncache(struct ramfs_node *node) {
+    struct page_mapping *m = page_cache_find(&ramfs_page_ops, NULL, node->ino);
+    return m != NULL ? page_cache_invalidate(m) : 0;
+}
+
+long ramfs_write(struct ramfs_node *node, uint64_t offset, const void *buffer, size_t len) {
+    if (node == NULL || node->type == RAMFS_DIR || node_uncache(node) != 0) {
+        return -1;
+    }
+    long done = node_write(node, offset, buffer, len);
+    if (done > 0) {
+        page_cache_resize(&ramfs_page_ops, NULL, node->ino, node->size);
+    }
+    return done;
+}
+
+int ramfs_truncate(struct ramfs_node *node, uint64_t size) {
+    if (node == NULL || node->type == RAMFS_DIR || size > (uint64_t)RAMFS_MAX_PAGES * RAMFS_PAGE_SIZE ||
+        node_uncache(node) != 0) {
+        return -1;
+    }
+    if (size < node->size) {
+        uint32_t keep = (uint32_t)((size + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE);
+        node_free_pages(node, keep);
+        // Bytes past the new end must read as zeros if the file grows again
+        size_t tail = (size_t)(size % RAMFS_PAGE_SIZE);
+        if (tail != 0 && keep - 1 < node->npages && node->pages[keep - 1] != NULL) {
+            memset(node->pages[keep - 1] + tail, 0, RAMFS_PAGE_SIZE - tail);
+        }
+    }
+    node->size = size;
+    page_cache_resize(&ramfs_page_ops, NULL, node->ino, size);
+    return 0;
+}
+
+int ramfs_readdir(struct ramfs_node *dir, int (*fn)(struct ramfs_node *node, void *arg), void *arg) {
+    if (dir == NULL || dir->type != RAMFS_DIR) {
+        return -1;
+    }
+    for (uint32_t b = 0; b < dir->nbuckets; b++) {
+        for (struct ramfs_node *node = dir->buckets[b]; node != NULL; node = node->hash_next) {
+            int status = fn(node, arg);
+            if (status != 0) {
+                return status;
+            }
+        }
+    }
+    return 0;
+}
+
+void ramfs_get_stats(struct ramfs_stats *out) {
+    *out = stats;
+}
+
+static int ramfs_mount(const char *device) {
+    (void)device;
+    if (root != NULL) {
+        printf("ramfs is already mounted\n");
+        return -1;
+    }
+    ino_hint = RAMFS_ROOT_INO;
+    root = node_alloc(RAMFS_DIR);
+    return root != NULL ? 0 : -1;
+}
+
+static int ramfs_unmount(void) {
+    if (root == NULL) {
+        return -1;
+    }
+    tree_free(root);
+    root = NULL;
+    free(nodes);
+    nodes = NULL;
+    nodes_cap = 0;
+    return 0;
+}
+
+static struct ramfs_node *node_by_ino(unsigned long ino) {
+    return ino < nodes_cap ? nodes[ino] : NULL;
+}
+
+static int ramfs_read_inode(inode_t *inode) {
+    struct ramfs_node *node = node_by_ino(inode->ino);
+    if (node == NULL) {
+        return -1;
+    }
+    inode->is_directory = node->type == RAMFS_DIR;
+    return 0;
+}
+
+// Everything already lives in memory: there is nothing to write back
+static int ramfs_write_inode(inode_t *inode) {
+    return node_by_ino(inode->ino) != NULL ? 0 : -1;
+}
+
+static int ramfs_sync(void) {
+    return 0;
+}
+
+static int ramfs_readpage(void *ctx, uint64_t ino, uint64_t index, void *data) {
+    (void)ctx;
+    long n = ramfs_read(node_by_ino((unsigned long)ino), index * PAGE_SIZE, data, PAGE_SIZE);
+    if (n < 0) {
+        return -1;
+    }
+    memset((uint8_t *)data + n, 0, PAGE_SIZE - (size_t)n);
+    return 0;
+}
+
+static int ramfs_writepage(void *ctx, uint64_t ino, uint64_t index, const void *data, size_t len) {
+    (void)ctx;
+    struct ramfs_node *node = node_by_ino((unsigned long)ino);
+    if (node == NULL || node->type == RAMFS_DIR) {
+        return -1;
+    }
+    return node_write(node, index * PAGE_SIZE, data, len) == (long)len ? 0 : -1;
+}
+
+const struct page_cache_ops ramfs_page_ops = {
+    .readpage = ramfs_readpage,
+    .writepage = ramfs_writepage,
+};
+
+fs_operations_t ramfs_ops = {
+    .mount = ramfs_mount,
+    .unmount = ramfs_unmount,
+    .read_inode = ramfs_read_inode,
+    .write_inode = ramfs_write_inode,
+    .sync = ramfs_sync,
+};
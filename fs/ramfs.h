@@ -0,0 +1,75 @@
+#ifndef RAMFS_H
+#define RAMFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fs.h"
+#include "page_cache.h"
+
+#define RAMFS_PAGE_SIZE 4096
+#define RAMFS_DIR_BUCKETS 8      // Initial directory hash size, doubled as it fills
+#define RAMFS_ROOT_INO 1
+#define RAMFS_MAX_PAGES (1u << 20)  // Largest file: 4 GiB
+
+// Node types
+#define RAMFS_DIR  1
+#define RAMFS_FILE 2
+#define RAMFS_DEV  3   // Device node; its data holds the driver configuration
+
+// In-memory file, directory or device node
+struct ramfs_node {
+    uint32_t ino;
+    uint16_t type;                    // RAMFS_*
+    const struct iname *name;         // Interned, NULL for the root
+    struct ramfs_node *parent;
+    struct ramfs_node *hash_next;     // Next entry in the parent's bucket
+    union {
+        struct {                      // RAMFS_DIR
+            struct ramfs_node **buckets;
+            uint32_t nbuckets;        // Power of two
+            uint32_t nentries;
+        };
+        struct {                      // RAMFS_FILE, RAMFS_DEV
+            uint8_t **pages;          // NULL pages are holes
+            uint32_t npages;
+            uint64_t size;
+        };
+    };
+};
+
+struct ramfs_stats {
+    uint32_t nodes;       // Live nodes, the root included
+    uint32_t pages;       // Data pages allocated
+    uint64_t lookups;     // Path components resolved
+    uint64_t rehashes;    // Directory tables grown
+};
+
+// Operations for vfs_mount(); the device name is ignored
+extern fs_operations_t ramfs_ops;
+
+// Paths are relative to the ramfs root; a leading '/' is optional
+struct ramfs_node *ramfs_lookup(const char *path);
+struct ramfs_node *ramfs_mkdir(const char *path);
+struct ramfs_node *ramfs_create(const char *path);
+struct ramfs_node *ramfs_mknod(const char *path, const void *config, size_t len);
+
+// Remove a file, device node or empty directory
+int ramfs_unlink(const char *path);
+
+// File data; reads stop at the end of the file and return the byte count.
+// Writes and truncation beyond RAMFS_MAX_PAGES pages fail.
+long ramfs_read(struct ramfs_node *node, uint64_t offset, void *buffer, size_t len);
+long ramfs_write(struct ramfs_node *node, uint64_t offset, const void *buffer, size_t len);
+int ramfs_truncate(struct ramfs_node *node, uint64_t size);
+
+// Call fn for each entry of a directory until it returns non-zero
+int ramfs_readdir(struct ramfs_node *dir, int (*fn)(struct ramfs_node *node, void *arg), void *arg);
+
+void ramfs_get_stats(struct ramfs_stats *stats);
+
+// Page cache access to ramfs files by inode number, with a NULL context.
+// ramfs_write() and ramfs_truncate() write back and drop the file's cached
+// pages first.
+extern const struct page_cache_ops ramfs_page_ops;
+
+#endif // RAMFS_H
@@ -0,0 +1,75 @@
+#include "readahead.h"
+#include <string.h>
+
+static struct readahead_stats stats;
+
+void readahead_init(struct readahead *ra) {
+    ra->prev = UINT32_MAX;
+    ra->start = 0;
+    ra->size = 0;
+    ra->marker = UINT32_MAX;
+}
+
+static void readahead_submit(struct readahead *ra, uint32_t start, uint32_t size) {
+    ra->start = start;
+    ra->size = size;
+    // Prefetch the following window as soon as this one starts being used,
+    // so the reader never waits on the device while the stream holds
+    ra->marker = start;
+    stats.windows++;
+    stats.issued += bcache_prefetch(start, size);
+}
+
+static void readahead_update(struct readahead *ra, uint32_t block) {
+    uint32_t prev = ra->prev;
+    ra->prev = block;
+
+    if (prev == UINT32_MAX || block == prev) {
+        return; // First read of the stream, or a re-read
+    }
+
+    if (block != prev + 1) {
+        // Random access: back off and forget the window
+        stats.random++;
+        ra->size = ra->size / 2 < READAHEAD_MIN ? READAHEAD_MIN : ra->size / 2;
+        ra->marker = UINT32_MAX;
+        return;
+    }
+
+    stats.sequential++;
+    uint32_t end = ra->start + ra->size;
+    if (ra->marker == UINT32_MAX || block >= end) {
+        // Stream (re)started: open a window right after this block
+        readahead_submit(ra, block + 1, ra->size < READAHEAD_MIN ? READAHEAD_MIN : ra->size);
+    } else if (block == ra->marker) {
+        // The reader caught up with the window: ramp up and go further ahead
+        uint32_t size = ra->size * 2 > READAHEAD_MAX ? READAHEAD_MAX : ra->size * 2;
+        readahead_submit(ra, end, size);
+    }
+}
+
+struct buffer_head *readahead_bread(struct readahead *ra, uint32_t block) {
+    readahead_update(ra, block);
+    return bread(block);
+}
+
+int readahead_read(struct readahead *ra, uint32_t block, uint32_t count, void *buffer) {
+    uint8_t *out = buffer;
+    for (uint32_t i = 0; i < count; i++) {
+        struct buffer_head *bh = readahead_bread(ra, block + i);
+        if (bh == NULL) {
+            return -1;
+        }
+        memcpy(out + (size_t)i * BLOCK_SIZE, bh->data, BLOCK_SIZE);
+        brelse(bh);
+    }
+    return 0;
+}
+
+void readahead_get_stats(struct readahead_stats *out) {
+    struct bcache_stats cache;
+    bcache_get_stats(&cache);
+    *out = stats;
+    out->hits = cache.ra_hits;
+    out->wasted = cache.ra_wasted;
+}
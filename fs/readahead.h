@@ -0,0 +1,38 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include "bcache.h"
+
+// Prefetch window bounds (in blocks)
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 64
+
+// Per-stream readahead state; one per open file or sequential reader
+struct readahead {
+    uint32_t prev;      // Last block read through the stream
+    uint32_t start;     // Current window: [start, start + size)
+    uint32_t size;
+    uint32_t marker;    // Reaching this block prefetches the next window
+};
+
+struct readahead_stats {
+    uint64_t sequential;  // Reads that continued a stream
+    uint64_t random;      // Reads that broke a stream
+    uint64_t windows;     // Prefetch windows submitted
+    uint64_t issued;      // Blocks read ahead
+    uint64_t hits;        // Prefetched blocks that were used
+    uint64_t wasted;      // Prefetched blocks evicted unused
+};
+
+void readahead_init(struct readahead *ra);
+
+// bread() that detects sequential access and prefetches ahead of it
+struct buffer_head *readahead_bread(struct readahead *ra, uint32_t block);
+
+// Read count blocks into buffer through the stream
+int readahead_read(struct readahead *ra, uint32_t block, uint32_t count, void *buffer);
+
+void readahead_get_stats(struct readahead_stats *stats);
+
+#endif // READAHEAD_H
@@ -2,37 +2,49 @@
 #include <stdio.h>
 #include <string.h>
 #include "block_io.h"  // Подключаем header файл с операциями с блоками
-
-#define SUPERBLOCK_MAGIC 0xA1B2C3D4
-
-struct superblock {
-    uint32_t magic;
-    uint32_t block_size;
-    uint32_t total_blocks;
-    uint32_t free_blocks;
-    uint32_t root_inode;
-    uint32_t block_bitmap;
-    uint32_t inode_bitmap;
-    uint32_t inode_table;
-};
+#include "bcache.h"    // Buffer cache for metadata blocks
+#include "superblock.h"
 
 void init_superblock(struct superblock *sb, uint32_t total_blocks, uint32_t block_size) {
+    memset(sb, 0, sizeof(*sb));
     sb->magic = SUPERBLOCK_MAGIC;
     sb->block_size = block_size;
     sb->total_blocks = total_blocks;
-    sb->free_blocks = total_blocks;
     sb->root_inode = 1;
+    sb->total_inodes = total_blocks / ION_BLOCKS_PER_INODE;
+
+    // Metadata layout: bitmaps and inode table follow each other from block 2
     sb->block_bitmap = 2;
-    sb->inode_bitmap = 3;
-    sb->inode_table = 4;
+    sb->inode_bitmap = sb->block_bitmap + bitmap_blocks(total_blocks);
+    sb->inode_table = sb->inode_bitmap + bitmap_blocks(sb->total_inodes);
+    sb->journal_start = sb->inode_table +
+        (uint32_t)(((uint64_t)sb->total_inodes * ION_INODE_SIZE + block_size - 1) / block_size);
+
+    // Journal: 1/64 of the disk, at least enough for one full transaction
+    sb->journal_blocks = total_blocks / 64;
+    if (sb->journal_blocks < ION_JOURNAL_MIN) {
+        sb->journal_blocks = ION_JOURNAL_MIN;
+    } else if (sb->journal_blocks > ION_JOURNAL_MAX) {
+        sb->journal_blocks = ION_JOURNAL_MAX;
+    }
+    // Checksum table: one CRC-32C per block of the device
+    sb->csum_start = sb->journal_start + sb->journal_blocks;
+    sb->csum_blocks = (uint32_t)(((uint64_t)total_blocks * sizeof(uint32_t) + block_size - 1) / block_size);
+    sb->data_start = sb->csum_start + sb->csum_blocks;
+
+    sb->free_blocks = total_blocks - sb->data_start;
+    sb->free_inodes = sb->total_inodes - 2; // Inode 0 is never used, 1 is the root
 }
 
 int read_superblock(struct superblock *sb, uint32_t block) {
-    int status = read_block(block, sb);
-    if (status != 0) {
+    struct buffer_head *bh = bread(block);
+    if (bh == NULL) {
         return -1;
     }
 
+    memcpy(sb, bh->data, sizeof(*sb));
+    brelse(bh);
+
     if (sb->magic != SUPERBLOCK_MAGIC) {
         return -1;
     }
@@ -41,7 +53,15 @@ int read_superblock(struct superblock *sb, uint32_t block) {
 }
 
 int write_superblock(struct superblock *sb, uint32_t block) {
-    return write_block(block, sb);
+    struct buffer_head *bh = bgetblk(block);
+    if (bh == NULL) {
+        return -1;
+    }
+
+    memcpy(bh->data, sb, sizeof(*sb));
+    bwrite(bh);
+    brelse(bh);
+    return 0;
 }
 
 void print_superblock(const struct superblock *sb) {
@@ -54,6 +74,284 @@ void print_superblock(const struct superblock *sb) {
     printf("  Block bitmap: Block %u\n", sb->block_bitmap);
     printf("  Inode bitmap: Block %u\n", sb->inode_bitmap);
     printf("  Inode table: Block %u\n", sb->inode_table);
+    printf("  Inodes: %u (%u free)\n", sb->total_inodes, sb->free_inodes);
+    printf("  Journal: Block %u (%u blocks)\n", sb->journal_start, sb->journal_blocks);
+    printf("  Checksums: Block %u (%u blocks)%s\n", sb->csum_start, sb->csum_blocks,
+           (sb->features & ION_FEATURE_CSUM) ? "" : ", disabled");
+    printf("  Data start: Block %u\n", sb->data_start);
+}
+
+static int ion_periodic_sync(void *ctx);
+
+// Stack the journal, then the checksums, over the device and start
+// tracking dirty blocks for sync and the periodic flusher
+static int ion_attach(struct ion_fs *fs) {
+    fs->journal = journal_open(fs->sb.journal_start, fs->sb.journal_blocks, fs->sb.data_start);
+    if (fs->journal == NULL) {
+        return -1;
+    }
+    if (fs->sb.features & ION_FEATURE_CSUM) {
+        fs->csum = block_csum_open(fs->sb.csum_start, fs->sb.csum_blocks, fs->sb.data_start);
+        if (fs->csum == NULL) {
+            return -1;
+        }
+    }
+    if (writeback_init(&fs->wb, 0, fs->sb.total_blocks) != 0) {
+        return -1;
+    }
+    // The timer commits through ion_sync(), so metadata becomes durable
+    // without an explicit sync and only between operations
+    fs->wb.flush = ion_periodic_sync;
+    fs->wb.ctx = fs;
+    if (bcache_attach_writeback(&fs->wb) != 0 || writeback_register(&fs->wb) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int ion_format(struct ion_fs *fs, uint32_t sb_block, uint32_t total_blocks) {
+    return ion_format_features(fs, sb_block, total_blocks, ION_FEATURE_CSUM);
+}
+
+int ion_format_features(struct ion_fs *fs, uint32_t sb_block, uint32_t total_blocks, uint32_t features) {
+    memset(fs, 0, sizeof(*fs));
+    init_superblock(&fs->sb, total_blocks, BLOCK_SIZE);
+    fs->sb.features = features;
+    fs->sb_block = sb_block;
+
+    if (bitmap_init(&fs->block_map, total_blocks) != 0) {
+        return -1;
+    }
+    if (bitmap_init(&fs->inode_map, fs->sb.total_inodes) != 0) {
+        bitmap_destroy(&fs->block_map);
+        return -1;
+    }
+
+    // The metadata area and the reserved inodes are never allocated
+    for (uint32_t b = 0; b < fs->sb.data_start; b++) {
+        bitmap_set(&fs->block_map, b);
+    }
+    bitmap_set(&fs->inode_map, 0);
+    bitmap_set(&fs->inode_map, fs->sb.root_inode);
+    percpu_counter_init(&fs->free_block_count, fs->sb.free_blocks);
+    percpu_counter_init(&fs->free_inode_count, fs->sb.free_inodes);
+
+    // The home superblock tells ion_load where the journal is, and the
+    // bitmaps of a large disk would not fit one transaction, so both are
+    // written directly; the rest of the initial metadata is journaled and
+    // checksummed
+    if (journal_format(fs->sb.journal_start, fs->sb.journal_blocks) != 0 ||
+        block_csum_format(fs->sb.csum_start, fs->sb.csum_blocks) != 0 ||
+        bitmap_store(&fs->block_map, fs->sb.block_bitmap) != 0 ||
+        bitmap_store(&fs->inode_map, fs->sb.inode_bitmap) != 0 ||
+        write_superblock(&fs->sb, sb_block) != 0 || bflush() != 0 ||
+        ion_attach(fs) != 0 || ion_sync(fs) != 0) {
+        ion_release(fs);
+        return -1;
+    }
+    return 0;
+}
+
+// Read the allocation bitmaps and derive the free counters from them
+static int ion_load_maps(struct ion_fs *fs) {
+    if (bitmap_load(&fs->block_map, fs->sb.block_bitmap) != 0 ||
+        bitmap_load(&fs->inode_map, fs->sb.inode_bitmap) != 0) {
+        return -1;
+    }
+    // The bitmaps are authoritative for the free counters
+    fs->sb.free_blocks = bitmap_count_free(&fs->block_map);
+    fs->sb.free_inodes = bitmap_count_free(&fs->inode_map);
+    percpu_counter_init(&fs->free_block_count, fs->sb.free_blocks);
+    percpu_counter_init(&fs->free_inode_count, fs->sb.free_inodes);
+    return 0;
+}
+
+int ion_load(struct ion_fs *fs, uint32_t sb_block) {
+    memset(fs, 0, sizeof(*fs));
+    if (read_superblock(&fs->sb, sb_block) != 0) {
+        return -1;
+    }
+    fs->sb_block = sb_block;
+
+    // Replay whatever was committed before the last shutdown; the cached
+    // copies of the metadata may be stale afterwards
+    int replayed = journal_recover(fs->sb.journal_start, fs->sb.journal_blocks, fs->sb.data_start);
+    if (replayed < 0) {
+        return -1;
+    }
+    if (replayed > 0 && (binvalidate() != 0 || read_superblock(&fs->sb, sb_block) != 0)) {
+        return -1;
+    }
+    if (ion_attach(fs) != 0) {
+        ion_release(fs);
+        return -1;
+    }
+
+    if (bitmap_init(&fs->block_map, fs->sb.total_blocks) != 0 ||
+        bitmap_init(&fs->inode_map, fs->sb.total_inodes) != 0 || ion_load_maps(fs) != 0) {
+        ion_release(fs);
+        return -1;
+    }
+    return 0;
+}
+
+// An operation outgrew its transaction, which can then never commit. Drop
+// the transaction and every cached metadata change since the last commit,
+// and reload the metadata as committed.
+static int ion_rollback(struct ion_fs *fs) {
+    printf("ION: transaction overflowed, rolling back to the last commit\n");
+    journal_abort(fs->journal);
+    bcache_drop(0, fs->sb.data_start);
+    if ((fs->csum != NULL && block_csum_reload(fs->csum) != 0) ||
+        read_superblock(&fs->sb, fs->sb_block) != 0 || ion_load_maps(fs) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int ion_sync(struct ion_fs *fs) {
+    // Exact counts only when they reach the disk
+    fs->sb.free_blocks = (uint32_t)percpu_counter_sum(&fs->free_block_count);
+    fs->sb.free_inodes = (uint32_t)percpu_counter_sum(&fs->free_inode_count);
+
+    // Every cached block, then the checksum table, goes into the running
+    // transaction before it commits
+    int status = -1;
+    if (bitmap_store(&fs->block_map, fs->sb.block_bitmap) == 0 &&
+        bitmap_store(&fs->inode_map, fs->sb.inode_bitmap) == 0 &&
+        write_superblock(&fs->sb, fs->sb_block) == 0 &&
+        (fs->wb.words != NULL ? writeback_sync(&fs->wb) : bflush()) == 0) {
+        status = fs->journal != NULL ? journal_commit(fs->journal) : 0;
+    }
+    if (status != 0 && fs->journal != NULL && journal_overflowed(fs->journal)) {
+        ion_rollback(fs);
+    }
+    return status;
+}
+
+// Blocks the next commit would hold if it happened now
+static uint32_t ion_pending(struct ion_fs *fs) {
+    uint32_t pending = journal_staged(fs->journal) + fs->wb.ndirty + 1;
+    pending += bitmap_dirty_blocks(&fs->block_map) + bitmap_dirty_blocks(&fs->inode_map);
+    if (fs->csum != NULL) {
+        pending += block_csum_dirty_blocks(fs->csum);
+    }
+    return pending;
+}
+
+static int ion_periodic_sync(void *ctx) {
+    struct ion_fs *fs = ctx;
+    if (fs->journal != NULL && journal_handles(fs->journal) > 0) {
+        return 0; // Mid-operation: the next tick commits
+    }
+    if (fs->journal != NULL && ion_pending(fs) == 1) {
+        return 0; // Nothing but the superblock, which has not changed
+    }
+    return ion_sync(fs);
+}
+
+int ion_begin(struct ion_fs *fs, uint32_t credits) {
+    if (fs->journal == NULL) {
+        return 0;
+    }
+    if (journal_handles(fs->journal) == 0 && ion_pending(fs) + credits > JOURNAL_TX_MAX) {
+        // Commit what is done so far, while no operation is half-way
+        if (ion_sync(fs) != 0) {
+            return -1;
+        }
+        if (ion_pending(fs) + credits > JOURNAL_TX_MAX) {
+            printf("ION: operation needs %u journal blocks, more than a transaction holds\n", credits);
+            return -1;
+        }
+    }
+    journal_begin(fs->journal);
+    return 0;
+}
+
+void ion_end(struct ion_fs *fs) {
+    if (fs->journal == NULL) {
+        return;
+    }
+    journal_end(fs->journal);
+    if (journal_handles(fs->journal) == 0 && journal_overflowed(fs->journal)) {
+        ion_rollback(fs);
+    }
+}
+
+void ion_release(struct ion_fs *fs) {
+    // Commit the cached metadata before the stack is taken down
+    if (fs->journal != NULL && fs->block_map.words != NULL) {
+        ion_sync(fs);
+    } else if (fs->journal != NULL || fs->csum != NULL) {
+        bflush();
+    }
+    if (fs->wb.words != NULL) {
+        bcache_detach_writeback(&fs->wb);
+        writeback_destroy(&fs->wb);
+    }
+    if (fs->csum != NULL) {
+        block_csum_close(fs->csum);
+        fs->csum = NULL;
+    }
+    if (fs->journal != NULL) {
+        journal_close(fs->journal);
+        fs->journal = NULL;
+    }
+    bitmap_destroy(&fs->block_map);
+    bitmap_destroy(&fs->inode_map);
+}
+
+int ion_statfs(struct ion_fs *fs, struct ion_statfs *st) {
+    st->block_size = fs->sb.block_size;
+    st->total_blocks = fs->sb.total_blocks;
+    st->free_blocks = (uint32_t)percpu_counter_sum(&fs->free_block_count);
+    st->total_inodes = fs->sb.total_inodes;
+    st->free_inodes = (uint32_t)percpu_counter_sum(&fs->free_inode_count);
+    return 0;
+}
+
+uint32_t ion_free_blocks_estimate(const struct ion_fs *fs) {
+    int64_t free = percpu_counter_read(&fs->free_block_count);
+    return free > 0 ? (uint32_t)free : 0;
+}
+
+int ion_alloc_block(struct ion_fs *fs, uint32_t *block) {
+    if (bitmap_alloc(&fs->block_map, block) != 0) {
+        return -1;
+    }
+    percpu_counter_add(&fs->free_block_count, -1);
+    return 0;
+}
+
+uint32_t ion_alloc_blocks(struct ion_fs *fs, uint32_t want, uint32_t *start) {
+    uint32_t got = bitmap_alloc_run(&fs->block_map, want, start);
+    percpu_counter_add(&fs->free_block_count, -(int32_t)got);
+    return got;
+}
+
+void ion_free_blocks(struct ion_fs *fs, uint32_t start, uint32_t count) {
+    bcache_drop(start, count);
+    for (uint32_t b = start; b < start + count; b++) {
+        if (b >= fs->sb.data_start && bitmap_test(&fs->block_map, b)) {
+            bitmap_clear(&fs->block_map, b);
+            percpu_counter_add(&fs->free_block_count, 1);
+        }
+    }
+}
+
+int ion_alloc_inode(struct ion_fs *fs, uint32_t *ino) {
+    if (bitmap_alloc(&fs->inode_map, ino) != 0) {
+        return -1;
+    }
+    percpu_counter_add(&fs->free_inode_count, -1);
+    return 0;
+}
+
+void ion_free_inode(struct ion_fs *fs, uint32_t ino) {
+    if (ino > fs->sb.root_inode && bitmap_test(&fs->inode_map, ino)) {
+        bitmap_clear(&fs->inode_map, ino);
+        percpu_counter_add(&fs->free_inode_count, 1);
+    }
 }
 
 int spmain() {
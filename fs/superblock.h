@@ -0,0 +1,105 @@
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include <stdint.h>
+#include "bitmap.h"
+#include "journal.h"
+#include "block_csum.h"
+#include "percpu_counter.h"
+#include "writeback.h"
+
+#define SUPERBLOCK_MAGIC 0xA1B2C3D4
+
+#define ION_INODE_SIZE 128      // Bytes per on-disk inode
+#define ION_BLOCKS_PER_INODE 4  // One inode per 16 KiB of disk
+#define ION_JOURNAL_MIN (2 * JOURNAL_TX_MAX)
+#define ION_JOURNAL_MAX 1024
+
+// Journal credits: most blocks an operation adds to the running
+// transaction, checksum table blocks included
+#define ION_CREDITS_INODE 2      // One inode table block
+#define ION_CREDITS_EXTENT 24    // Mapping extents: tree path and splits, bitmaps, inode
+#define ION_CREDITS_DATA(blocks) ((uint32_t)(blocks) / CSUM_PER_BLOCK + 2)  // Checksums of a data run
+#define ION_CREDITS_FREE(blocks) ((uint32_t)(blocks) / (BLOCK_SIZE * 8) + 2)  // Bitmap blocks of a freed run
+
+// Feature flags
+#define ION_FEATURE_CSUM 0x0001   // Per-block CRC-32C checksums
+
+// On-disk superblock of the ION format
+struct superblock {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t root_inode;
+    uint32_t block_bitmap;    // First block of the block bitmap
+    uint32_t inode_bitmap;    // First block of the inode bitmap
+    uint32_t inode_table;     // First block of the inode table
+    uint32_t total_inodes;
+    uint32_t free_inodes;
+    uint32_t data_start;      // First block after the metadata area
+    uint32_t journal_start;   // Metadata write-ahead log
+    uint32_t journal_blocks;
+    uint32_t features;        // ION_FEATURE_*
+    uint32_t csum_start;      // Block checksum table
+    uint32_t csum_blocks;
+};
+
+// In-memory state of a loaded ION filesystem
+struct ion_fs {
+    struct superblock sb;
+    uint32_t sb_block;            // Block holding the superblock
+    struct ion_bitmap block_map;  // Free-block allocator
+    struct ion_bitmap inode_map;  // Free-inode allocator
+    struct journal *journal;      // Metadata journal, active while loaded
+    struct block_csum *csum;      // Checksums, stacked on the journal
+    struct writeback wb;          // Dirty blocks, flushed in order on sync
+
+    // Live free counts; folded into sb.free_blocks/free_inodes on sync
+    struct percpu_counter free_block_count;
+    struct percpu_counter free_inode_count;
+};
+
+// Filesystem usage as reported by statfs
+struct ion_statfs {
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t total_inodes;
+    uint32_t free_inodes;
+};
+
+void init_superblock(struct superblock *sb, uint32_t total_blocks, uint32_t block_size);
+int read_superblock(struct superblock *sb, uint32_t block);
+int write_superblock(struct superblock *sb, uint32_t block);
+void print_superblock(const struct superblock *sb);
+
+// Create an empty filesystem, or load an existing one, at sb_block
+int ion_format(struct ion_fs *fs, uint32_t sb_block, uint32_t total_blocks);
+int ion_format_features(struct ion_fs *fs, uint32_t sb_block, uint32_t total_blocks, uint32_t features);
+int ion_load(struct ion_fs *fs, uint32_t sb_block);
+int ion_sync(struct ion_fs *fs);
+void ion_release(struct ion_fs *fs);
+
+// Operation handles. Everything between ion_begin() and ion_end() commits
+// in one journal transaction; handles nest, and the outermost one reserves
+// credits blocks, committing the work so far first if they might not fit.
+// ion_sync() commits, so it must be called outside any handle. An
+// operation that writes more than its transaction holds is rolled back,
+// along with everything else since the last commit, when its outermost
+// handle ends or at the next sync.
+int ion_begin(struct ion_fs *fs, uint32_t credits);
+void ion_end(struct ion_fs *fs);
+int ion_statfs(struct ion_fs *fs, struct ion_statfs *st);
+
+// Cheap free-block estimate for allocation policy (no per-CPU folding)
+uint32_t ion_free_blocks_estimate(const struct ion_fs *fs);
+
+// Block and inode allocation
+int ion_alloc_block(struct ion_fs *fs, uint32_t *block);
+uint32_t ion_alloc_blocks(struct ion_fs *fs, uint32_t want, uint32_t *start);
+void ion_free_blocks(struct ion_fs *fs, uint32_t start, uint32_t count);
+int ion_alloc_inode(struct ion_fs *fs, uint32_t *ino);
+void ion_free_inode(struct ion_fs *fs, uint32_t ino);
+
+#endif // SUPERBLOCK_H
@@ -1,81 +1,473 @@
 // ion/vfs.c
 
 #include "fs.h"
+#include "dcache.h"
+#include "icache.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 // Global root inode for VFS
 static inode_t *vfs_root = NULL;
-static inode_t *mounted_fs = NULL;
+
+// Mount table snapshot. Readers load it without locks; writers copy it,
+// publish the copy and free the old one after a grace period.
+struct mount_table {
+    int count;
+    struct vfs_mount *mounts[VFS_MAX_MOUNTS];  // Longest mount point first
+};
+
+static struct mount_table *mount_table = NULL;
+static volatile int mount_writer_lock = 0;
+static unsigned int rcu_epoch = 0;
+static int rcu_readers[2];
+
+// Enter a read-side critical section; returns the token for vfs_read_unlock()
+int vfs_read_lock(void) {
+    for (;;) {
+        int epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST) & 1;
+        __atomic_fetch_add(&rcu_readers[epoch], 1, __ATOMIC_SEQ_CST);
+        // A writer may have flipped the epoch before we were counted
+        if ((int)(__atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST) & 1) == epoch) {
+            return epoch;
+        }
+        __atomic_fetch_sub(&rcu_readers[epoch], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void vfs_read_unlock(int token) {
+    __atomic_fetch_sub(&rcu_readers[token], 1, __ATOMIC_RELEASE);
+}
+
+// Wait until every reader that could still see an old snapshot has left
+static void vfs_synchronize(void) {
+    unsigned int old = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+    while (__atomic_load_n(&rcu_readers[old], __ATOMIC_ACQUIRE) != 0) {
+    }
+}
+
+static void mount_write_lock(void) {
+    while (__atomic_test_and_set(&mount_writer_lock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void mount_write_unlock(void) {
+    __atomic_clear(&mount_writer_lock, __ATOMIC_RELEASE);
+}
+
+// Copy the current table, apply a change and publish it (writer lock held)
+static int mount_table_replace(struct vfs_mount *add, struct vfs_mount *remove) {
+    struct mount_table *old = __atomic_load_n(&mount_table, __ATOMIC_ACQUIRE);
+    struct mount_table *table = (struct mount_table *)malloc(sizeof(*table));
+    if (table == NULL) {
+        return -1;
+    }
+
+    table->count = 0;
+    for (int i = 0; old != NULL && i < old->count; i++) {
+        if (old->mounts[i] != remove) {
+            table->mounts[table->count++] = old->mounts[i];
+        }
+    }
+    if (add != NULL) {
+        if (table->count == VFS_MAX_MOUNTS) {
+            free(table);
+            return -1;
+        }
+        int pos = table->count;
+        while (pos > 0 && table->mounts[pos - 1]->path_len < add->path_len) {
+            table->mounts[pos] = table->mounts[pos - 1];
+            pos--;
+        }
+        table->mounts[pos] = add;
+        table->count++;
+    }
+
+    __atomic_store_n(&mount_table, table, __ATOMIC_RELEASE);
+    vfs_synchronize();
+    free(old);
+    return 0;
+}
+
+// Mount covering path (longest matching mount point); caller holds vfs_read_lock()
+struct vfs_mount *vfs_find_mount(const char *path) {
+    struct mount_table *table = __atomic_load_n(&mount_table, __ATOMIC_ACQUIRE);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < table->count; i++) {
+        struct vfs_mount *m = table->mounts[i];
+        if (m->path_len == 1) {
+            return m; // "/" covers everything
+        }
+        if (strncmp(path, m->path, m->path_len) == 0 &&
+            (path[m->path_len] == '\0' || path[m->path_len] == '/')) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// Exact mount point match; caller holds the writer lock
+static struct vfs_mount *mount_find_exact(const char *path, size_t len) {
+    struct mount_table *table = __atomic_load_n(&mount_table, __ATOMIC_ACQUIRE);
+    for (int i = 0; table != NULL && i < table->count; i++) {
+        if (table->mounts[i]->path_len == len && strncmp(table->mounts[i]->path, path, len) == 0) {
+            return table->mounts[i];
+        }
+    }
+    return NULL;
+}
+
+// Length of a mount point without trailing slashes ("/" stays "/")
+static size_t mount_path_len(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
 
 // Initialize the Virtual File System (VFS)
 void vfs_init(void) {
     // Initialize the root directory of the VFS
-    vfs_root = (inode_t *)malloc(sizeof(inode_t));
+    vfs_root = inode_alloc(NULL);
     if (vfs_root == NULL) {
         printf("Error allocating memory for VFS root directory\n");
         return;
     }
 
-    strcpy(vfs_root->name, "/");
+    vfs_root->name = iname_get("/", 1, dcache_hash_name("/", 1));
     vfs_root->is_directory = 1;
-    vfs_root->parent = NULL;
-    vfs_root->children = NULL;
 
     printf("VFS initialized\n");
 }
 
-// Mount a file system to the VFS
-int vfs_mount(const char *device, fs_operations_t *fs_ops, enum fs_type fs_type) {
-    if (mounted_fs != NULL) {
-        printf("A file system is already mounted\n");
-        return -1; // Error: VFS is already mounted
+// Mount a file system at a mount point
+int vfs_mount_at(const char *path, const char *device, fs_operations_t *fs_ops, enum fs_type fs_type) {
+    if (path == NULL || path[0] != '/' || fs_ops == NULL) {
+        return -1;
+    }
+    size_t len = mount_path_len(path);
+    if (len >= VFS_MOUNT_PATH_MAX) {
+        printf("Mount point %s is too long\n", path);
+        return -1;
+    }
+    // The covered directory stays referenced while the mount exists
+    inode_t *dir = NULL;
+    if (len > 1) {
+        dir = vfs_lookup(path);
+        if (dir == NULL || !dir->is_directory) {
+            printf("Mount point %s is not a directory\n", path);
+            iput(dir);
+            return -1;
+        }
+    }
+
+    struct vfs_mount *m = (struct vfs_mount *)calloc(1, sizeof(*m));
+    superblock_t *sb = (superblock_t *)calloc(1, sizeof(*sb));
+    if (m == NULL || sb == NULL) {
+        printf("Error allocating memory for the mount\n");
+        iput(dir);
+        free(m);
+        free(sb);
+        return -1; // Memory allocation failure
     }
 
-    // Allocate memory for the inode representing the mounted file system
-    mounted_fs = (inode_t *)malloc(sizeof(inode_t));
-    if (mounted_fs == NULL) {
+    // Allocate the inode representing the root of the mounted file system
+    m->root = inode_alloc(sb);
+    if (m->root == NULL) {
         printf("Error allocating memory for the file system inode\n");
+        iput(dir);
+        free(m);
+        free(sb);
         return -1; // Memory allocation failure
     }
+    m->mountpoint = dir;
+    m->root->is_directory = 1;
+    m->root->name = iname_get("/", 1, dcache_hash_name("/", 1));
+    sb->root_inode = m->root;
+    sb->ops = fs_ops;
+    strcpy(sb->fs_name, fs_type == FS_TYPE_EXT4 ? "EXT4" : fs_type == FS_TYPE_FAT32 ? "FAT32" :
+                       fs_type == FS_TYPE_RAMFS ? "RAMFS" : "UNKNOWN");
 
-    // Initialize the inode with file system type and operations
-    mounted_fs->is_directory = 1; // Let's assume the mount point is a directory
-    mounted_fs->parent = NULL;
-    mounted_fs->children = NULL;
+    memcpy(m->path, path, len);
+    m->path[len] = '\0';
+    m->path_len = len;
+    m->ops = fs_ops;
+    m->type = fs_type;
+    m->sb = sb;
+    if (device != NULL) {
+        strncpy(m->device, device, sizeof(m->device) - 1);
+    }
 
     // Call the file system's mount operation
-    int result = fs_ops->mount(device);
-    if (result != 0) {
+    if (fs_ops->mount != NULL && fs_ops->mount(device) != 0) {
         printf("Failed to mount the file system on device %s\n", device);
-        free(mounted_fs);
-        mounted_fs = NULL;
+        iput(m->root);
+        iput(dir);
+        free(m);
+        free(sb);
         return -1; // Mount failure
     }
 
-    printf("File system mounted successfully on device %s\n", device);
+    mount_write_lock();
+    int status = -1;
+    if (mount_find_exact(m->path, len) != NULL) {
+        printf("A file system is already mounted on %s\n", m->path);
+    } else {
+        status = mount_table_replace(m, NULL);
+    }
+    mount_write_unlock();
+
+    if (status != 0) {
+        if (fs_ops->unmount != NULL) {
+            fs_ops->unmount();
+        }
+        iput(m->root);
+        iput(dir);
+        free(m);
+        free(sb);
+        return -1;
+    }
+
+    printf("File system mounted successfully on device %s at %s\n", device, m->path);
     return 0; // Success
 }
 
-// Unmount the file system from the VFS
-int vfs_unmount(void) {
-    if (mounted_fs == NULL) {
-        printf("No file system is currently mounted\n");
+// Mount a file system as the root of the VFS
+int vfs_mount(const char *device, fs_operations_t *fs_ops, enum fs_type fs_type) {
+    return vfs_mount_at("/", device, fs_ops, fs_type);
+}
+
+// Drop an in-memory namespace subtree
+static void vfs_free_tree(inode_t *dir) {
+    inode_t *child = dir->children;
+    while (child != NULL) {
+        inode_t *next = child->next;
+        vfs_free_tree(child);
+        dcache_purge_inode(child);
+        iput(child);
+        child = next;
+    }
+    dir->children = NULL;
+}
+
+// Whether a namespace inode is referenced beyond the tree's own reference
+static int vfs_tree_busy(inode_t *dir) {
+    if (dir->count > 1) {
+        return 1;
+    }
+    for (inode_t *child = dir->children; child != NULL; child = child->next) {
+        if (vfs_tree_busy(child)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether another mount sits below m; caller holds the writer lock
+static int mount_has_submounts(const struct vfs_mount *m) {
+    struct mount_table *table = __atomic_load_n(&mount_table, __ATOMIC_ACQUIRE);
+    for (int i = 0; table != NULL && i < table->count; i++) {
+        const struct vfs_mount *other = table->mounts[i];
+        if (other != m && other->path_len > m->path_len &&
+            (m->path_len == 1 || (strncmp(other->path, m->path, m->path_len) == 0 &&
+                                  other->path[m->path_len] == '/'))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Unmount the file system mounted at a mount point
+int vfs_unmount_at(const char *path) {
+    if (path == NULL) {
+        return -1;
+    }
+    size_t len = mount_path_len(path);
+
+    mount_write_lock();
+    struct vfs_mount *m = mount_find_exact(path, len);
+    if (m == NULL) {
+        mount_write_unlock();
+        printf("No file system is mounted on %s\n", path);
         return -1; // Error: No file system mounted
     }
+    if (mount_has_submounts(m)) {
+        mount_write_unlock();
+        printf("%s is busy: file systems are mounted below it\n", path);
+        return -1;
+    }
+
+    // Once the mount is unpublished no new reference can be taken through
+    // it, so the ones left show whether it is still in use
+    int status = mount_table_replace(NULL, m);
+    if (status == 0 && (vfs_tree_busy(m->root) || icache_sb_busy(m->sb))) {
+        mount_table_replace(m, NULL);
+        printf("%s is busy: its files are still in use\n", path);
+        status = -1;
+    }
+    mount_write_unlock();
+    if (status != 0) {
+        return -1;
+    }
 
-    // Call the file system's unmount operation
-    int result = mounted_fs->is_directory; // Just an example, no real unmount function here
-    if (result != 0) {
-        printf("Failed to unmount the file system\n");
-        return -1; // Unmount failure
+    // No reader can reach the mount any more
+    if (m->ops->unmount != NULL && m->ops->unmount() != 0) {
+        printf("Failed to unmount the file system cleanly\n");
+        status = -1;
     }
 
     // Free the resources associated with the mounted file system
-    free(mounted_fs);
-    mounted_fs = NULL;
+    vfs_free_tree(m->root);
+    dcache_purge_inode(m->root);
+    icache_evict_sb(m->sb);
+    iput(m->root);
+    iput(m->mountpoint);
+    free(m->sb);
+    free(m);
 
-    printf("File system unmounted successfully\n");
-    return 0; // Success
+    printf("File system unmounted successfully from %s\n", path);
+    return status;
+}
+
+// Unmount the root file system
+int vfs_unmount(void) {
+    return vfs_unmount_at("/");
+}
+
+// Find a child by name, through the dentry cache
+static inode_t *vfs_lookup_child(inode_t *dir, const char *name, size_t len) {
+    if (len == 1 && name[0] == '.') {
+        return dir;
+    }
+    if (len == 2 && name[0] == '.' && name[1] == '.') {
+        return dir->parent != NULL ? dir->parent : dir;
+    }
+
+    uint32_t hash = dcache_hash_name(name, len);
+    inode_t *child;
+    if (dcache_lookup(dir, name, len, hash, &child)) {
+        return child;
+    }
+
+    // Miss: search the directory once and remember the answer either way
+    for (child = dir->children; child != NULL; child = child->next) {
+        const struct iname *n = child->name;
+        if (n->hash == hash && n->len == len && memcmp(n->str, name, len) == 0) {
+            break;
+        }
+    }
+    dcache_add(dir, name, len, hash, child);
+    return child;
+}
+
+// Resolve an absolute path, one hash probe per component on cache hits.
+// The walk starts at the root of the covering mount, found without locks.
+inode_t *vfs_lookup(const char *path) {
+    if (vfs_root == NULL || path == NULL || path[0] != '/') {
+        return NULL;
+    }
+
+    int token = vfs_read_lock();
+    inode_t *node = vfs_root;
+    struct vfs_mount *m = vfs_find_mount(path);
+    if (m != NULL) {
+        node = m->root;
+        path += m->path_len;
+    }
+
+    while (node != NULL && *path != '\0') {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if (len == 0) {
+            break;
+        }
+        if (!node->is_directory || len > VFS_NAME_MAX) {
+            node = NULL;
+            break;
+        }
+
+        node = vfs_lookup_child(node, path, len);
+        path += len;
+    }
+    // Referenced before leaving the read section: an unmount waits for
+    // readers, then refuses while the reference is held
+    igrab(node);
+    vfs_read_unlock(token);
+    return node;
+}
+
+// Create a file or directory under parent
+inode_t *vfs_create(inode_t *parent, const char *name, int is_directory) {
+    size_t len = strlen(name);
+    if (parent == NULL || !parent->is_directory || len == 0 || len > VFS_NAME_MAX ||
+        strchr(name, '/') != NULL) {
+        return NULL;
+    }
+    if (vfs_lookup_child(parent, name, len) != NULL) {
+        printf("'%s' already exists\n", name);
+        return NULL;
+    }
+
+    // The namespace holds the initial reference until vfs_remove()
+    inode_t *inode = inode_alloc(parent->sb);
+    if (inode == NULL) {
+        printf("Error allocating memory for inode\n");
+        return NULL;
+    }
+
+    uint32_t hash = dcache_hash_name(name, len);
+    inode->name = iname_get(name, len, hash);
+    if (inode->name == NULL) {
+        iput(inode);
+        return NULL;
+    }
+    inode->is_directory = is_directory;
+    inode->parent = parent;
+    inode->next = parent->children;
+    parent->children = inode;
+
+    // Replaces the negative entry left by the existence check
+    dcache_add(parent, name, len, hash, inode);
+    return inode;
+}
+
+// Whether a file system is mounted on inode
+static int vfs_is_mountpoint(const inode_t *inode) {
+    int token = vfs_read_lock();
+    struct mount_table *table = __atomic_load_n(&mount_table, __ATOMIC_ACQUIRE);
+    int found = 0;
+    for (int i = 0; table != NULL && i < table->count && !found; i++) {
+        found = table->mounts[i]->mountpoint == inode;
+    }
+    vfs_read_unlock(token);
+    return found;
+}
+
+// Remove an empty directory or a file
+int vfs_remove(inode_t *inode) {
+    if (inode == NULL || inode == vfs_root || inode->parent == NULL || inode->children != NULL ||
+        vfs_is_mountpoint(inode)) {
+        return -1;
+    }
+
+    inode_t **link = &inode->parent->children;
+    while (*link != NULL && *link != inode) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return -1;
+    }
+    *link = inode->next;
+
+    const struct iname *name = inode->name;
+    dcache_purge_inode(inode);
+    dcache_add(inode->parent, name->str, name->len, name->hash, NULL);
+    iput(inode);
+    return 0;
 }
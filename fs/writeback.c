@@ -0,0 +1,164 @@
+#include "writeback.h"
+#include "bcache.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct writeback *registered[WB_MAX_MOUNTS];
+static int nregistered;
+static struct timer wb_timer;    // Runs writeback_timer() while anything is registered
+
+int writeback_init(struct writeback *wb, uint32_t first, uint32_t nblocks) {
+    memset(wb, 0, sizeof(*wb));
+    wb->first = first;
+    wb->nblocks = nblocks;
+    wb->nwords = (nblocks + 63) / 64;
+    wb->words = calloc(wb->nwords, sizeof(uint64_t));
+    wb->summary = calloc((wb->nwords + 63) / 64, sizeof(uint64_t));
+    if (wb->words == NULL || wb->summary == NULL) {
+        writeback_destroy(wb);
+        return -1;
+    }
+    wb->dirty_ratio = WB_DEFAULT_RATIO;
+    wb->interval_ms = WB_DEFAULT_INTERVAL;
+    return 0;
+}
+
+void writeback_destroy(struct writeback *wb) {
+    writeback_unregister(wb);
+    free(wb->words);
+    free(wb->summary);
+    wb->words = NULL;
+    wb->summary = NULL;
+}
+
+void writeback_set_policy(struct writeback *wb, uint32_t dirty_ratio, uint32_t interval_ms) {
+    wb->dirty_ratio = dirty_ratio;
+    wb->interval_ms = interval_ms;
+}
+
+void writeback_mark(struct writeback *wb, uint32_t block) {
+    block -= wb->first;
+    if (block >= wb->nblocks) {
+        return;
+    }
+    uint32_t w = block / 64;
+    uint64_t bit = 1ULL << (block % 64);
+    if (!(wb->words[w] & bit)) {
+        wb->words[w] |= bit;
+        wb->summary[w / 64] |= 1ULL << (w % 64);
+        wb->ndirty++;
+    }
+}
+
+void writeback_clear(struct writeback *wb, uint32_t block) {
+    block -= wb->first;
+    if (block >= wb->nblocks) {
+        return;
+    }
+    uint32_t w = block / 64;
+    uint64_t bit = 1ULL << (block % 64);
+    if (wb->words[w] & bit) {
+        wb->words[w] &= ~bit;
+        if (wb->words[w] == 0) {
+            wb->summary[w / 64] &= ~(1ULL << (w % 64));
+        }
+        wb->ndirty--;
+    }
+}
+
+uint32_t writeback_next(const struct writeback *wb, uint32_t from) {
+    from = from > wb->first ? from - wb->first : 0;
+    if (from >= wb->nblocks) {
+        return UINT32_MAX;
+    }
+
+    // Rest of the current word
+    uint32_t w = from / 64;
+    uint64_t bits = wb->words[w] & (~0ULL << (from % 64));
+    if (bits != 0) {
+        return wb->first + w * 64 + (uint32_t)__builtin_ctzll(bits);
+    }
+
+    // Then skip empty words 64 at a time through the summary
+    w++;
+    for (uint32_t s = w / 64; s < (wb->nwords + 63) / 64; s++) {
+        uint64_t sum = wb->summary[s];
+        if (s == w / 64) {
+            sum &= ~0ULL << (w % 64);
+        }
+        if (sum != 0) {
+            uint32_t word = s * 64 + (uint32_t)__builtin_ctzll(sum);
+            return wb->first + word * 64 + (uint32_t)__builtin_ctzll(wb->words[word]);
+        }
+    }
+    return UINT32_MAX;
+}
+
+int writeback_sync(struct writeback *wb) {
+    uint32_t before = wb->ndirty;
+    int status = bflush_writeback(wb);
+    wb->stats.syncs++;
+    wb->stats.blocks += before - wb->ndirty;
+    wb->elapsed_ms = 0;
+    return status;
+}
+
+int writeback_balance(struct writeback *wb, uint32_t cache_blocks) {
+    if (wb->dirty_ratio == 0 || (uint64_t)wb->ndirty * 100 < (uint64_t)wb->dirty_ratio * cache_blocks) {
+        return 0;
+    }
+    wb->stats.ratio_flushes++;
+    return writeback_sync(wb);
+}
+
+int writeback_register(struct writeback *wb) {
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        if (registered[i] == NULL) {
+            // The first mount starts the flusher
+            if (nregistered == 0 && timer_start(&wb_timer, WB_TIMER_PERIOD, writeback_timer) != 0) {
+                return -1;
+            }
+            registered[i] = wb;
+            nregistered++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void writeback_unregister(struct writeback *wb) {
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        if (registered[i] == wb) {
+            registered[i] = NULL;
+            // ...and the last one to go stops it
+            if (--nregistered == 0) {
+                timer_stop(&wb_timer);
+            }
+        }
+    }
+}
+
+void writeback_tick(uint32_t elapsed_ms) {
+    for (int i = 0; i < WB_MAX_MOUNTS; i++) {
+        struct writeback *wb = registered[i];
+        if (wb == NULL || wb->interval_ms == 0) {
+            continue;
+        }
+        wb->elapsed_ms += elapsed_ms;
+        if (wb->elapsed_ms >= wb->interval_ms) {
+            if (wb->flush != NULL) {
+                wb->stats.periodic_flushes++;
+                wb->flush(wb->ctx);
+            } else if (wb->ndirty > 0) {
+                wb->stats.periodic_flushes++;
+                writeback_sync(wb);
+            }
+            wb->elapsed_ms = 0;
+        }
+    }
+}
+
+void writeback_timer(void) {
+    writeback_tick(WB_TIMER_PERIOD);
+}
@@ -0,0 +1,65 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <stdint.h>
+
+#define WB_DEFAULT_RATIO 20          // Percent of the buffer cache allowed dirty
+#define WB_DEFAULT_INTERVAL 5000     // Milliseconds between periodic flushes
+#define WB_TIMER_PERIOD 100          // Period of writeback_timer() (ms)
+#define WB_MAX_MOUNTS 8
+
+struct writeback_stats {
+    uint64_t syncs;              // Flushes performed
+    uint64_t blocks;             // Dirty blocks written
+    uint64_t ratio_flushes;      // Flushes forced by the dirty ratio
+    uint64_t periodic_flushes;   // Flushes started by the timer
+};
+
+// Dirty-block set of one mounted filesystem: a bit per block of its range
+// plus a summary bit per non-empty word, so a sync visits only dirty
+// blocks, in block order. Each mounted filesystem has its own set, and the
+// buffer cache files a dirty block under the set whose range holds it.
+struct writeback {
+    uint64_t *words;
+    uint64_t *summary;
+    uint32_t first;              // First device block of the range
+    uint32_t nblocks;
+    uint32_t nwords;
+    uint32_t ndirty;
+    uint32_t dirty_ratio;        // Percent, 0 disables the ratio trigger
+    uint32_t interval_ms;        // 0 disables periodic flushing
+    uint32_t elapsed_ms;         // Since the last flush
+    // Periodic flush of the owner (optional, writeback_sync() otherwise),
+    // for filesystems that must flush more than the cached blocks
+    int (*flush)(void *ctx);
+    void *ctx;
+    struct writeback_stats stats;
+};
+
+int writeback_init(struct writeback *wb, uint32_t first, uint32_t nblocks);
+void writeback_destroy(struct writeback *wb);
+void writeback_set_policy(struct writeback *wb, uint32_t dirty_ratio, uint32_t interval_ms);
+
+void writeback_mark(struct writeback *wb, uint32_t block);
+void writeback_clear(struct writeback *wb, uint32_t block);
+
+// First dirty block at or after from, or UINT32_MAX
+uint32_t writeback_next(const struct writeback *wb, uint32_t from);
+
+// Write every dirty block of the filesystem, and only those
+int writeback_sync(struct writeback *wb);
+
+// Flush now if more than dirty_ratio percent of cache_blocks are dirty
+int writeback_balance(struct writeback *wb, uint32_t cache_blocks);
+
+// Periodic flusher: registered filesystems are flushed once interval_ms
+// has passed since their last flush. writeback_tick() advances the clock;
+// writeback_timer() is the callback of a WB_TIMER_PERIOD timer that runs
+// while any filesystem is registered, as often as the kernel drives its
+// timers (the shell polls them between commands).
+int writeback_register(struct writeback *wb);
+void writeback_unregister(struct writeback *wb);
+void writeback_tick(uint32_t elapsed_ms);
+void writeback_timer(void);
+
+#endif // WRITEBACK_H
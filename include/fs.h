@@ -3,14 +3,40 @@
 
 #include <stddef.h> // For size_t
 
-// Define the inode structure (minimal)
+#include <stdint.h>
+
+#define VFS_NAME_MAX 255   // Longest file name component
+
+// Interned file name (fs/iname.c). Equal names share one immutable copy;
+// the hash and length prefix the bytes so lookups compare them first.
+struct iname {
+    struct iname *next;       // Intern table chain
+    uint32_t hash;            // dcache_hash_name() of the bytes
+    uint32_t refs;
+    uint16_t len;
+    char str[];               // len bytes, NUL-terminated
+};
+
+// In-memory inode, one cache line: everything a path walk or an inode
+// cache lookup touches sits together, and the name is a shared reference
 typedef struct inode {
-    char name[256];           // File or directory name
-    int is_directory;         // 1 if directory, 0 if file
-    struct inode *parent;     // Parent directory
     struct inode *children;   // Pointer to children (subdirectories/files)
-    struct superblock *sb;    // Pointer to associated superblock (NEW)
-} inode_t;
+    struct inode *next;       // Next sibling in the parent's children list
+    struct inode *parent;     // Parent directory
+    const struct iname *name; // File or directory name
+    struct superblock *sb;    // Pointer to associated superblock
+    struct inode *hash_next;  // Inode cache hash chain (or slab free list)
+    unsigned long ino;        // Inode number within sb (0 = in-memory only)
+    int32_t count;            // References held on the inode
+    uint16_t state;           // I_* inode cache flags
+    uint8_t is_directory;     // 1 if directory, 0 if file
+} __attribute__((aligned(64))) inode_t;
+
+// Inode cache state flags
+#define I_HASHED 0x01   // Reachable through iget()
+#define I_DIRTY  0x02   // Must go through write_inode before reclaim
+#define I_REFERENCED 0x04  // Used since the reclaim clock last passed
+#define I_FREE   0x08   // Slab object not in use
 
 // File system operations structure
 typedef struct fs_operations {
@@ -36,11 +62,56 @@ enum fs_type {
     FS_TYPE_UNKNOWN,
     FS_TYPE_EXT4,
     FS_TYPE_FAT32,
+    FS_TYPE_RAMFS,
+};
+
+#define VFS_MAX_MOUNTS 16
+#define VFS_MOUNT_PATH_MAX 128
+
+// Mounted file system, keyed by its mount point
+struct vfs_mount {
+    char path[VFS_MOUNT_PATH_MAX];  // Mount point, without trailing slash
+    size_t path_len;
+    char device[64];
+    fs_operations_t *ops;
+    enum fs_type type;
+    superblock_t *sb;
+    inode_t *root;                  // Root directory of the mounted file system
+    inode_t *mountpoint;            // Directory covered by the mount (referenced), NULL for "/"
 };
 
 // VFS functions (prototypes)
 void vfs_init(void);
 int vfs_mount(const char *device, fs_operations_t *fs_ops, enum fs_type fs_type);
 int vfs_unmount(void);
+int vfs_mount_at(const char *path, const char *device, fs_operations_t *fs_ops, enum fs_type fs_type);
+// Fails while file systems are mounted below path or its inodes are referenced
+int vfs_unmount_at(const char *path);
+
+// Lock-free mount table lookup: the mount returned by vfs_find_mount() stays
+// valid until the matching vfs_read_unlock()
+int vfs_read_lock(void);
+void vfs_read_unlock(int token);
+struct vfs_mount *vfs_find_mount(const char *path);
+
+// Inode cache (fs/icache.c)
+inode_t *iget(struct superblock *sb, unsigned long ino);  // Cached or read via read_inode
+inode_t *igrab(inode_t *inode);                            // Take another reference
+inode_t *inode_alloc(struct superblock *sb);               // New unhashed inode
+void iput(inode_t *inode);
+void mark_inode_dirty(inode_t *inode);
+int icache_sync(struct superblock *sb);
+
+// Interned names: iname_get() returns a referenced copy of the name
+const struct iname *iname_get(const char *name, size_t len, uint32_t hash);
+const struct iname *iname_dup(const struct iname *name);
+void iname_put(const struct iname *name);
+size_t iname_arena_bytes(void);
+
+// Namespace operations. vfs_lookup() returns a referenced inode, released
+// with iput().
+inode_t *vfs_lookup(const char *path);
+inode_t *vfs_create(inode_t *parent, const char *name, int is_directory);
+int vfs_remove(inode_t *inode);
 
 #endif // FS_H
@@ -4,8 +4,10 @@
 #define FSAPI_H
 
 #include <stddef.h> // For size_t type
+#include <stdint.h> // For uintmax_t
 #include <stdio.h>  // For basic file operations
 #include <string.h> // For memset
+#include <sys/types.h> // For off_t
 
 // Function to create a file with the specified name.
 // Parameters:
@@ -22,34 +24,65 @@ int create_file(const char *filename) {
     return 0; // Success
 }
 
-// Function to create a file with the specified name and fill it with zeros up to a given size.
+// Largest offset fseeko() can reach
+#define FSAPI_OFF_MAX ((off_t)(((uintmax_t)1 << (sizeof(off_t) * 8 - 1)) - 1))
+
+// Preallocation modes for create_filew_mode()
+#define FSAPI_PREALLOC_SPARSE 0 // Only the size is set; unwritten ranges read as zeros
+#define FSAPI_PREALLOC_ZERO   1 // Every byte is written, so the space is allocated up front
+
+// Function to create a file with the specified name and a given size, using the given preallocation mode.
 // Parameters:
 //   - filename: The name of the file to create (null-terminated string).
-//   - size: The size of the file in bytes, filled with zeros.
+//   - size: The size of the file in bytes, reading back as zeros.
+//   - mode: FSAPI_PREALLOC_SPARSE or FSAPI_PREALLOC_ZERO.
 // Returns:
-//   - 0 on success, non-zero error code on failure.
-int create_filew(const char *filename, size_t size) {
+//   - 0 on success, non-zero error code on failure (-4: size not representable as a file offset).
+int create_filew_mode(const char *filename, size_t size, int mode) {
     if (!filename) return -1; // Error: Null filename
+    if (size > 0 && (uintmax_t)(size - 1) > (uintmax_t)FSAPI_OFF_MAX) return -4; // Error: Size too large
 
     FILE *file = fopen(filename, "wb");
     if (!file) return -2; // Error: Could not create file
 
-    char buffer[1024] = {0}; // Buffer to write zeros
+    if (mode == FSAPI_PREALLOC_SPARSE) {
+        // Seek past the end and write the last byte: the skipped range is
+        // left unallocated and the cost does not depend on the size
+        if (size > 0 && (fseeko(file, (off_t)(size - 1), SEEK_SET) != 0 || fputc(0, file) == EOF)) {
+            fclose(file);
+            return -3; // Error: Could not write to file
+        }
+        if (fclose(file) != 0) return -3;
+        return 0; // Success
+    }
+
+    static const char zeros[4096]; // Source of the zeros, shared by every call
     size_t remaining = size;
 
     while (remaining > 0) {
-        size_t chunk_size = (remaining > sizeof(buffer)) ? sizeof(buffer) : remaining;
-        if (fwrite(buffer, 1, chunk_size, file) != chunk_size) {
+        size_t chunk_size = (remaining > sizeof(zeros)) ? sizeof(zeros) : remaining;
+        if (fwrite(zeros, 1, chunk_size, file) != chunk_size) {
             fclose(file);
             return -3; // Error: Could not write to file
         }
         remaining -= chunk_size;
     }
 
-    fclose(file);
+    if (fclose(file) != 0) return -3;
     return 0; // Success
 }
 
+// Function to create a file with the specified name and fill it with zeros up to a given size.
+// The file is created sparse: reading it returns zeros, but no data is written.
+// Parameters:
+//   - filename: The name of the file to create (null-terminated string).
+//   - size: The size of the file in bytes, filled with zeros.
+// Returns:
+//   - 0 on success, non-zero error code on failure.
+int create_filew(const char *filename, size_t size) {
+    return create_filew_mode(filename, size, FSAPI_PREALLOC_SPARSE);
+}
+
 // Function to delete a file with the specified name.
 // Parameters:
 //   - filename: The name of the file to delete (null-terminated string).
@@ -84,4 +117,274 @@ int create_mknod(const char *filename, const char *config) {
     return 0; // Success
 }
 
+// Open flags for fs_open()
+#define FSAPI_O_RDONLY 0x00 // Open for reading only
+#define FSAPI_O_WRONLY 0x01 // Open for writing only
+#define FSAPI_O_RDWR   0x02 // Open for reading and writing
+#define FSAPI_O_ACCMODE 0x03
+#define FSAPI_O_CREAT  0x04 // Create the file if it does not exist
+#define FSAPI_O_TRUNC  0x08 // Truncate the file to zero length
+#define FSAPI_O_APPEND 0x10 // Every write goes to the end of the file
+
+// Whence values for fs_lseek()
+#define FSAPI_SEEK_SET 0
+#define FSAPI_SEEK_CUR 1
+#define FSAPI_SEEK_END 2
+
+#define FSAPI_MAX_FDS 64 // Size of the open-file table
+
+// Segment for fs_readv()/fs_writev()
+struct fsapi_iovec {
+    void *base;   // Start of the memory segment
+    size_t len;   // Segment length in bytes
+};
+
+// Open-file table entry. The stream stays open between calls; pos and
+// last_op track where it sits so sequential I/O does not seek each time.
+struct fsapi_file {
+    FILE *stream;  // NULL for a free slot
+    int flags;     // FSAPI_O_* flags given to fs_open()
+    long offset;   // Descriptor offset used by fs_read()/fs_write()
+    long pos;      // Current position of the stream, -1 if unknown
+    int last_op;   // 0 none, 1 read, 2 write: stdio needs a seek between the two
+};
+
+static struct fsapi_file fsapi_files[FSAPI_MAX_FDS];
+
+// Return the table entry of an open descriptor, or NULL
+static struct fsapi_file *fsapi_file_get(int fd) {
+    if (fd < 0 || fd >= FSAPI_MAX_FDS || fsapi_files[fd].stream == NULL) return NULL;
+    return &fsapi_files[fd];
+}
+
+// Move the stream to offset before an operation of the given kind (1 read, 2 write)
+static int fsapi_position(struct fsapi_file *f, long offset, int op) {
+    if (f->pos == offset && (f->last_op == op || f->last_op == 0)) {
+        f->last_op = op;
+        return 0;
+    }
+    if (fseek(f->stream, offset, SEEK_SET) != 0) {
+        f->pos = -1;
+        return -1;
+    }
+    f->pos = offset;
+    f->last_op = op;
+    return 0;
+}
+
+// Function to open a file and return a descriptor for it.
+// Parameters:
+//   - filename: The name of the file to open (null-terminated string).
+//   - flags: FSAPI_O_RDONLY, FSAPI_O_WRONLY or FSAPI_O_RDWR, optionally
+//            combined with FSAPI_O_CREAT, FSAPI_O_TRUNC and FSAPI_O_APPEND.
+// Returns:
+//   - A descriptor (>= 0) on success, negative error code on failure.
+int fs_open(const char *filename, int flags) {
+    if (!filename || (flags & FSAPI_O_ACCMODE) == FSAPI_O_ACCMODE) return -1; // Error: Bad parameters
+
+    int fd = 0;
+    while (fd < FSAPI_MAX_FDS && fsapi_files[fd].stream != NULL) fd++;
+    if (fd == FSAPI_MAX_FDS) return -4; // Error: Too many open files
+
+    // Writers open the file for update so that existing data is kept; the
+    // access mode is enforced by fs_read()/fs_write()
+    FILE *file;
+    if ((flags & FSAPI_O_ACCMODE) == FSAPI_O_RDONLY) {
+        file = fopen(filename, "rb");
+    } else if (flags & FSAPI_O_TRUNC) {
+        // Without FSAPI_O_CREAT the file must already exist
+        file = fopen(filename, "r+b");
+        if (file) {
+            file = freopen(filename, "w+b", file);
+        } else if (flags & FSAPI_O_CREAT) {
+            file = fopen(filename, "w+b");
+        }
+    } else {
+        file = fopen(filename, "r+b");
+        if (!file && (flags & FSAPI_O_CREAT)) file = fopen(filename, "w+b");
+    }
+    if (!file) return -2; // Error: Could not open file
+
+    fsapi_files[fd].stream = file;
+    fsapi_files[fd].flags = flags;
+    fsapi_files[fd].offset = 0;
+    fsapi_files[fd].pos = 0;
+    fsapi_files[fd].last_op = 0;
+    return fd;
+}
+
+// Function to close a descriptor and flush what was written through it.
+// Parameters:
+//   - fd: A descriptor returned by fs_open().
+// Returns:
+//   - 0 on success, non-zero error code on failure.
+int fs_close(int fd) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f) return -1; // Error: Bad descriptor
+
+    int ret = fclose(f->stream) != 0 ? -3 : 0;
+    f->stream = NULL;
+    return ret;
+}
+
+// Function to read from a file at a given offset without moving the descriptor offset.
+// Parameters:
+//   - fd: A descriptor opened for reading.
+//   - buffer: Where to store the data.
+//   - len: The number of bytes to read.
+//   - offset: The file offset to read from.
+// Returns:
+//   - The number of bytes read (0 at the end of the file), negative error code on failure.
+long fs_pread(int fd, void *buffer, size_t len, long offset) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f || (f->flags & FSAPI_O_ACCMODE) == FSAPI_O_WRONLY) return -1; // Error: Bad descriptor
+    if (!buffer || offset < 0) return -1;
+    if (len == 0) return 0;
+
+    if (fsapi_position(f, offset, 1) != 0) return -3; // Error: Could not seek
+    size_t done = fread(buffer, 1, len, f->stream);
+    f->pos += (long)done;
+    if (done < len) {
+        int failed = ferror(f->stream);
+        clearerr(f->stream);
+        if (failed) {
+            f->pos = -1;
+            return -3; // Error: Could not read from file
+        }
+    }
+    return (long)done;
+}
+
+// Function to write to a file at a given offset without moving the descriptor offset.
+// With FSAPI_O_APPEND the data goes to the end of the file instead.
+// Parameters:
+//   - fd: A descriptor opened for writing.
+//   - buffer: The data to write.
+//   - len: The number of bytes to write.
+//   - offset: The file offset to write at; a gap past the end reads as zeros.
+// Returns:
+//   - The number of bytes written, negative error code on failure.
+long fs_pwrite(int fd, const void *buffer, size_t len, long offset) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f || (f->flags & FSAPI_O_ACCMODE) == FSAPI_O_RDONLY) return -1; // Error: Bad descriptor
+    if (!buffer || offset < 0) return -1;
+    if (len == 0) return 0;
+
+    if (f->flags & FSAPI_O_APPEND) {
+        if (fseek(f->stream, 0, SEEK_END) != 0) return -3; // Error: Could not seek
+        f->pos = ftell(f->stream);
+        f->last_op = 2;
+    } else if (fsapi_position(f, offset, 2) != 0) {
+        return -3; // Error: Could not seek
+    }
+    size_t done = fwrite(buffer, 1, len, f->stream);
+    f->pos += (long)done;
+    if (done < len) {
+        clearerr(f->stream);
+        f->pos = -1;
+        return -3; // Error: Could not write to file
+    }
+    return (long)done;
+}
+
+// Function to read from the descriptor offset and advance it.
+// Parameters:
+//   - fd: A descriptor opened for reading.
+//   - buffer: Where to store the data.
+//   - len: The number of bytes to read.
+// Returns:
+//   - The number of bytes read (0 at the end of the file), negative error code on failure.
+long fs_read(int fd, void *buffer, size_t len) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f) return -1; // Error: Bad descriptor
+
+    long n = fs_pread(fd, buffer, len, f->offset);
+    if (n > 0) f->offset += n;
+    return n;
+}
+
+// Function to write at the descriptor offset (or the end with FSAPI_O_APPEND) and advance it.
+// Parameters:
+//   - fd: A descriptor opened for writing.
+//   - buffer: The data to write.
+//   - len: The number of bytes to write.
+// Returns:
+//   - The number of bytes written, negative error code on failure.
+long fs_write(int fd, const void *buffer, size_t len) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f) return -1; // Error: Bad descriptor
+
+    long n = fs_pwrite(fd, buffer, len, f->offset);
+    if (n > 0) f->offset = (f->flags & FSAPI_O_APPEND) ? f->pos : f->offset + n;
+    return n;
+}
+
+// Function to read into several buffers in one call, starting at the descriptor offset.
+// Parameters:
+//   - fd: A descriptor opened for reading.
+//   - iov: The segments to fill, in order.
+//   - iovcnt: The number of segments.
+// Returns:
+//   - The number of bytes read, negative error code on failure.
+long fs_readv(int fd, const struct fsapi_iovec *iov, int iovcnt) {
+    if (!iov || iovcnt < 0) return -1; // Error: Null parameters
+
+    long total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        long n = fs_read(fd, iov[i].base, iov[i].len);
+        if (n < 0) return total > 0 ? total : n;
+        total += n;
+        if ((size_t)n < iov[i].len) break; // End of the file
+    }
+    return total;
+}
+
+// Function to write several buffers in one call, starting at the descriptor offset.
+// Parameters:
+//   - fd: A descriptor opened for writing.
+//   - iov: The segments to write, in order.
+//   - iovcnt: The number of segments.
+// Returns:
+//   - The number of bytes written, negative error code on failure.
+long fs_writev(int fd, const struct fsapi_iovec *iov, int iovcnt) {
+    if (!iov || iovcnt < 0) return -1; // Error: Null parameters
+
+    long total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        long n = fs_write(fd, iov[i].base, iov[i].len);
+        if (n < 0) return total > 0 ? total : n;
+        total += n;
+    }
+    return total;
+}
+
+// Function to move the descriptor offset.
+// Parameters:
+//   - fd: An open descriptor.
+//   - offset: The new offset, relative to whence.
+//   - whence: FSAPI_SEEK_SET, FSAPI_SEEK_CUR or FSAPI_SEEK_END.
+// Returns:
+//   - The resulting offset, negative error code on failure.
+long fs_lseek(int fd, long offset, int whence) {
+    struct fsapi_file *f = fsapi_file_get(fd);
+    if (!f) return -1; // Error: Bad descriptor
+
+    long base;
+    if (whence == FSAPI_SEEK_SET) {
+        base = 0;
+    } else if (whence == FSAPI_SEEK_CUR) {
+        base = f->offset;
+    } else if (whence == FSAPI_SEEK_END) {
+        if (fseek(f->stream, 0, SEEK_END) != 0) return -3; // Error: Could not seek
+        base = ftell(f->stream);
+        f->pos = base;
+        f->last_op = 0;
+    } else {
+        return -1; // Error: Bad whence
+    }
+    if (base < 0 || base + offset < 0) return -1;
+    f->offset = base + offset;
+    return f->offset;
+}
+
 #endif // FSAPI_H
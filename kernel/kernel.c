@@ -9,6 +9,7 @@
 #include "rtl8188eu.h"
 #include "create_dir.h" // Minimal user api
 #include "fsapi.h" // Kernel and user FS api
+#include "ramfs.h" // In-memory root file system
 #include <net/wireless/atheros/hw.c>
 #include <hdmi/hdmi.c>
 #include <net/wireless/wran/wran.c>
@@ -17,6 +18,7 @@
 #include "ieee80211.h"
 #include <gpio/gpio.c>
 #include "panic.c" // Link kernel panic
+#include "timer.c" // Kernel timers (writeback flusher)
 #include <net/wireless/qcom/qca988x/qca988x.c> // QCOM 988X adapter driver
 #include "boot_menu.h"
 #include "io_dma.h"
@@ -169,6 +171,42 @@ void handle_rtl_connect(const char *input) {
     }
 }
 
+/**
+ * Creates a directory or device node on the mounted root file system.
+ * The parent is resolved through the VFS, the node is created by ramfs
+ * and then entered in the VFS namespace, so later lookups find it.
+ * Returns 0 on success, -1 on error.
+ */
+int root_create(const char *name, int is_directory, const char *config) {
+    char path[VFS_MOUNT_PATH_MAX];
+    if (snprintf(path, sizeof(path), "/%s", name[0] == '/' ? name + 1 : name) >= (int)sizeof(path)) {
+        return -1;
+    }
+
+    // Split into the parent directory and the new name
+    char *slash = strrchr(path, '/');
+    const char *leaf = slash + 1;
+    char parent_path[VFS_MOUNT_PATH_MAX];
+    size_t parent_len = slash == path ? 1 : (size_t)(slash - path);
+    memcpy(parent_path, path, parent_len);
+    parent_path[parent_len] = '\0';
+
+    inode_t *parent = vfs_lookup(parent_path);
+    if (parent == NULL) {
+        return -1;
+    }
+    struct ramfs_node *node = is_directory ? ramfs_mkdir(path) : ramfs_mknod(path, config, strlen(config));
+    inode_t *inode = node != NULL ? vfs_create(parent, leaf, is_directory) : NULL;
+    if (node != NULL && inode == NULL) {
+        ramfs_unlink(path); // Keep the driver and the namespace in step
+    }
+    if (inode != NULL) {
+        inode->ino = node->ino;
+    }
+    iput(parent);
+    return inode != NULL ? 0 : -1;
+}
+
 /**
  * Handles the "mkdir" command by creating a directory.
  */
@@ -179,14 +217,22 @@ void handle_mkdir(const char *input) {
         return;
     }
 
-    int result = create_dir(dir_name); // Call the create_dir function to create the directory
-    if (result == 0) {
+    if (root_create(dir_name, 1, NULL) == 0) { // Created in the in-memory root file system
         printf("Directory '%s' created successfully.\n", dir_name); // Success message
     } else {
         printf("Failed to create directory '%s'.\n", dir_name); // Error message
     }
 }
 
+/**
+ * Creates a driver's device node in the in-memory root file system.
+ */
+void create_devnode(const char *name, const char *config) {
+    if (ramfs_lookup(name) == NULL && root_create(name, 0, config) != 0) {
+        printf("Failed to create device node '%s'.\n", name);
+    }
+}
+
 /**
  * Handles the "ionconfig" command.
  * Allows users to toggle the drivers on/off.
@@ -249,19 +295,19 @@ void handle_ionconfig() {
             if (input == '1') {
                 if (selected_driver == 1) {
                     i2c_option = 1;  // Turn on I2C driver
-                    create_mknod("i2c", "file=i2c.c");
+                    create_devnode("i2c", "file=i2c.c");
                 } else if (selected_driver == 2) {
                     gpio_option = 1;  // Turn on GPIO driver
                     gpio_init();  // Initialize GPIO pins when driver is turned on
-                    create_mknod("gpio", "file=gpio.c");
+                    create_devnode("gpio", "file=gpio.c");
                 } else if (selected_driver == 3) {
                     qca_option = 1;  // Turn on QCA 988X driver
                     qca988x_init();  // Call QCA driver initialization
-                    create_mknod("qca988x", "file=qca988x.c");
+                    create_devnode("qca988x", "file=qca988x.c");
                 } else if (selected_driver == 4) {
                     uwb_option = 1;  // Turn on UWB driver
                     dwuwb_init();  // Initialize UWB driver
-                    create_mknod("uwb-dev", "file=uwb.c");
+                    create_devnode("uwb-dev", "file=uwb.c");
                 }
                 break;
             } else if (input == '2') {
@@ -381,6 +427,7 @@ int main() {
     char time_buffer[9]; // Buffer for storing current time
     const char *prompt = "$ "; // Terminal prompt
 
+    timer_init();
     boot_menu();
     printf_log("Kernel loaded at 0x10000\n");
     printf_log("Kernel booting...\n");
@@ -392,8 +439,18 @@ int main() {
     printf("[HDMI] Driver loaded...\n");
     interactive_text();
 
+    // Namespace operations of the shell stay in memory
+    vfs_init();
+    if (vfs_mount("ram0", &ramfs_ops, FS_TYPE_RAMFS) != 0) {
+        printf("Failed to mount the root file system\n");
+    }
+
     print_welcome();
     while (1) {
+        // No timer interrupt here: run the timers that fell due while the
+        // shell waited for input (e.g. the periodic writeback)
+        timer_poll();
+
         // Get the current time
         get_current_time(time_buffer, sizeof(time_buffer));
 
@@ -0,0 +1,86 @@
+#include <stddef.h>
+#include <time.h>
+#include "timer.h"
+
+// Longest gap timer_poll() catches up on
+#define TIMER_POLL_MAX_MS 60000
+
+// Running timers
+static struct timer *timers[TIMER_MAX];
+static uint64_t last_poll_ms;   // Time of the last timer_poll()
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Count elapsed_ms on every active timer and fire the ones that are due,
+// once for each interval that passed
+static void timer_advance(uint32_t elapsed_ms) {
+    for (int i = 0; i < TIMER_MAX; i++) {
+        struct timer *timer = timers[i];
+        if (timer != NULL && timer->is_active) {
+            timer->counter += elapsed_ms;  // Increment the counter for the active timer
+
+            // If the timer's counter reaches the specified interval, trigger the callback
+            while (timer->is_active && timer->counter >= timer->interval_ms) {
+                timer->counter -= timer->interval_ms;
+                timer->callback();  // Call the callback function
+            }
+        }
+    }
+}
+
+// Initialize all timers (by default, no timer is running)
+void timer_init() {
+    for (int i = 0; i < TIMER_MAX; i++) {
+        timers[i] = NULL;
+    }
+    last_poll_ms = now_ms();
+}
+
+// Start a timer with a specified interval in milliseconds and a callback
+// function; returns -1 when TIMER_MAX timers are already running
+int timer_start(struct timer *timer, uint32_t interval_ms, void (*callback)(void)) {
+    int slot = -1;
+    for (int i = 0; i < TIMER_MAX; i++) {
+        if (timers[i] == timer || (timers[i] == NULL && slot < 0)) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        return -1;
+    }
+
+    timer->interval_ms = interval_ms > 0 ? interval_ms : 1;  // Set the interval for the timer
+    timer->callback = callback;        // Set the callback function
+    timer->counter = 0;                // Reset the counter
+    timer->is_active = 1;              // Mark the timer as active
+    timers[slot] = timer;
+    return 0;
+}
+
+// Stop a timer and forget it
+void timer_stop(struct timer *timer) {
+    timer->is_active = 0;  // Mark the timer as inactive
+    for (int i = 0; i < TIMER_MAX; i++) {
+        if (timers[i] == timer) {
+            timers[i] = NULL;
+        }
+    }
+}
+
+// Update all active timers (this function should be called every millisecond)
+void timer_update() {
+    timer_advance(1);
+}
+
+// Catch up with the time elapsed since the last call, for loops without a
+// millisecond tick
+void timer_poll() {
+    uint64_t now = now_ms();
+    uint64_t elapsed = now - last_poll_ms;
+    last_poll_ms = now;
+    timer_advance(elapsed > TIMER_POLL_MAX_MS ? TIMER_POLL_MAX_MS : (uint32_t)elapsed);
+}